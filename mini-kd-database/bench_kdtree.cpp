@@ -0,0 +1,534 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <thread>
+#include <algorithm>
+#include <atomic>
+#include "src/Database.h"
+#include "src/ShardedDatabase.h"
+#include "src/StaticKDTree.h"
+#include "src/FixedDatabase.h"
+#include "src/DistanceKernels.h"
+
+using Clock = std::chrono::steady_clock;
+
+double elapsedMs(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+std::vector<std::pair<std::vector<double>, std::string>> makeUniform(int count, int dims, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> coord(0.0, 1000.0);
+    std::vector<std::pair<std::vector<double>, std::string>> points;
+    points.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        std::vector<double> coords(dims);
+        for (double& c : coords) c = coord(rng);
+        points.emplace_back(std::move(coords), "p" + std::to_string(i));
+    }
+    return points;
+}
+
+double timeQueries(const Database& db, const std::vector<std::pair<std::vector<double>, std::string>>& targets) {
+    auto start = Clock::now();
+    for (const auto& t : targets) {
+        db.nearestNeighbor(t.first);
+    }
+    return elapsedMs(start);
+}
+
+int main(int argc, char* argv[]) {
+    int count = argc > 1 ? std::atoi(argv[1]) : 1000000;
+    int dims = argc > 2 ? std::atoi(argv[2]) : 3;
+    
+    std::cout << "=== KDTree Benchmark ===" << std::endl;
+    std::cout << "Points: " << count << ", dimensions: " << dims << std::endl;
+    
+    auto points = makeUniform(count, dims, 42);
+    auto targets = makeUniform(10000, dims, 7);
+    
+    // Bulk load vs insert loop
+    std::cout << "\nBulk load vs insert loop" << std::endl;
+    
+    Database looped(dims);
+    auto start = Clock::now();
+    for (const auto& pr : points) {
+        looped.insert(pr.first, pr.second);
+    }
+    double loopMs = elapsedMs(start);
+    std::cout << "  insert loop: " << loopMs << " ms, height " << looped.getHeight()
+              << ", 10k NN queries " << timeQueries(looped, targets) << " ms" << std::endl;
+    
+    Database bulk(dims);
+    start = Clock::now();
+    bulk.bulkLoad(points);
+    double bulkMs = elapsedMs(start);
+    std::cout << "  bulkLoad:    " << bulkMs << " ms, height " << bulk.getHeight()
+              << ", 10k NN queries " << timeQueries(bulk, targets) << " ms" << std::endl;
+    std::cout << "  speedup:     " << loopMs / bulkMs << "x" << std::endl;
+    
+    // Pointer-based tree vs flat static layout
+    std::cout << "\nPointer tree vs flat static layout" << std::endl;
+    
+    std::vector<Point> batch;
+    batch.reserve(points.size());
+    for (const auto& pr : points) {
+        batch.emplace_back(pr.first, pr.second);
+    }
+    KDTree pointerTree(dims);
+    pointerTree.build(batch);
+    start = Clock::now();
+    StaticKDTree flatTree(dims, batch);
+    std::cout << "  static build: " << elapsedMs(start) << " ms" << std::endl;
+    
+    start = Clock::now();
+    for (const auto& t : targets) pointerTree.kNearestNeighbors(t.first, 10);
+    std::cout << "  pointer tree 10k kNN(10): " << elapsedMs(start) << " ms" << std::endl;
+    start = Clock::now();
+    for (const auto& t : targets) flatTree.kNearestNeighbors(t.first, 10);
+    std::cout << "  static tree  10k kNN(10): " << elapsedMs(start) << " ms" << std::endl;
+    std::vector<Neighbor> neighbors;
+    start = Clock::now();
+    for (const auto& t : targets) pointerTree.kNearestNeighbors(t.first, 10, neighbors);
+    std::cout << "  pointer tree 10k kNN(10) into a reused buffer: " << elapsedMs(start) << " ms" << std::endl;
+    start = Clock::now();
+    for (const auto& t : targets) flatTree.kNearestNeighbors(t.first, 10, neighbors);
+    std::cout << "  static tree  10k kNN(10) into a reused buffer: " << elapsedMs(start) << " ms" << std::endl;
+    
+    std::vector<double> boxMin(dims, 400.0), boxMax(dims, 450.0);
+    start = Clock::now();
+    size_t hits = 0;
+    for (int i = 0; i < 100; ++i) hits += pointerTree.rangeQuery(boxMin, boxMax).size();
+    std::cout << "  pointer tree 100 range queries: " << elapsedMs(start) << " ms (" << hits << " hits)" << std::endl;
+    start = Clock::now();
+    hits = 0;
+    for (int i = 0; i < 100; ++i) hits += flatTree.rangeQuery(boxMin, boxMax).size();
+    std::cout << "  static tree  100 range queries: " << elapsedMs(start) << " ms (" << hits << " hits)" << std::endl;
+    
+    // Ball queries: the bounding box plus a distance filter, then the native versions
+    std::cout << "\nRadius queries (100 balls of radius 60)" << std::endl;
+    std::vector<double> center(dims, 500.0), ballMin(dims, 440.0), ballMax(dims, 560.0);
+    start = Clock::now();
+    hits = 0;
+    for (int i = 0; i < 100; ++i) {
+        for (const Point& p : pointerTree.rangeQuery(ballMin, ballMax)) {
+            hits += squaredDistance(p.getCoordinates().data(), center.data(), dims) <= 60.0 * 60.0 ? 1 : 0;
+        }
+    }
+    std::cout << "  box query + filter: " << elapsedMs(start) << " ms (" << hits << " hits)" << std::endl;
+    start = Clock::now();
+    hits = 0;
+    for (int i = 0; i < 100; ++i) hits += pointerTree.radiusQuery(center, 60.0).size();
+    std::cout << "  radiusQuery:        " << elapsedMs(start) << " ms (" << hits << " hits)" << std::endl;
+    start = Clock::now();
+    hits = 0;
+    for (int i = 0; i < 100; ++i) hits += pointerTree.radiusCount(center, 60.0);
+    std::cout << "  radiusCount:        " << elapsedMs(start) << " ms (" << hits << " hits)" << std::endl;
+    start = Clock::now();
+    hits = 0;
+    for (int i = 0; i < 100; ++i) hits += flatTree.radiusCount(center, 60.0);
+    std::cout << "  static radiusCount: " << elapsedMs(start) << " ms (" << hits << " hits)" << std::endl;
+    
+    // Metric policies compile into the same search; the default Euclidean search is the baseline
+    std::cout << "\nDistance metrics, 10k kNN(10) into a reused buffer" << std::endl;
+    start = Clock::now();
+    for (const auto& t : targets) pointerTree.kNearestNeighbors(t.first, 10, neighbors);
+    std::cout << "  default (Euclidean): " << elapsedMs(start) << " ms" << std::endl;
+    auto timeMetric = [&](const char* name, const auto& metric) {
+        auto begin = Clock::now();
+        for (const auto& t : targets) pointerTree.kNearestNeighbors(t.first, 10, metric, neighbors);
+        std::cout << "  " << name << elapsedMs(begin) << " ms" << std::endl;
+    };
+    std::vector<double> weights(dims, 1.0);
+    weights[0] = 4.0;
+    timeMetric("EuclideanMetric:     ", EuclideanMetric());
+    timeMetric("ManhattanMetric:     ", ManhattanMetric());
+    timeMetric("ChebyshevMetric:     ", ChebyshevMetric());
+    timeMetric("weighted Euclidean:  ", WeightedEuclideanMetric(weights));
+    
+    // Materialized vs streaming wide range scan
+    std::cout << "\nWide range scan (whole space)" << std::endl;
+    
+    std::vector<double> wideMin(dims, 0.0), wideMax(dims, 1000.0);
+    start = Clock::now();
+    size_t materialized = bulk.rangeQuery(wideMin, wideMax).size();
+    std::cout << "  rangeQuery:     " << elapsedMs(start) << " ms (" << materialized << " hits)" << std::endl;
+    start = Clock::now();
+    size_t streamedHits = 0;
+    double coordSum = 0.0;
+    bulk.forEachInRange(wideMin, wideMax, [&](const PointView& p) {
+        ++streamedHits;
+        coordSum += p.getCoordinate(0);
+        return true;
+    });
+    std::cout << "  forEachInRange: " << elapsedMs(start) << " ms (" << streamedHits << " hits)" << std::endl;
+    
+    // Batched kNN on the shared worker pool
+    std::cout << "\nBatched kNN(10) over 10k targets" << std::endl;
+    
+    std::vector<std::vector<double>> batchTargets;
+    for (const auto& t : targets) batchTargets.push_back(t.first);
+    int cores = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    for (int threads = 1; threads <= cores; threads *= 2) {
+        start = Clock::now();
+        bulk.kNearestNeighborsBatch(batchTargets, 10, threads);
+        double ms = elapsedMs(start);
+        std::cout << "  " << threads << " thread(s): " << ms << " ms, "
+                  << batchTargets.size() / (ms / 1000.0) << " queries/s" << std::endl;
+    }
+    
+    // Batch distance kernel vs one-at-a-time loop over the flat coordinate block
+    std::cout << "\nBatch distance kernel (" << distanceKernelName() << ")" << std::endl;
+    
+    std::vector<double> flatCoords;
+    flatCoords.reserve(points.size() * dims);
+    for (const auto& pr : points) {
+        flatCoords.insert(flatCoords.end(), pr.first.begin(), pr.first.end());
+    }
+    std::vector<double> distOut(points.size());
+    double checksum = 0.0;
+    start = Clock::now();
+    for (int rep = 0; rep < 10; ++rep) {
+        for (size_t i = 0; i < points.size(); ++i) {
+            distOut[i] = squaredDistance(targets[rep].first.data(), flatCoords.data() + i * dims, dims);
+        }
+        checksum += distOut[rep];
+    }
+    std::cout << "  scalar loop, 10 passes: " << elapsedMs(start) << " ms" << std::endl;
+    start = Clock::now();
+    for (int rep = 0; rep < 10; ++rep) {
+        squaredDistances(targets[rep].first.data(), flatCoords.data(), points.size(), dims, distOut.data());
+        checksum += distOut[rep];
+    }
+    std::cout << "  batch kernel, 10 passes: " << elapsedMs(start) << " ms (checksum " << checksum << ")" << std::endl;
+    
+    // Runtime-dimension tree vs compile-time 3D tree
+    if (dims == 3) {
+        std::cout << "\nRuntime dimensions vs FixedKDTree<3>" << std::endl;
+        std::vector<FixedKDTree<3>::Entry> entries;
+        entries.reserve(points.size());
+        for (const auto& pr : points) {
+            entries.emplace_back(FixedKDTree<3>::Coordinates{{pr.first[0], pr.first[1], pr.first[2]}}, pr.second);
+        }
+        FixedKDTree<3> fixedTree;
+        start = Clock::now();
+        fixedTree.build(entries);
+        std::cout << "  fixed build: " << elapsedMs(start) << " ms" << std::endl;
+        
+        start = Clock::now();
+        for (const auto& t : targets) pointerTree.nearestNeighbor(t.first);
+        std::cout << "  KDTree         10k NN: " << elapsedMs(start) << " ms" << std::endl;
+        start = Clock::now();
+        for (const auto& t : targets) fixedTree.nearestNeighbor({{t.first[0], t.first[1], t.first[2]}});
+        std::cout << "  FixedKDTree<3> 10k NN: " << elapsedMs(start) << " ms" << std::endl;
+    }
+    
+    // Insert stream arriving in sorted order, the worst case for plain descent
+    std::cout << "\nSorted insert stream" << std::endl;
+    
+    auto sorted = points;
+    std::sort(sorted.begin(), sorted.end());
+    Database sortedDb(dims);
+    start = Clock::now();
+    for (const auto& pr : sorted) {
+        sortedDb.insert(pr.first, pr.second);
+    }
+    std::cout << "  insert loop: " << elapsedMs(start) << " ms, height " << sortedDb.getHeight()
+              << ", 10k NN queries " << timeQueries(sortedDb, targets) << " ms" << std::endl;
+    sortedDb.clear();
+    
+    // Startup from a saved snapshot: open maps the file instead of rebuilding
+    std::cout << "\nSnapshot save and open" << std::endl;
+    
+    const std::string snapshotPath = "bench_snapshot.kds";
+    start = Clock::now();
+    bulk.saveSnapshot(snapshotPath);
+    std::cout << "  save:        " << elapsedMs(start) << " ms" << std::endl;
+    start = Clock::now();
+    std::unique_ptr<Database> opened = Database::openSnapshot(snapshotPath);
+    std::cout << "  open:        " << elapsedMs(start) << " ms, " << opened->getSize() << " points" << std::endl;
+    start = Clock::now();
+    opened->nearestNeighbor(targets[0].first);
+    std::cout << "  first NN:    " << elapsedMs(start) << " ms, 10k NN queries "
+              << timeQueries(*opened, targets) << " ms" << std::endl;
+    opened.reset();
+    std::remove(snapshotPath.c_str());
+    
+    // kNN readers running against a steady stream of writes
+    std::cout << "\nConcurrent kNN(10) reads during writes" << std::endl;
+    
+    Database shared(dims);
+    shared.bulkLoad(points);
+    for (int readers = 1; readers <= 8; readers *= 2) {
+        std::atomic<bool> running(true);
+        std::atomic<long> reads(0);
+        std::vector<std::thread> readerThreads;
+        for (int r = 0; r < readers; ++r) {
+            readerThreads.emplace_back([&, r]() {
+                for (size_t i = r; running.load(); i = (i + readers) % targets.size()) {
+                    shared.kNearestNeighbors(targets[i].first, 10);
+                    ++reads;
+                }
+            });
+        }
+        
+        // One writer moving points at a fixed pace
+        long writes = 0;
+        start = Clock::now();
+        while (elapsedMs(start) < 500.0) {
+            const auto& pr = points[writes % points.size()];
+            shared.remove(pr.first);
+            shared.insert(pr.first, pr.second);
+            ++writes;
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        running.store(false);
+        for (std::thread& t : readerThreads) {
+            t.join();
+        }
+        double seconds = elapsedMs(start) / 1000.0;
+        std::cout << "  " << readers << " reader(s): " << static_cast<long>(reads.load() / seconds)
+                  << " reads/s, " << static_cast<long>(writes / seconds) << " write pairs/s" << std::endl;
+    }
+    shared.clear();
+    
+    // Logged inserts under each sync policy, then group commit across threads
+    std::cout << "\nWrite-ahead log" << std::endl;
+    
+    const std::string logPath = "bench_wal.log";
+    const char* policyNames[] = {"every commit", "periodic", "never"};
+    SyncPolicy policies[] = {SyncPolicy::EveryCommit, SyncPolicy::Periodic, SyncPolicy::Never};
+    for (int p = 0; p < 3; ++p) {
+        std::remove(logPath.c_str());
+        LogOptions logOptions;
+        logOptions.sync = policies[p];
+        Database logged(dims);
+        logged.openLog(logPath, logOptions);
+        start = Clock::now();
+        for (size_t i = 0; i < 2000; ++i) {
+            logged.insert(points[i].first, points[i].second);
+        }
+        std::cout << "  2k inserts, sync " << policyNames[p] << ": " << elapsedMs(start) << " ms" << std::endl;
+    }
+    
+    std::remove(logPath.c_str());
+    {
+        WriteAheadLog log(logPath, dims);
+        start = Clock::now();
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 8; ++t) {
+            writers.emplace_back([&log, &points, t]() {
+                for (size_t i = t; i < 2000; i += 8) {
+                    log.commit(log.logInsert(points[i].first, points[i].second));
+                }
+            });
+        }
+        for (std::thread& w : writers) {
+            w.join();
+        }
+        std::cout << "  2k commits from 8 threads: " << elapsedMs(start) << " ms, "
+                  << log.syncCount() << " syncs" << std::endl;
+    }
+    std::remove(logPath.c_str());
+    
+    // Copy-on-write snapshots: taking one is O(1), and writes made while one
+    // is held copy the nodes on their path
+    std::cout << "\nCopy-on-write snapshots" << std::endl;
+    
+    Database versioned(dims);
+    versioned.bulkLoad(points);
+    start = Clock::now();
+    for (int i = 0; i < 1000; ++i) {
+        versioned.snapshot();
+    }
+    std::cout << "  1000 snapshots: " << elapsedMs(start) << " ms" << std::endl;
+    for (int held = 0; held < 2; ++held) {
+        std::unique_ptr<DatabaseSnapshot> view;
+        if (held) {
+            view.reset(new DatabaseSnapshot(versioned.snapshot()));
+        }
+        start = Clock::now();
+        for (size_t i = 0; i < targets.size(); ++i) {
+            const auto& pr = points[i];
+            versioned.remove(pr.first);
+            versioned.insert(pr.first, pr.second);
+        }
+        std::cout << "  10k remove+insert pairs, " << (held ? "snapshot held: " : "no snapshot:   ")
+                  << elapsedMs(start) << " ms" << std::endl;
+    }
+    versioned.clear();
+    
+    // Four shards against one Database: parallel writers, then queries
+    std::cout << "\nSharded database (4 shards)" << std::endl;
+    
+    ShardedDatabase sharded(dims, 4);
+    Database unsharded(dims);
+    start = Clock::now();
+    sharded.bulkLoad(points);
+    std::cout << "  bulk load:   " << elapsedMs(start) << " ms" << std::endl;
+    unsharded.bulkLoad(points);
+    for (int useShards = 0; useShards < 2; ++useShards) {
+        start = Clock::now();
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 4; ++t) {
+            writers.emplace_back([&, t]() {
+                for (size_t i = t; i < targets.size(); i += 4) {
+                    if (useShards) {
+                        sharded.insert(targets[i].first, targets[i].second);
+                    } else {
+                        unsharded.insert(targets[i].first, targets[i].second);
+                    }
+                }
+            });
+        }
+        for (std::thread& w : writers) {
+            w.join();
+        }
+        std::cout << "  10k inserts from 4 threads, " << (useShards ? "sharded: " : "single:  ")
+                  << elapsedMs(start) << " ms" << std::endl;
+    }
+    start = Clock::now();
+    hits = 0;
+    for (int i = 0; i < 100; ++i) hits += sharded.rangeQuery(boxMin, boxMax).size();
+    std::cout << "  100 range queries: " << elapsedMs(start) << " ms (" << hits << " hits)" << std::endl;
+    start = Clock::now();
+    for (const auto& t : targets) sharded.kNearestNeighbors(t.first, 10);
+    std::cout << "  10k kNN(10): " << elapsedMs(start) << " ms" << std::endl;
+    
+    // Approximate kNN: recall against latency, in 8 dimensions where exact search visits most of the tree
+    std::cout << "\nApproximate kNN(10), 8 dimensions, 1k queries" << std::endl;
+    
+    std::vector<Point> widePoints;
+    for (const auto& pr : makeUniform(std::min(count, 200000), 8, 3)) {
+        widePoints.emplace_back(pr.first, pr.second);
+    }
+    KDTree wideTree(8);
+    wideTree.build(widePoints);
+    auto wideTargets = makeUniform(1000, 8, 9);
+    std::vector<std::vector<Point>> truth;
+    for (const auto& t : wideTargets) truth.push_back(wideTree.kNearestNeighbors(t.first, 10));
+    
+    struct ApproxCase { const char* name; double epsilon; size_t maxVisits; };
+    const ApproxCase cases[] = {{"exact        ", 0.0, 0}, {"epsilon 0.5  ", 0.5, 0}, {"epsilon 1    ", 1.0, 0},
+                                {"epsilon 2    ", 2.0, 0}, {"budget 500   ", 0.0, 500}, {"budget 100   ", 0.0, 100},
+                                {"budget 20    ", 0.0, 20}};
+    for (const ApproxCase& c : cases) {
+        SearchOptions options;
+        options.epsilon = c.epsilon;
+        options.maxVisits = c.maxVisits;
+        std::vector<std::vector<Point>> found;
+        int exactCount = 0;
+        start = Clock::now();
+        for (const auto& t : wideTargets) {
+            bool exact = false;
+            found.push_back(wideTree.kNearestNeighbors(t.first, 10, options, exact));
+            exactCount += exact ? 1 : 0;
+        }
+        double ms = elapsedMs(start);
+        
+        size_t matched = 0, wanted = 0;
+        for (size_t i = 0; i < truth.size(); ++i) {
+            wanted += truth[i].size();
+            for (const Point& p : found[i]) {
+                for (const Point& q : truth[i]) {
+                    if (p.getCoordinates() == q.getCoordinates()) {
+                        ++matched;
+                        break;
+                    }
+                }
+            }
+        }
+        std::cout << "  " << c.name << ms << " ms, recall " << static_cast<double>(matched) / wanted
+                  << ", exact " << exactCount << "/" << wideTargets.size() << std::endl;
+    }
+    
+    // Insert/remove churn and teardown on the arena-backed tree
+    std::cout << "\nChurn and clear" << std::endl;
+    
+    KDTree churnTree(dims);
+    churnTree.build(batch);
+    start = Clock::now();
+    for (size_t i = 0; i < targets.size(); ++i) {
+        churnTree.remove(batch[i]);
+        churnTree.insert(Point(targets[i].first, targets[i].second));
+    }
+    std::cout << "  10k remove+insert pairs: " << elapsedMs(start) << " ms" << std::endl;
+    
+    // Removes only shrink leaves; the occasional full rebuild is the slowest one
+    double slowestMs = 0.0;
+    start = Clock::now();
+    for (size_t i = targets.size(); i < batch.size() / 2; ++i) {
+        auto removeStart = Clock::now();
+        churnTree.remove(batch[i]);
+        slowestMs = std::max(slowestMs, elapsedMs(removeStart));
+    }
+    std::cout << "  remove half the points: " << elapsedMs(start) << " ms, slowest remove "
+              << slowestMs << " ms" << std::endl;
+    start = Clock::now();
+    churnTree.clear();
+    std::cout << "  clear " << count << " points: " << elapsedMs(start) << " ms" << std::endl;
+    
+    // Leaf bucket size: memory per point and query cost
+    std::cout << "\nLeaf bucket size" << std::endl;
+    
+    for (int bucket : {4, 16, 32, 64}) {
+        KDTree bucketTree(dims, bucket);
+        start = Clock::now();
+        bucketTree.build(batch);
+        double buildMs = elapsedMs(start);
+        start = Clock::now();
+        for (const auto& t : targets) {
+            bucketTree.nearestNeighbor(t.first);
+        }
+        double nearestMs = elapsedMs(start);
+        start = Clock::now();
+        for (size_t i = 0; i < 1000; ++i) {
+            bucketTree.kNearestNeighbors(targets[i].first, 10);
+        }
+        double kNearestMs = elapsedMs(start);
+        size_t hits = 0;
+        start = Clock::now();
+        for (size_t i = 0; i < 100; ++i) {
+            std::vector<double> lo = targets[i].first, hi = targets[i].first;
+            for (int d = 0; d < dims; ++d) {
+                lo[d] -= 50.0;
+                hi[d] += 50.0;
+            }
+            bucketTree.forEachInRange(lo, hi, [&hits](const PointView&) {
+                ++hits;
+                return true;
+            });
+        }
+        double rangeMs = elapsedMs(start);
+        std::printf("  bucket %2d: build %.1f ms, %.1f bytes/point, height %d, 10k NN %.1f ms, "
+                    "1k kNN(10) %.1f ms, 100 range scans %.2f ms (%zu hits)\n",
+                    bucket, buildMs, static_cast<double>(bucketTree.memoryUsage()) / batch.size(),
+                    bucketTree.height(), nearestMs, kNearestMs, rangeMs, hits);
+    }
+    
+    // Unique values vs 16 labels repeated across all points, stored plainly and interned
+    std::cout << "\nValue storage" << std::endl;
+    std::vector<Point> labelled = batch;
+    for (size_t i = 0; i < labelled.size(); ++i) {
+        labelled[i].setValue("category-" + std::to_string(i % 16));
+    }
+    const char* valueNames[] = {"unique values", "16 labels    "};
+    const std::vector<Point>* valueSets[] = {&batch, &labelled};
+    for (int set = 0; set < 2; ++set) {
+        for (int intern = 0; intern < 2; ++intern) {
+            KDTree valueTree(dims, KDTree::DEFAULT_BUCKET_SIZE, intern == 1);
+            start = Clock::now();
+            valueTree.build(*valueSets[set]);
+            double buildMs = elapsedMs(start);
+            std::printf("  %s, %s: build %.1f ms, %.1f value bytes/point\n", valueNames[set],
+                        intern ? "interned" : "plain   ", buildMs,
+                        static_cast<double>(valueTree.valueMemoryUsage()) / valueSets[set]->size());
+        }
+    }
+    
+    return 0;
+}
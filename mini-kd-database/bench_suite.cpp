@@ -0,0 +1,263 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <numeric>
+#include "src/Database.h"
+
+// Standard workloads for tracking performance between releases.
+//
+// Every combination of dataset, dimension count and size loads a Database
+// point by point, then times range, nearest-neighbor, kNN, move and remove
+// operations one at a time. Each row of the CSV written to stdout gives
+// the throughput and the median and 99th percentile latency of one
+// operation on one workload.
+
+using Clock = std::chrono::steady_clock;
+
+struct SuiteOptions {
+    std::vector<std::string> datasets = {"uniform", "clustered", "sorted", "duplicates"};
+    std::vector<int> dims = {2, 3, 8, 16};
+    std::vector<long> sizes = {1000, 10000, 100000, 1000000};
+    int ops = 1000;  // timed operations per query, move and remove row
+    unsigned seed = 42;
+};
+
+// Coordinates of `count` points back to back, in insertion order
+std::vector<double> makeDataset(const std::string& name, long count, int dims, unsigned seed) {
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> coord(0.0, 1000.0);
+    std::vector<double> coords(static_cast<size_t>(count) * dims);
+    
+    if (name == "clustered") {
+        // 32 Gaussian blobs of width 10 at random centers
+        std::vector<double> centers(32 * dims);
+        for (double& c : centers) c = coord(rng);
+        std::normal_distribution<double> spread(0.0, 10.0);
+        std::uniform_int_distribution<int> pick(0, 31);
+        for (long i = 0; i < count; ++i) {
+            int center = pick(rng);
+            for (int d = 0; d < dims; ++d) {
+                coords[i * dims + d] = centers[center * dims + d] + spread(rng);
+            }
+        }
+    } else if (name == "duplicates") {
+        // Every location is inserted about 16 times; later copies replace the value
+        long distinct = std::max(1L, count / 16);
+        std::vector<double> locations(static_cast<size_t>(distinct) * dims);
+        for (double& c : locations) c = coord(rng);
+        std::uniform_int_distribution<long> pick(0, distinct - 1);
+        for (long i = 0; i < count; ++i) {
+            long location = pick(rng);
+            std::copy_n(locations.begin() + location * dims, dims, coords.begin() + i * dims);
+        }
+    } else {
+        for (double& c : coords) c = coord(rng);
+        if (name == "sorted") {
+            // Ascending along the first axis, the worst insertion order for a K-D tree
+            std::vector<long> order(count);
+            std::iota(order.begin(), order.end(), 0L);
+            std::sort(order.begin(), order.end(), [&coords, dims](long a, long b) {
+                return coords[a * dims] < coords[b * dims];
+            });
+            std::vector<double> sorted(coords.size());
+            for (long i = 0; i < count; ++i) {
+                std::copy_n(coords.begin() + order[i] * dims, dims, sorted.begin() + i * dims);
+            }
+            coords.swap(sorted);
+        }
+    }
+    return coords;
+}
+
+// Latencies of one operation, in microseconds
+class Recorder {
+private:
+    std::vector<double> latencies;
+    double totalSeconds = 0.0;
+
+public:
+    explicit Recorder(size_t expected) { latencies.reserve(expected); }
+    
+    template <typename Operation>
+    void time(Operation&& operation) {
+        auto start = Clock::now();
+        operation();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        totalSeconds += seconds;
+        latencies.push_back(seconds * 1e6);
+    }
+    
+    double percentile(double fraction) {
+        if (latencies.empty()) return 0.0;
+        size_t rank = std::min(latencies.size() - 1, static_cast<size_t>(fraction * latencies.size()));
+        std::nth_element(latencies.begin(), latencies.begin() + rank, latencies.end());
+        return latencies[rank];
+    }
+    
+    void report(const std::string& dataset, int dims, long size, const char* operation) {
+        double opsPerSecond = totalSeconds > 0 ? latencies.size() / totalSeconds : 0.0;
+        std::printf("%s,%d,%ld,%s,%zu,%.6f,%.1f,%.3f,%.3f\n", dataset.c_str(), dims, size, operation,
+                    latencies.size(), totalSeconds, opsPerSecond, percentile(0.50), percentile(0.99));
+        std::fflush(stdout);
+    }
+};
+
+void runWorkload(const SuiteOptions& options, const std::string& dataset, int dims, long size) {
+    std::vector<double> coords = makeDataset(dataset, size, dims, options.seed);
+    std::mt19937_64 rng(options.seed + 1);
+    std::uniform_int_distribution<long> pickPoint(0, size - 1);
+    
+    // Query targets: stored points nudged off their exact coordinates, so
+    // they follow the data wherever it is dense
+    std::normal_distribution<double> nudge(0.0, 1.0);
+    std::vector<double> probes(static_cast<size_t>(options.ops) * dims);
+    for (int i = 0; i < options.ops; ++i) {
+        long source = pickPoint(rng);
+        for (int d = 0; d < dims; ++d) {
+            probes[i * dims + d] = coords[source * dims + d] + nudge(rng);
+        }
+    }
+    auto point = [dims](const std::vector<double>& from, long i) {
+        return std::vector<double>(from.begin() + i * dims, from.begin() + (i + 1) * dims);
+    };
+    
+    Database db(dims);
+    Recorder inserts(size);
+    for (long i = 0; i < size; ++i) {
+        std::vector<double> p = point(coords, i);
+        std::string value = "p" + std::to_string(i);
+        inserts.time([&]() { db.insert(p, value); });
+    }
+    inserts.report(dataset, dims, size, "insert");
+    
+    // Boxes sized to hold about 10 uniform points
+    double halfWidth = 500.0 * std::pow(10.0 / size, 1.0 / dims);
+    Recorder ranges(options.ops);
+    size_t hits = 0;
+    for (int i = 0; i < options.ops; ++i) {
+        std::vector<double> lo = point(probes, i), hi = lo;
+        for (int d = 0; d < dims; ++d) {
+            lo[d] -= halfWidth;
+            hi[d] += halfWidth;
+        }
+        ranges.time([&]() {
+            db.forEachInRange(lo, hi, [&hits](const PointView&) {
+                ++hits;
+                return true;
+            });
+        });
+    }
+    ranges.report(dataset, dims, size, "range");
+    
+    Recorder nearest(options.ops);
+    for (int i = 0; i < options.ops; ++i) {
+        std::vector<double> target = point(probes, i);
+        nearest.time([&]() { db.nearestNeighbor(target); });
+    }
+    nearest.report(dataset, dims, size, "nn");
+    
+    Recorder kNearest(options.ops);
+    for (int i = 0; i < options.ops; ++i) {
+        std::vector<double> target = point(probes, i);
+        kNearest.time([&]() { db.kNearestNeighbors(target, 10); });
+    }
+    kNearest.report(dataset, dims, size, "knn10");
+    
+    // Moves stored points onto the probe locations
+    Recorder updates(options.ops);
+    for (int i = 0; i < options.ops; ++i) {
+        long victim = pickPoint(rng);
+        std::vector<double> from = point(coords, victim), to = point(probes, i);
+        updates.time([&]() { db.update(from, to, "moved"); });
+        std::copy(to.begin(), to.end(), coords.begin() + victim * dims);
+    }
+    updates.report(dataset, dims, size, "update");
+    
+    Recorder removes(options.ops);
+    for (int i = 0; i < options.ops; ++i) {
+        std::vector<double> victim = point(coords, pickPoint(rng));
+        removes.time([&]() { db.remove(victim); });
+    }
+    removes.report(dataset, dims, size, "remove");
+}
+
+// Splits "a,b,c"
+std::vector<std::string> splitList(const char* text) {
+    std::vector<std::string> items(1);
+    for (const char* c = text; *c; ++c) {
+        if (*c == ',') {
+            items.emplace_back();
+        } else {
+            items.back() += *c;
+        }
+    }
+    items.erase(std::remove(items.begin(), items.end(), std::string()), items.end());
+    return items;
+}
+
+void printUsage(const char* program) {
+    std::fprintf(stderr,
+                 "usage: %s [--datasets uniform,clustered,sorted,duplicates] [--dims 2,3,8,16]\n"
+                 "          [--sizes 1000,10000,100000,1000000] [--ops 1000] [--seed 42]\n"
+                 "Writes CSV to stdout: dataset,dims,points,operation,count,seconds,ops_per_sec,p50_us,p99_us\n",
+                 program);
+}
+
+int main(int argc, char* argv[]) {
+    SuiteOptions options;
+    for (int i = 1; i < argc; ++i) {
+        const char* flag = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value || std::strncmp(flag, "--", 2) != 0) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        if (std::strcmp(flag, "--datasets") == 0) {
+            options.datasets = splitList(value);
+        } else if (std::strcmp(flag, "--dims") == 0) {
+            options.dims.clear();
+            for (const std::string& item : splitList(value)) options.dims.push_back(std::atoi(item.c_str()));
+        } else if (std::strcmp(flag, "--sizes") == 0) {
+            options.sizes.clear();
+            for (const std::string& item : splitList(value)) options.sizes.push_back(std::atol(item.c_str()));
+        } else if (std::strcmp(flag, "--ops") == 0) {
+            options.ops = std::atoi(value);
+        } else if (std::strcmp(flag, "--seed") == 0) {
+            options.seed = static_cast<unsigned>(std::atol(value));
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+        ++i;
+    }
+    
+    for (const std::string& dataset : options.datasets) {
+        if (dataset != "uniform" && dataset != "clustered" && dataset != "sorted" && dataset != "duplicates") {
+            std::fprintf(stderr, "unknown dataset: %s\n", dataset.c_str());
+            return 1;
+        }
+    }
+    if (options.ops <= 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    
+    std::printf("dataset,dims,points,operation,count,seconds,ops_per_sec,p50_us,p99_us\n");
+    for (const std::string& dataset : options.datasets) {
+        for (int dims : options.dims) {
+            for (long size : options.sizes) {
+                if (dims > 0 && size > 0) {
+                    runWorkload(options, dataset, dims, size);
+                }
+            }
+        }
+    }
+    return 0;
+}
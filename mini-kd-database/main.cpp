@@ -2,9 +2,19 @@
 #include <vector>
 #include <string>
 #include <limits>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <stdexcept>
 #include "src/KDTree.h"
 #include "src/Point.h"
 #include "src/Database.h"
+#include "src/PointFile.h"
+#include "src/MappedFile.h"
 
 using namespace std;
 
@@ -19,6 +29,8 @@ void printMenu() {
     cout << "7. Update a point" << endl;
     cout << "8. Display all points" << endl;
     cout << "9. Clear tree" << endl;
+    cout << "10. Radius query" << endl;
+    cout << "11. Show statistics" << endl;
     cout << "0. Exit" << endl;
     cout << "Enter your choice: ";
 }
@@ -45,7 +57,242 @@ Point readPoint(int dimensions) {
     return Point(coords, value);
 }
 
-int main() {
+// ---- Batch mode ----
+//
+// kdtree_app --dims D [--data FILE] [--queries FILE] [--output FILE] [--save-binary FILE]
+//
+// Loads the data file (CSV or packed binary, see PointFile.h) with one
+// bulkLoad, then runs the query file: one query per line, numbers
+// separated by spaces or commas, '#' starting a comment line.
+//   search x..      nearest x..      knn k x..      range min.. max..
+//   radius r x..    count r x..      insert x.. [value]    remove x..
+// Each query writes "# <query>: <n>" (points found, counted or changed)
+// followed by the points it returned as CSV lines.
+
+void printUsage(const char* program) {
+    cerr << "usage: " << program << "                   (interactive menu)\n"
+         << "       " << program << " --dims D [--data FILE] [--queries FILE] [--output FILE]\n"
+         << "                 [--save-binary FILE]\n"
+         << "  --data         CSV (x1,...,xD[,value] per line) or packed binary point file\n"
+         << "  --queries      search, nearest, knn, range, radius, count, insert or remove per line\n"
+         << "  --output       write query results here instead of stdout\n"
+         << "  --save-binary  write the loaded data as a packed binary point file" << endl;
+}
+
+// Shortest of %.15g and %.17g that reads back as the same double
+string formatNumber(double x) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.15g", x);
+    if (strtod(buffer, nullptr) != x) {
+        snprintf(buffer, sizeof(buffer), "%.17g", x);
+    }
+    return buffer;
+}
+
+void writePoint(ostream& out, const vector<double>& coords, const string& value) {
+    for (double c : coords) {
+        out << formatNumber(c) << ',';
+    }
+    out << value << '\n';
+}
+
+const char* skipSeparators(const char* p, const char* last) {
+    while (p < last && (*p == ' ' || *p == '\t' || *p == ',')) ++p;
+    return p;
+}
+
+// Parses `count` numbers into out; throws if the line runs out first or a
+// number overflows (1e400) or is otherwise not finite
+const char* readNumbers(const char* p, const char* last, size_t count, vector<double>& out) {
+    out.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        p = skipSeparators(p, last);
+        const char* after = parseDouble(p, last, out[i]);
+        if (!after) {
+            throw invalid_argument("expected " + to_string(count) + " numbers");
+        }
+        if (!isfinite(out[i])) {
+            throw invalid_argument("number " + to_string(i + 1) + " is out of range");
+        }
+        p = after;
+    }
+    return skipSeparators(p, last);
+}
+
+// Runs every query of the file at `path` against db; returns the number run
+size_t runQueries(Database& db, const string& path, ostream& out) {
+    MappedFile file(path);
+    const char* p = file.getData();
+    const char* end = p + file.getSize();
+    size_t dims = static_cast<size_t>(db.getDimensions());
+    size_t lineNumber = 0;
+    size_t queries = 0;
+    vector<double> a, b;
+    vector<pair<vector<double>, string>> results;
+    
+    while (p < end) {
+        const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+        const char* next = lineEnd ? lineEnd + 1 : end;
+        if (!lineEnd) lineEnd = end;
+        if (lineEnd > p && lineEnd[-1] == '\r') --lineEnd;
+        ++lineNumber;
+        const char* line = skipSeparators(p, lineEnd);
+        p = next;
+        if (line == lineEnd || *line == '#') {
+            continue;
+        }
+        
+        try {
+            const char* word = line;
+            while (word < lineEnd && *word != ' ' && *word != '\t' && *word != ',') ++word;
+            string command(line, word);
+            const char* rest = word;
+            size_t found = 0;
+            results.clear();
+            
+            if (command == "search") {
+                rest = readNumbers(rest, lineEnd, dims, a);
+                string value;
+                if (db.getPointValue(a, value)) {
+                    results.emplace_back(a, value);
+                }
+                found = results.size();
+            } else if (command == "nearest") {
+                rest = readNumbers(rest, lineEnd, dims, a);
+                if (!db.isEmpty()) {
+                    results.push_back(db.nearestNeighbor(a));
+                }
+                found = results.size();
+            } else if (command == "knn") {
+                rest = readNumbers(rest, lineEnd, dims + 1, a);
+                if (!(a[0] >= 1 && a[0] <= numeric_limits<int>::max()) || a[0] != static_cast<int>(a[0])) {
+                    throw invalid_argument("k must be a positive integer");
+                }
+                int k = static_cast<int>(a[0]);
+                a.erase(a.begin());
+                results = db.kNearestNeighbors(a, k);
+                found = results.size();
+            } else if (command == "range") {
+                rest = readNumbers(rest, lineEnd, 2 * dims, a);
+                b.assign(a.begin() + dims, a.end());
+                a.resize(dims);
+                results = db.rangeQuery(a, b);
+                found = results.size();
+            } else if (command == "radius" || command == "count") {
+                rest = readNumbers(rest, lineEnd, dims + 1, a);
+                double radius = a[0];
+                a.erase(a.begin());
+                if (command == "radius") {
+                    results = db.radiusQuery(a, radius);
+                    found = results.size();
+                } else {
+                    found = db.radiusCount(a, radius);
+                }
+            } else if (command == "insert") {
+                rest = readNumbers(rest, lineEnd, dims, a);
+                db.insert(a, string(rest, lineEnd));
+                rest = lineEnd;
+                found = 1;
+            } else if (command == "remove") {
+                rest = readNumbers(rest, lineEnd, dims, a);
+                found = db.remove(a) ? 1 : 0;
+            } else {
+                throw invalid_argument("unknown query '" + command + "'");
+            }
+            if (rest != lineEnd) {
+                throw invalid_argument("unexpected text after the query");
+            }
+            
+            out << "# " << string(line, lineEnd) << ": " << found << '\n';
+            for (const auto& pr : results) {
+                writePoint(out, pr.first, pr.second);
+            }
+            ++queries;
+        } catch (const exception& e) {
+            throw runtime_error(path + ":" + to_string(lineNumber) + ": " + e.what());
+        }
+    }
+    out.flush();
+    return queries;
+}
+
+double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+int runBatch(int argc, char* argv[]) {
+    int dimensions = 0;
+    string dataPath, queryPath, outputPath, binaryPath;
+    for (int i = 1; i < argc; ++i) {
+        string flag = argv[i];
+        if (i + 1 >= argc) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        string value = argv[++i];
+        if (flag == "--dims") {
+            dimensions = atoi(value.c_str());
+        } else if (flag == "--data") {
+            dataPath = value;
+        } else if (flag == "--queries") {
+            queryPath = value;
+        } else if (flag == "--output") {
+            outputPath = value;
+        } else if (flag == "--save-binary") {
+            binaryPath = value;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (dimensions <= 0 || (dataPath.empty() && queryPath.empty()) || (dataPath.empty() && !binaryPath.empty())) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    
+    try {
+        Database db(dimensions);
+        if (!dataPath.empty()) {
+            auto start = chrono::steady_clock::now();
+            PointBatch points = readPointBatch(dataPath, dimensions);
+            double parsed = secondsSince(start);
+            db.bulkLoad(points);
+            cerr << "Loaded " << points.size() << " points (" << db.getSize() << " distinct) from " << dataPath
+                 << " in " << secondsSince(start) << " s, " << parsed << " s parsing" << endl;
+            if (!binaryPath.empty()) {
+                writeBinaryPointFile(binaryPath, points);
+            }
+        }
+        
+        if (!queryPath.empty()) {
+            ofstream file;
+            if (!outputPath.empty()) {
+                file.open(outputPath, ios::trunc);
+                if (!file) {
+                    throw runtime_error("Cannot open output file: " + outputPath);
+                }
+            }
+            ostream& out = outputPath.empty() ? cout : file;
+            auto start = chrono::steady_clock::now();
+            size_t count = runQueries(db, queryPath, out);
+            if (!out) {
+                throw runtime_error("Cannot write results");
+            }
+            cerr << "Ran " << count << " queries in " << secondsSince(start) << " s" << endl;
+        }
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1) {
+        ios::sync_with_stdio(false);
+        return runBatch(argc, argv);
+    }
+    
     int dimensions;
     cout << "Enter number of dimensions for KDTree: ";
     while (!(cin >> dimensions) || dimensions <= 0) {
@@ -79,8 +326,8 @@ int main() {
                 case 2: {
                     cout << "\n--- Search Point ---" << endl;
                     vector<double> coords = readCoordinates(dimensions);
-                    string value = db.getPointValue(coords);
-                    if (!value.empty()) {
+                    string value;
+                    if (db.getPointValue(coords, value)) {
                         cout << "Point found in tree! Value: '" << value << "'" << endl;
                     } else {
                         cout << "Point not found in tree." << endl;
@@ -161,8 +408,8 @@ int main() {
                     vector<double> oldCoords = readCoordinates(dimensions);
                     
                     // Check if point exists and get its current value
-                    string oldValue = db.getPointValue(oldCoords);
-                    if (oldValue.empty()) {
+                    string oldValue;
+                    if (!db.getPointValue(oldCoords, oldValue)) {
                         cout << "No point found at coordinates (";
                         for (size_t i = 0; i < oldCoords.size(); ++i) {
                             cout << oldCoords[i] << (i + 1 < oldCoords.size() ? ", " : "");
@@ -221,6 +468,62 @@ int main() {
                     break;
                 }
                 
+                case 10: {
+                    cout << "\n--- Radius Query ---" << endl;
+                    vector<double> target = readCoordinates(dimensions);
+                    double radius;
+                    cout << "Enter radius: ";
+                    while (!(cin >> radius) || radius < 0) {
+                        cin.clear();
+                        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+                        cout << "Please enter a non-negative radius: ";
+                    }
+                    auto results = db.radiusQuery(target, radius);
+                    cout << "Found " << results.size() << " points within " << radius << ":" << endl;
+                    for (const auto& pr : results) {
+                        cout << "  (";
+                        for (size_t i = 0; i < pr.first.size(); ++i) {
+                            cout << pr.first[i] << (i + 1 < pr.first.size() ? ", " : "");
+                        }
+                        cout << ") : '" << pr.second << "'" << endl;
+                    }
+                    break;
+                }
+                
+                case 11: {
+                    cout << "\n--- Statistics ---" << endl;
+                    DatabaseStats stats = db.stats();
+                    if (!stats.enabled) {
+                        cout << "Statistics are not compiled in; rebuild with 'make -B STATS=1'." << endl;
+                        break;
+                    }
+                    cout << fixed << setprecision(1);
+                    bool any = false;
+                    for (int op = 0; op < DatabaseStats::OPERATION_COUNT; ++op) {
+                        const OperationStats& s = stats.operations[op];
+                        if (s.count == 0) {
+                            continue;
+                        }
+                        any = true;
+                        double n = static_cast<double>(s.count);
+                        cout << DatabaseStats::operationName(static_cast<DatabaseStats::Operation>(op))
+                             << ": " << s.count << " ops, mean " << s.meanMicros() << " us"
+                             << ", p50 <= " << s.percentileMicros(0.50) << " us"
+                             << ", p99 <= " << s.percentileMicros(0.99) << " us" << endl;
+                        if (s.work.nodesVisited > 0) {
+                            cout << "    per op: " << s.work.nodesVisited / n << " nodes visited, "
+                                 << s.work.distanceEvaluations / n << " distance evaluations, "
+                                 << s.work.subtreesPruned / n << " subtrees pruned; max depth "
+                                 << s.work.maxDepth << endl;
+                        }
+                    }
+                    if (!any) {
+                        cout << "No operations recorded yet." << endl;
+                    }
+                    cout << defaultfloat << setprecision(6);
+                    break;
+                }
+                
                 case 0: {
                     cout << "Exiting... Thank you!" << endl;
                     break;
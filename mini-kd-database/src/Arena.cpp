@@ -0,0 +1,102 @@
+#include "Arena.h"
+#include <algorithm>
+#include <utility>
+
+namespace {
+const size_t ALIGNMENT = 8;
+const size_t SMALL_LIMIT = 256;
+const size_t SMALL_CLASSES = SMALL_LIMIT / ALIGNMENT;
+const size_t MAX_SLAB = 1 << 22;
+}
+
+Arena::Arena(size_t slabBytes)
+    : cursor(nullptr), remaining(0), slabSize(slabBytes) {}
+
+Arena::Arena(Arena&& other) noexcept
+    : slabs(std::move(other.slabs)), cursor(other.cursor), remaining(other.remaining),
+      slabSize(other.slabSize), freeLists(std::move(other.freeLists)) {
+    other.cursor = nullptr;
+    other.remaining = 0;
+}
+
+Arena& Arena::operator=(Arena&& other) noexcept {
+    if (this != &other) {
+        slabs = std::move(other.slabs);
+        cursor = other.cursor;
+        remaining = other.remaining;
+        slabSize = other.slabSize;
+        freeLists = std::move(other.freeLists);
+        other.cursor = nullptr;
+        other.remaining = 0;
+    }
+    return *this;
+}
+
+size_t Arena::roundedSize(size_t bytes) {
+    if (bytes <= SMALL_LIMIT) {
+        return std::max(ALIGNMENT, (bytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT);
+    }
+    size_t size = SMALL_LIMIT;
+    while (size < bytes) {
+        size *= 2;
+    }
+    return size;
+}
+
+size_t Arena::sizeClass(size_t bytes) {
+    size_t size = roundedSize(bytes);
+    if (size <= SMALL_LIMIT) {
+        return size / ALIGNMENT - 1;
+    }
+    size_t index = SMALL_CLASSES;
+    for (size_t s = SMALL_LIMIT * 2; s < size; s *= 2) {
+        ++index;
+    }
+    return index;
+}
+
+char* Arena::carve(size_t bytes) {
+    if (bytes > remaining) {
+        // Oversized requests get a slab of their own; the current slab keeps its tail
+        if (bytes > slabSize / 4) {
+            slabs.emplace_back(new char[bytes]);
+            return slabs.back().get();
+        }
+        slabs.emplace_back(new char[slabSize]);
+        cursor = slabs.back().get();
+        remaining = slabSize;
+        // Slabs grow geometrically so big trees need few of them
+        slabSize = std::min(slabSize * 2, std::max(slabSize, MAX_SLAB));
+    }
+    char* block = cursor;
+    cursor += bytes;
+    remaining -= bytes;
+    return block;
+}
+
+void* Arena::allocate(size_t bytes) {
+    size_t index = sizeClass(bytes);
+    if (index < freeLists.size() && freeLists[index]) {
+        void* block = freeLists[index];
+        freeLists[index] = *static_cast<void**>(block);
+        return block;
+    }
+    return carve(roundedSize(bytes));
+}
+
+void Arena::deallocate(void* block, size_t bytes) {
+    if (!block) return;
+    size_t index = sizeClass(bytes);
+    if (index >= freeLists.size()) {
+        freeLists.resize(index + 1, nullptr);
+    }
+    *static_cast<void**>(block) = freeLists[index];
+    freeLists[index] = block;
+}
+
+void Arena::release() {
+    slabs.clear();
+    freeLists.clear();
+    cursor = nullptr;
+    remaining = 0;
+}
@@ -0,0 +1,46 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Slab allocator for tree nodes, coordinate buffers and value bytes.
+//
+// Memory is carved out of slabs that double in size as the arena grows and
+// is handed back through per-size free lists, so blocks freed by one remove
+// are reused by the next insert.
+// Every request is rounded up to a size class (multiples of 8 bytes up to
+// 256, powers of two above that); callers must deallocate with the same
+// byte count they allocated. Nothing allocated here has a destructor run:
+// release() drops every slab at once.
+class Arena {
+private:
+    std::vector<std::unique_ptr<char[]>> slabs;
+    char* cursor;
+    size_t remaining;
+    size_t slabSize;
+    std::vector<void*> freeLists;
+
+    static size_t sizeClass(size_t bytes);
+    char* carve(size_t bytes);
+
+public:
+    explicit Arena(size_t slabBytes = 1 << 16);
+
+    Arena(Arena&& other) noexcept;
+    Arena& operator=(Arena&& other) noexcept;
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Single blocks, recycled through the free lists
+    void* allocate(size_t bytes);
+    void deallocate(void* block, size_t bytes);
+
+    // Drops all slabs; every pointer handed out becomes invalid
+    void release();
+
+    static size_t roundedSize(size_t bytes);
+};
+
+#endif // ARENA_H
@@ -0,0 +1,174 @@
+#include "CoordinateIndex.h"
+#include <cstring>
+
+namespace {
+const size_t MIN_SLOTS = 16;
+
+// Slots are grown before more than three quarters of them are in use
+bool overLoaded(size_t entries, size_t slotCount) {
+    return entries * 4 > slotCount * 3;
+}
+}
+
+CoordinateIndex::CoordinateIndex(int dims) : dimensions(dims), count(0) {}
+
+uint64_t CoordinateIndex::hashOf(const double* point) const {
+    uint64_t hash = 0x243f6a8885a308d3ULL;
+    for (int i = 0; i < dimensions; ++i) {
+        // 0.0 == -0.0, so both must hash alike
+        double c = point[i] == 0.0 ? 0.0 : point[i];
+        uint64_t bits;
+        std::memcpy(&bits, &c, sizeof(bits));
+        hash = (hash ^ bits) * 0x9e3779b97f4a7c15ULL;
+        hash ^= hash >> 29;
+    }
+    return hash;
+}
+
+bool CoordinateIndex::sameCoords(uint32_t id, const double* point) const {
+    const double* stored = coords.data() + static_cast<size_t>(id) * dimensions;
+    for (int i = 0; i < dimensions; ++i) {
+        if (stored[i] != point[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Slot holding the key, or the empty slot that ends its probe run
+size_t CoordinateIndex::findSlot(const double* point, uint64_t hash) const {
+    size_t mask = slots.size() - 1;
+    uint32_t tag = static_cast<uint32_t>(hash);
+    for (size_t i = static_cast<size_t>(hash >> 32) & mask; ; i = (i + 1) & mask) {
+        const Slot& slot = slots[i];
+        if (slot.id == NOT_FOUND || (slot.hash == tag && sameCoords(slot.id, point))) {
+            return i;
+        }
+    }
+}
+
+void CoordinateIndex::rehash(size_t slotCount) {
+    std::vector<Slot> old;
+    old.swap(slots);
+    slots.assign(slotCount, Slot{NOT_FOUND, 0});
+    
+    size_t mask = slots.size() - 1;
+    for (const Slot& slot : old) {
+        if (slot.id == NOT_FOUND) continue;
+        size_t i = static_cast<size_t>(hashOf(coords.data() + static_cast<size_t>(slot.id) * dimensions) >> 32) & mask;
+        while (slots[i].id != NOT_FOUND) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = slot;
+    }
+}
+
+void CoordinateIndex::grow() {
+    rehash(slots.empty() ? MIN_SLOTS : slots.size() * 2);
+}
+
+uint32_t CoordinateIndex::find(const double* point) const {
+    if (count == 0) {
+        return NOT_FOUND;
+    }
+    return slots[findSlot(point, hashOf(point))].id;
+}
+
+void CoordinateIndex::prefetch(const double* point) const {
+    if (!slots.empty()) {
+        __builtin_prefetch(&slots[static_cast<size_t>(hashOf(point) >> 32) & (slots.size() - 1)]);
+    }
+}
+
+void CoordinateIndex::insert(const double* point, uint32_t id) {
+    insertIfAbsent(point, id);
+}
+
+uint32_t CoordinateIndex::insertIfAbsent(const double* point, uint32_t id) {
+    if (slots.empty() || overLoaded(count + 1, slots.size())) {
+        grow();
+    }
+    
+    uint64_t hash = hashOf(point);
+    Slot& slot = slots[findSlot(point, hash)];
+    if (slot.id != NOT_FOUND) {
+        return slot.id;
+    }
+    
+    size_t offset = static_cast<size_t>(id) * dimensions;
+    if (coords.size() < offset + dimensions) {
+        coords.resize(offset + dimensions);
+    }
+    std::memcpy(coords.data() + offset, point, dimensions * sizeof(double));
+    slot.id = id;
+    slot.hash = static_cast<uint32_t>(hash);
+    count++;
+    return NOT_FOUND;
+}
+
+// Backward-shift deletion: later entries of the probe run move up into the
+// gap, so no tombstones are needed
+bool CoordinateIndex::erase(const double* point) {
+    if (count == 0) {
+        return false;
+    }
+    
+    size_t mask = slots.size() - 1;
+    size_t gap = findSlot(point, hashOf(point));
+    if (slots[gap].id == NOT_FOUND) {
+        return false;
+    }
+    
+    for (size_t i = (gap + 1) & mask; slots[i].id != NOT_FOUND; i = (i + 1) & mask) {
+        size_t home = static_cast<size_t>(hashOf(coords.data() + static_cast<size_t>(slots[i].id) * dimensions) >> 32) & mask;
+        // Move the entry up unless its home lies cyclically in (gap, i]
+        bool homeInRange = gap < i ? (home > gap && home <= i) : (home > gap || home <= i);
+        if (!homeInRange) {
+            slots[gap] = slots[i];
+            gap = i;
+        }
+    }
+    slots[gap].id = NOT_FOUND;
+    count--;
+    return true;
+}
+
+// Slots stay where they are, since they are placed by the coordinates;
+// only the ids and the coordinates they address move
+void CoordinateIndex::renumber(const std::vector<uint32_t>& newIds) {
+    size_t idCount = 0;
+    for (const Slot& slot : slots) {
+        if (slot.id != NOT_FOUND && newIds[slot.id] >= idCount) idCount = newIds[slot.id] + size_t(1);
+    }
+    std::vector<double> moved(idCount * dimensions);
+    for (Slot& slot : slots) {
+        if (slot.id == NOT_FOUND) continue;
+        uint32_t id = newIds[slot.id];
+        std::memcpy(moved.data() + static_cast<size_t>(id) * dimensions,
+                    coords.data() + static_cast<size_t>(slot.id) * dimensions, dimensions * sizeof(double));
+        slot.id = id;
+    }
+    coords.swap(moved);
+}
+
+void CoordinateIndex::clear() {
+    coords.clear();
+    slots.clear();
+    count = 0;
+}
+
+// Sizes the slots for `entries` in one step rather than doubling up to them
+void CoordinateIndex::reserve(size_t entries) {
+    size_t slotCount = slots.empty() ? MIN_SLOTS : slots.size();
+    while (overLoaded(entries, slotCount)) {
+        slotCount *= 2;
+    }
+    if (slotCount != slots.size()) {
+        rehash(slotCount);
+    }
+    coords.reserve(entries * dimensions);
+}
+
+size_t CoordinateIndex::size() const {
+    return count;
+}
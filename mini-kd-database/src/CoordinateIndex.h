@@ -0,0 +1,60 @@
+#ifndef COORDINATE_INDEX_H
+#define COORDINATE_INDEX_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Hash index from exact coordinates to 32-bit ids, used by Database to find
+// a point's value without walking the tree.
+//
+// Open addressing with linear probing over a flat slot array; the
+// coordinates of id i are kept at i * dimensions in one flat vector, so
+// neither lookups nor inserts allocate per entry. Keys compare with ==, so
+// 0.0 and -0.0 are the same key and NaN coordinates are never found.
+class CoordinateIndex {
+public:
+    static const uint32_t NOT_FOUND = UINT32_MAX;
+
+private:
+    struct Slot {
+        uint32_t id;    // NOT_FOUND when empty
+        uint32_t hash;  // low bits of the full hash, checked before the coordinates
+    };
+
+    int dimensions;
+    std::vector<double> coords;
+    std::vector<Slot> slots;
+    size_t count;
+
+    uint64_t hashOf(const double* point) const;
+    bool sameCoords(uint32_t id, const double* point) const;
+    size_t findSlot(const double* point, uint64_t hash) const;
+    void rehash(size_t slotCount);
+    void grow();
+
+public:
+    explicit CoordinateIndex(int dims);
+
+    // Id stored for these coordinates, or NOT_FOUND
+    uint32_t find(const double* point) const;
+    // Adds a key that is not in the index yet
+    void insert(const double* point, uint32_t id);
+    // Adds the key unless it is there already, in one probe. Returns the id
+    // it already had, or NOT_FOUND if it was added.
+    uint32_t insertIfAbsent(const double* point, uint32_t id);
+    bool erase(const double* point);
+    // Starts loading the slot a lookup of point probes first. Probes of
+    // random keys miss the cache, so loops over many keys issue this a few
+    // keys ahead of the one they look up.
+    void prefetch(const double* point) const;
+    // Gives every entry the id newIds[its id]; the new ids must be distinct.
+    // No key is hashed again.
+    void renumber(const std::vector<uint32_t>& newIds);
+
+    void clear();
+    void reserve(size_t entries);
+    size_t size() const;
+};
+
+#endif // COORDINATE_INDEX_H
@@ -1,75 +1,431 @@
 #include "Database.h"
 #include <stdexcept>
 #include <algorithm>
+#include <thread>
+#include <fstream>
+#include <cstdio>
 
-Database::Database(int dims) : tree(dims), dimensions(dims) {}
+namespace {
+// How many points ahead bulkLoad prefetches the dedup slot it will probe
+const size_t PREFETCH_DISTANCE = 8;
+}
+
+Database::Database(int dims, bool internValues)
+    : tree(dims, KDTree::DEFAULT_BUCKET_SIZE, internValues), dimensions(dims), index(dims), hiddenCount(0) {}
 
 void Database::insert(const std::vector<double>& coordinates, const std::string& value) {
     if (coordinates.size() != dimensions) {
         throw std::invalid_argument("Point dimensions do not match database dimensions");
     }
-    tree.insert(Point(coordinates, value));
+    KD_STATS_TIME(statsRecorder, DatabaseStats::INSERT);
+    
+    std::lock_guard<std::mutex> serial(writeMutex);
+    logChange([&](WriteAheadLog& log) { return log.logInsert(coordinates, value); });
+    WriteGuard lock(rwLock);
+    insertEntry(coordinates, value);
+}
+
+void Database::insertEntry(const std::vector<double>& coordinates, const std::string& value) {
+    KDTree::ValueId id = index.find(coordinates.data());
+    if (id != CoordinateIndex::NOT_FOUND) {
+        reindex(coordinates, id, tree.setValue(coordinates, id, value));
+        return;
+    }
+    hide(coordinates);
+    index.insert(coordinates.data(), tree.insert(Point(coordinates, value)));
+    materializeIfLarge();
+}
+
+// While a snapshot shares the old value, setting a value gives it a new handle
+void Database::reindex(const std::vector<double>& coordinates, KDTree::ValueId oldId, KDTree::ValueId newId) {
+    if (newId != oldId) {
+        index.erase(coordinates.data());
+        index.insert(coordinates.data(), newId);
+    }
+}
+
+void Database::bulkLoad(const std::vector<std::pair<std::vector<double>, std::string>>& points,
+                        bool replace) {
+    PointBatch batch(dimensions);
+    batch.reserve(points.size());
+    for (const auto& pr : points) {
+        if (pr.first.size() != static_cast<size_t>(dimensions)) {
+            throw std::invalid_argument("Point dimensions do not match database dimensions");
+        }
+        batch.add(pr.first, pr.second);
+    }
+    bulkLoad(batch, replace);
+}
+
+// Builds a balanced tree from the whole batch instead of inserting point by point
+void Database::bulkLoad(const PointBatch& points, bool replace) {
+    if (points.getDimensions() != dimensions) {
+        throw std::invalid_argument("Point dimensions do not match database dimensions");
+    }
+    KD_STATS_TIME(statsRecorder, DatabaseStats::BULK_LOAD);
+    
+    std::lock_guard<std::mutex> serial(writeMutex);
+    
+    // Same rule as insert: one point per coordinate, the last value wins.
+    // chosen[position] is the input point that fills each position; a batch
+    // without repeats is used as it is.
+    CoordinateIndex positions(dimensions);
+    positions.reserve(points.size());
+    std::vector<uint32_t> chosen;
+    chosen.reserve(points.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+        if (i + PREFETCH_DISTANCE < points.size()) {
+            positions.prefetch(points.coordinatesOf(i + PREFETCH_DISTANCE));
+        }
+        uint32_t position = positions.insertIfAbsent(points.coordinatesOf(i), static_cast<uint32_t>(chosen.size()));
+        if (position == CoordinateIndex::NOT_FOUND) {
+            chosen.push_back(static_cast<uint32_t>(i));
+        } else {
+            chosen[position] = static_cast<uint32_t>(i);
+        }
+    }
+    PointBatch distinct(dimensions);
+    if (chosen.size() < points.size()) {
+        distinct.reserve(chosen.size());
+        for (uint32_t i : chosen) {
+            PointView point = points.view(i);
+            distinct.add(point.getCoordinates(), point.getValueData(), point.getValueLength());
+        }
+    }
+    const PointBatch& batch = chosen.size() < points.size() ? distinct : points;
+    
+    // With a log open the batch is saved as a snapshot file and logged as
+    // one record naming it, instead of one record per point. A replacing
+    // load then serves that file and builds no tree.
+    if (wal) {
+        std::string loadPath = saveLoadFile(batch);
+        std::shared_ptr<const StaticKDTree> file;
+        try {
+            if (replace) {
+                file = std::make_shared<StaticKDTree>(StaticKDTree::open(loadPath));
+            }
+            logChange([&](WriteAheadLog& log) { return replace ? log.logLoad(loadPath) : log.logMerge(loadPath); });
+        } catch (...) {
+            std::remove(loadPath.c_str());
+            loadFiles.pop_back();
+            throw;
+        }
+        if (replace) {
+            WriteGuard lock(rwLock);
+            mapFile(std::move(file));
+            return;
+        }
+    }
+    
+    if (replace) {
+        WriteGuard lock(rwLock);
+        replaceEntries(batch, std::move(positions));
+        return;
+    }
+    std::vector<Point> merged;
+    merged.reserve(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+        merged.push_back(batch.view(i).toPoint());
+    }
+    WriteGuard lock(rwLock);
+    mergeEntries(std::move(merged));
+}
+
+// Saves a bulk load's batch next to the log. The names in use are .load1
+// up to the count, as a failed load gives its name back.
+std::string Database::saveLoadFile(const PointBatch& batch) {
+    std::string path = wal->getPath() + ".load" + std::to_string(loadFiles.size() + 1);
+    std::vector<PointView> views;
+    views.reserve(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+        views.push_back(batch.view(i));
+    }
+    StaticKDTree(dimensions, views).save(path);
+    loadFiles.push_back(path);
+    return path;
+}
+
+// `batch` holds one point per coordinate and `positions` indexes it. The
+// rebuild hands out fresh value handles, so that index is renumbered
+// instead of rebuilding one by hashing every point again.
+void Database::replaceEntries(const PointBatch& batch, CoordinateIndex positions) {
+    mapped.reset();
+    hidden.reset();
+    hiddenCount = 0;
+    std::vector<KDTree::ValueId> ids;
+    tree.build(batch, &ids);
+    positions.renumber(ids);
+    index = std::move(positions);
+}
+
+// Batch points that land on stored ones just overwrite them
+void Database::mergeEntries(std::vector<Point> batch) {
+    materialize();
+    std::vector<Point> fresh;
+    fresh.reserve(batch.size());
+    for (Point& point : batch) {
+        const std::vector<double>& coords = point.getCoordinates();
+        KDTree::ValueId stored = index.find(coords.data());
+        if (stored != CoordinateIndex::NOT_FOUND) {
+            reindex(coords, stored, tree.setValue(coords, stored, point.getValue()));
+        } else {
+            fresh.push_back(std::move(point));
+        }
+    }
+    tree.build(std::move(fresh), false);
+    rebuildIndex();
+}
+
+void Database::saveSnapshot(const std::string& path) {
+    snapshot().save(path);
+}
+
+std::unique_ptr<Database> Database::openSnapshot(const std::string& path) {
+    std::shared_ptr<const StaticKDTree> file = std::make_shared<StaticKDTree>(StaticKDTree::open(path));
+    std::unique_ptr<Database> db(new Database(file->getDimensions()));
+    db->mapFile(std::move(file));
+    return db;
+}
+
+// Taking a view starts a new tree epoch, which counts as a change
+DatabaseSnapshot Database::snapshot() {
+    WriteGuard lock(rwLock);
+    return DatabaseSnapshot(tree.snapshot(), mapped, hidden, hiddenCount, dimensions);
+}
+
+MappedDelta Database::overlay() const {
+    return MappedDelta(*mapped, hidden.get(), hiddenCount, tree);
+}
+
+// Serves `file` in place of the current contents
+void Database::mapFile(std::shared_ptr<const StaticKDTree> file) {
+    if (file->getDimensions() != dimensions) {
+        throw std::runtime_error("Snapshot does not match database dimensions");
+    }
+    clearEntries();
+    mapped = std::move(file);
+}
+
+// Hides the mapped file's copy of the point at `coordinates`, if it has a
+// visible one, and tells whether it did
+bool Database::hide(const std::vector<double>& coordinates) {
+    size_t position = mapped ? mapped->locate(coordinates) : StaticKDTree::NOT_FOUND;
+    if (position == StaticKDTree::NOT_FOUND || (hidden && (*hidden)[position])) {
+        return false;
+    }
+    if (!hidden) {
+        hidden = std::make_shared<std::vector<bool>>(mapped->size());
+    } else if (hidden.use_count() > 1) {
+        hidden = std::make_shared<std::vector<bool>>(*hidden);
+    }
+    (*hidden)[position] = true;
+    hiddenCount++;
+    return true;
+}
+
+// Past a quarter of the file, queries that search both the file and the
+// changes cost more than the rebuild saves
+void Database::materializeIfLarge() {
+    if (mapped && (static_cast<size_t>(tree.size()) + hiddenCount) * 4 > static_cast<size_t>(mapped->size())) {
+        materialize();
+    }
+}
+
+// Copies the mapped file and its changes into the dynamic tree
+void Database::materialize() {
+    if (!mapped) {
+        return;
+    }
+    tree.build(overlay().getAllPoints());
+    rebuildIndex();
+    mapped.reset();
+    hidden.reset();
+    hiddenCount = 0;
+}
+
+void Database::clearEntries() {
+    mapped.reset();
+    hidden.reset();
+    hiddenCount = 0;
+    tree.clear();
+    index.clear();
+}
+
+void Database::openLog(const std::string& path, const LogOptions& options) {
+    std::shared_ptr<WriteAheadLog> log = std::make_shared<WriteAheadLog>(path, dimensions, options);
+    std::lock_guard<std::mutex> serial(writeMutex);
+    WriteGuard lock(rwLock);
+    // Replay before attaching, so replayed changes are not logged again
+    wal.reset();
+    loadFiles.clear();
+    log->replay([this](const WriteAheadLog::Record& record) {
+        applyLogRecord(record);
+    });
+    wal = std::move(log);
+}
+
+// Every record replays as a blind write (upsert, remove-if-present), so
+// replaying records already contained in the snapshot is harmless. That
+// happens if a crash lands between the two steps of checkpoint().
+void Database::applyLogRecord(const WriteAheadLog::Record& record) {
+    switch (record.type) {
+        case WriteAheadLog::INSERT:
+        case WriteAheadLog::UPDATE:
+            insertEntry(record.coordinates, record.value);
+            break;
+        case WriteAheadLog::REMOVE:
+            removeEntry(record.coordinates);
+            break;
+        case WriteAheadLog::MOVE:
+            removeEntry(record.coordinates);
+            insertEntry(record.newCoordinates, record.value);
+            break;
+        case WriteAheadLog::CLEAR:
+            clearEntries();
+            break;
+        case WriteAheadLog::LOAD:
+            loadFiles.push_back(record.value);
+            mapFile(std::make_shared<StaticKDTree>(StaticKDTree::open(record.value)));
+            break;
+        case WriteAheadLog::MERGE:
+            loadFiles.push_back(record.value);
+            mergeEntries(StaticKDTree::open(record.value).getAllPoints());
+            break;
+    }
+}
+
+// writeMutex keeps writers out between the view and the truncation, so
+// the log holds nothing the view lacks; queries carry on throughout.
+// save() has synced the snapshot and its directory entry by the time it
+// returns, so the log is only emptied once the snapshot is sure to survive
+// a crash.
+void Database::checkpoint(const std::string& snapshotPath) {
+    std::lock_guard<std::mutex> serial(writeMutex);
+    snapshot().save(snapshotPath);
+    if (wal) {
+        wal->truncate();
+    }
+    for (const std::string& path : loadFiles) {
+        std::remove(path.c_str());
+    }
+    loadFiles.clear();
+}
+
+std::unique_ptr<Database> Database::recover(int dims, const std::string& snapshotPath,
+                                            const std::string& logPath, const LogOptions& options) {
+    std::unique_ptr<Database> db;
+    if (std::ifstream(snapshotPath).good()) {
+        db = openSnapshot(snapshotPath);
+        if (db->getDimensions() != dims) {
+            throw std::runtime_error("Snapshot does not match database dimensions: " + snapshotPath);
+        }
+    } else {
+        db.reset(new Database(dims));
+    }
+    db->openLog(logPath, options);
+    return db;
+}
+
+void Database::rebuildIndex() {
+    index.clear();
+    index.reserve(tree.size());
+    tree.forEachPoint([this](const PointView& p) {
+        index.insert(p.getCoordinates(), p.getValueId());
+        return true;
+    });
 }
 
 bool Database::remove(const std::vector<double>& coordinates) {
     if (coordinates.size() != dimensions) {
         return false;
     }
-    return tree.remove(Point(coordinates, ""));
+    KD_STATS_TIME(statsRecorder, DatabaseStats::REMOVE);
+    
+    std::lock_guard<std::mutex> serial(writeMutex);
+    if (!holds(coordinates)) {
+        return false;
+    }
+    logChange([&](WriteAheadLog& log) { return log.logRemove(coordinates); });
+    WriteGuard lock(rwLock);
+    removeEntry(coordinates);
+    return true;
+}
+
+bool Database::removeEntry(const std::vector<double>& coordinates) {
+    KDTree::ValueId id = index.find(coordinates.data());
+    if (id == CoordinateIndex::NOT_FOUND) {
+        // A point only the mapped file holds is removed by hiding it
+        bool hid = hide(coordinates);
+        materializeIfLarge();
+        return hid;
+    }
+    tree.remove(coordinates, id);
+    index.erase(coordinates.data());
+    return true;
 }
 
 std::string Database::search(const std::vector<double>& coordinates) const {
     if (coordinates.size() != dimensions) {
         throw std::invalid_argument("Point dimensions do not match database dimensions");
     }
-    
-    Point searchPoint(coordinates, "");
-    if (tree.search(searchPoint)) {
-        // Note: This is a limitation - we need to find the actual point to get its value
-        // For now, return empty string if found
-        return ""; // In a real implementation, we'd need to store values separately
-    }
-    return "";
+    return getPointValue(coordinates);
 }
 
+// A value-only update rewrites the value in place; the tree is not touched
 bool Database::update(const std::vector<double>& oldCoords, const std::string& newValue) {
     if (oldCoords.size() != dimensions) {
         return false;
     }
+    KD_STATS_TIME(statsRecorder, DatabaseStats::UPDATE);
     
-    // Get the old value first
-    std::string oldValue = getPointValue(oldCoords);
-    if (oldValue.empty()) {
+    std::lock_guard<std::mutex> serial(writeMutex);
+    if (!holds(oldCoords)) {
         return false;  // Point doesn't exist
     }
-    
-    // Remove old point and insert new one with updated value
-    bool removed = tree.remove(Point(oldCoords, oldValue));
-    if (removed) {
-        tree.insert(Point(oldCoords, newValue));
-        return true;
+    logChange([&](WriteAheadLog& log) { return log.logUpdate(oldCoords, newValue); });
+    WriteGuard lock(rwLock);
+    setEntryValue(oldCoords, newValue);
+    return true;
+}
+
+bool Database::setEntryValue(const std::vector<double>& coordinates, const std::string& value) {
+    if (!holds(coordinates)) {
+        return false;
     }
-    return false;
+    insertEntry(coordinates, value);
+    return true;
 }
 
 bool Database::update(const std::vector<double>& oldCoords, const std::vector<double>& newCoords, const std::string& newValue) {
     if (oldCoords.size() != dimensions || newCoords.size() != dimensions) {
         return false;
     }
+    KD_STATS_TIME(statsRecorder, DatabaseStats::UPDATE);
     
-    // Get the old value first
-    std::string oldValue = getPointValue(oldCoords);
-    if (oldValue.empty()) {
+    std::lock_guard<std::mutex> serial(writeMutex);
+    if (!holds(oldCoords)) {
         return false;  // Point doesn't exist
     }
-    
-    // Remove old point and insert new one with updated value
-    bool removed = tree.remove(Point(oldCoords, oldValue));
-    if (removed) {
-        tree.insert(Point(newCoords, newValue));
-        return true;
+    moveEntry(oldCoords, newCoords, newValue);
+    return true;
+}
+
+// Logs and applies the move of a point known to exist. Callers hold writeMutex.
+void Database::moveEntry(const std::vector<double>& oldCoords, const std::vector<double>& newCoords,
+                         const std::string& newValue) {
+    if (oldCoords == newCoords) {
+        logChange([&](WriteAheadLog& log) { return log.logUpdate(oldCoords, newValue); });
+        WriteGuard lock(rwLock);
+        setEntryValue(oldCoords, newValue);
+        return;
     }
-    return false;
+    
+    // Moving a point removes it and inserts it at the new coordinates,
+    // replacing whatever was stored there. One log record covers both steps.
+    logChange([&](WriteAheadLog& log) { return log.logMove(oldCoords, newCoords, newValue); });
+    WriteGuard lock(rwLock);
+    removeEntry(oldCoords);
+    insertEntry(newCoords, newValue);
 }
 
 // Enhanced update method that preserves old value
@@ -79,39 +435,62 @@ std::pair<std::vector<double>, std::string> Database::updateAndGetOld(const std:
     if (oldCoords.size() != dimensions || newCoords.size() != dimensions) {
         return {{}, ""};
     }
+    KD_STATS_TIME(statsRecorder, DatabaseStats::UPDATE);
     
-    // First, find the old point to get its current value
-    Point oldPoint(oldCoords, "");
-    if (!tree.search(oldPoint)) {
+    // Read the old value through the index before the point moves; both
+    // steps happen under writeMutex
+    std::string oldValue;
+    std::lock_guard<std::mutex> serial(writeMutex);
+    if (!findValue(oldCoords, oldValue)) {
         return {{}, ""};
     }
-    
-    // Get the old value (this would need enhancement in a real implementation)
-    std::string oldValue = "value_at_" + std::to_string(oldCoords[0]); // Placeholder
-    
-    // Remove old point
-    bool removed = tree.remove(Point(oldCoords, ""));
-    if (removed) {
-        // Insert new point
-        tree.insert(Point(newCoords, newValue));
-        return {oldCoords, oldValue};
-    }
-    
-    return {{}, ""};
+    moveEntry(oldCoords, newCoords, newValue);
+    return {oldCoords, oldValue};
 }
 
 std::string Database::getPointValue(const std::vector<double>& coordinates) const {
+    std::string value;
+    getPointValue(coordinates, value);
+    return value;
+}
+
+bool Database::getPointValue(const std::vector<double>& coordinates, std::string& value) const {
+    KD_STATS_TIME(statsRecorder, DatabaseStats::LOOKUP);
+    ReadGuard lock(rwLock);
+    return findValue(coordinates, value);
+}
+
+bool Database::findValue(const std::vector<double>& coordinates, std::string& value) const {
     if (coordinates.size() != dimensions) {
-        return "";
+        return false;
     }
     
-    // Use range query to find the exact point
-    auto results = rangeQuery(coordinates, coordinates);
-    if (!results.empty()) {
-        return results[0].second;
+    KDTree::ValueId id = index.find(coordinates.data());
+    if (id == CoordinateIndex::NOT_FOUND) {
+        return mapped && overlay().findValue(coordinates, value);
     }
-    
-    return "";
+    tree.getValue(id, value);
+    return true;
+}
+
+bool Database::contains(const std::vector<double>& coordinates) const {
+    if (coordinates.size() != static_cast<size_t>(dimensions)) {
+        return false;
+    }
+    KD_STATS_TIME(statsRecorder, DatabaseStats::LOOKUP);
+    ReadGuard lock(rwLock);
+    return holds(coordinates);
+}
+
+bool Database::holds(const std::vector<double>& coordinates) const {
+    if (index.find(coordinates.data()) != CoordinateIndex::NOT_FOUND) {
+        return true;
+    }
+    if (!mapped) {
+        return false;
+    }
+    size_t position = mapped->locate(coordinates);
+    return position != StaticKDTree::NOT_FOUND && !(hidden && (*hidden)[position]);
 }
 
 std::vector<std::pair<std::vector<double>, std::string>> Database::rangeQuery(
@@ -121,16 +500,42 @@ std::vector<std::pair<std::vector<double>, std::string>> Database::rangeQuery(
         throw std::invalid_argument("Range dimensions do not match database dimensions");
     }
     
-    std::vector<Point> points = tree.rangeQuery(min, max);
+    // Build each result straight from the stored data instead of via an intermediate Point
     std::vector<std::pair<std::vector<double>, std::string>> results;
+    forEachInRange(min, max, [&results](const PointView& p) {
+        results.emplace_back(p.copyCoordinates(), p.getValue());
+        return true;
+    });
     
-    for (const Point& p : points) {
-        results.emplace_back(p.getCoordinates(), p.getValue());
+    return results;
+}
+
+std::vector<std::pair<std::vector<double>, std::string>> Database::radiusQuery(
+    const std::vector<double>& target, double radius) const {
+    
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match database dimensions");
     }
     
+    std::vector<std::pair<std::vector<double>, std::string>> results;
+    forEachInRadius(target, radius, [&results](const PointView& p) {
+        results.emplace_back(p.copyCoordinates(), p.getValue());
+        return true;
+    });
+    
     return results;
 }
 
+size_t Database::radiusCount(const std::vector<double>& target, double radius) const {
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match database dimensions");
+    }
+    
+    KD_STATS_TIME(statsRecorder, DatabaseStats::RADIUS);
+    ReadGuard lock(rwLock);
+    return mapped ? overlay().radiusCount(target, radius) : tree.radiusCount(target, radius);
+}
+
 std::pair<std::vector<double>, std::string> Database::nearestNeighbor(
     const std::vector<double>& target) const {
     
@@ -138,17 +543,65 @@ std::pair<std::vector<double>, std::string> Database::nearestNeighbor(
         throw std::invalid_argument("Target dimensions do not match database dimensions");
     }
     
-    Point nearest = tree.nearestNeighbor(target);
+    KD_STATS_TIME(statsRecorder, DatabaseStats::NEAREST);
+    ReadGuard lock(rwLock);
+    Point nearest = mapped ? overlay().nearestNeighbor(target) : tree.nearestNeighbor(target);
     return {nearest.getCoordinates(), nearest.getValue()};
 }
 
 
 std::vector<std::pair<std::vector<double>, std::string>> Database::kNearestNeighbors(
-    const std::vector<double>& target, int k) const {
+    const std::vector<double>& target, int k, double maxDistSq) const {
     if (target.size() != dimensions) {
         throw std::invalid_argument("Target dimensions do not match database dimensions");
     }
-    std::vector<Point> points = tree.kNearestNeighbors(target, k);
+    KD_STATS_TIME(statsRecorder, DatabaseStats::K_NEAREST);
+    // The search yields views, so results are copied out once, under the lock
+    std::vector<Neighbor> nearest;
+    std::vector<std::pair<std::vector<double>, std::string>> results;
+    ReadGuard lock(rwLock);
+    if (mapped) {
+        overlay().kNearestNeighbors(target, k, nearest);
+    } else {
+        tree.kNearestNeighbors(target, k, nearest, maxDistSq);
+    }
+    results.reserve(nearest.size());
+    for (const Neighbor& n : nearest) {
+        // The mapped tree takes no bound, so its results are cut here
+        if (n.distSq >= maxDistSq && maxDistSq != std::numeric_limits<double>::infinity()) {
+            break;
+        }
+        results.emplace_back(n.point.copyCoordinates(), n.point.getValue());
+    }
+    return results;
+}
+
+std::pair<std::vector<double>, std::string> Database::nearestNeighbor(
+    const std::vector<double>& target, const SearchOptions& options, bool& exact) const {
+    
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match database dimensions");
+    }
+    
+    KD_STATS_TIME(statsRecorder, DatabaseStats::NEAREST);
+    ReadGuard lock(rwLock);
+    exact = true;
+    Point nearest = mapped ? overlay().nearestNeighbor(target) : tree.nearestNeighbor(target, options, exact);
+    return {nearest.getCoordinates(), nearest.getValue()};
+}
+
+std::vector<std::pair<std::vector<double>, std::string>> Database::kNearestNeighbors(
+    const std::vector<double>& target, int k, const SearchOptions& options, bool& exact) const {
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match database dimensions");
+    }
+    KD_STATS_TIME(statsRecorder, DatabaseStats::K_NEAREST);
+    std::vector<Point> points;
+    {
+        ReadGuard lock(rwLock);
+        exact = true;
+        points = mapped ? overlay().kNearestNeighbors(target, k) : tree.kNearestNeighbors(target, k, options, exact);
+    }
     std::vector<std::pair<std::vector<double>, std::string>> results;
     for (const Point& p : points) {
         results.emplace_back(p.getCoordinates(), p.getValue());
@@ -156,12 +609,73 @@ std::vector<std::pair<std::vector<double>, std::string>> Database::kNearestNeigh
     return results;
 }
 
+ThreadPool& Database::threadPool() const {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (!pool) {
+        int cores = static_cast<int>(std::thread::hardware_concurrency());
+        // The calling thread joins in, so one fewer worker covers every core
+        pool.reset(new ThreadPool(std::max(cores - 1, 1)));
+    }
+    return *pool;
+}
+
+std::vector<std::vector<std::pair<std::vector<double>, std::string>>> Database::rangeQueryBatch(
+    const std::vector<std::pair<std::vector<double>, std::vector<double>>>& ranges, int threads) const {
+    
+    std::vector<std::vector<std::pair<std::vector<double>, std::string>>> results(ranges.size());
+    threadPool().parallelFor(ranges.size(), [&](size_t i) {
+        results[i] = rangeQuery(ranges[i].first, ranges[i].second);
+    }, threads);
+    return results;
+}
+
+std::vector<std::pair<std::vector<double>, std::string>> Database::nearestNeighborBatch(
+    const std::vector<std::vector<double>>& targets, int threads) const {
+    
+    std::vector<std::pair<std::vector<double>, std::string>> results(targets.size());
+    threadPool().parallelFor(targets.size(), [&](size_t i) {
+        results[i] = nearestNeighbor(targets[i]);
+    }, threads);
+    return results;
+}
+
+std::vector<std::vector<std::pair<std::vector<double>, std::string>>> Database::kNearestNeighborsBatch(
+    const std::vector<std::vector<double>>& targets, int k, int threads) const {
+    
+    std::vector<std::vector<std::pair<std::vector<double>, std::string>>> results(targets.size());
+    threadPool().parallelFor(targets.size(), [&](size_t i) {
+        results[i] = kNearestNeighbors(targets[i], k);
+    }, threads);
+    return results;
+}
+
+DatabaseStats Database::stats() const {
+#ifdef KD_STATS
+    return statsRecorder.snapshot();
+#else
+    return DatabaseStats();
+#endif
+}
+
+void Database::resetStats() {
+#ifdef KD_STATS
+    statsRecorder.reset();
+#endif
+}
+
 bool Database::isEmpty() const {
-    return tree.isEmpty();
+    ReadGuard lock(rwLock);
+    return mapped ? overlay().isEmpty() : tree.isEmpty();
 }
 
 int Database::getSize() const {
-    return tree.size();
+    ReadGuard lock(rwLock);
+    return mapped ? overlay().size() : tree.size();
+}
+
+int Database::getHeight() const {
+    ReadGuard lock(rwLock);
+    return mapped ? overlay().height() : tree.height();
 }
 
 int Database::getDimensions() const {
@@ -169,9 +683,19 @@ int Database::getDimensions() const {
 }
 
 void Database::clear() {
-    tree.clear();
+    std::lock_guard<std::mutex> serial(writeMutex);
+    logChange([](WriteAheadLog& log) { return log.logClear(); });
+    WriteGuard lock(rwLock);
+    clearEntries();
 }
 
 void Database::printAll() const {
+    ReadGuard lock(rwLock);
+    if (mapped) {
+        for (const Point& p : overlay().getAllPoints()) {
+            p.print();
+        }
+        return;
+    }
     tree.print();
 }
\ No newline at end of file
@@ -2,35 +2,224 @@
 #define DATABASE_H
 
 #include "KDTree.h"
+#include "StaticKDTree.h"
+#include "DatabaseSnapshot.h"
+#include "MappedDelta.h"
+#include "ThreadPool.h"
+#include "CoordinateIndex.h"
+#include "WriteAheadLog.h"
+#include "ReadWriteLock.h"
+#include "QueryStats.h"
 #include <string>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <limits>
 
+// Thread safety: every method may be called from any number of threads.
+// Queries share a reader-writer lock and run in parallel. Changes run one
+// at a time: each commits its log record first, while queries go on, and
+// then takes the lock exclusively for the in-memory update only.
 class Database {
 private:
+    typedef std::shared_lock<ReadWriteLock> ReadGuard;
+    typedef std::unique_lock<ReadWriteLock> WriteGuard;
+    mutable ReadWriteLock rwLock;
+    
+
     KDTree tree;
     int dimensions;
+    
+    // Exact coordinates -> value handle of the point stored there. Every point
+    // in the tree has one entry, so coordinates are unique within a Database.
+    CoordinateIndex index;
+    void rebuildIndex();
+    
+    // Set while serving a snapshot file (from openSnapshot() or a logged
+    // bulk load). Changes go to the tree and hide the file's copies of the
+    // points they remove or overwrite, and queries merge the two; see
+    // MappedDelta. Once the changes make up a quarter of the file, both are
+    // copied into the tree and the file is dropped. `hidden` is shared with
+    // snapshots, so it is copied before a change while one holds it.
+    std::shared_ptr<const StaticKDTree> mapped;
+    std::shared_ptr<std::vector<bool>> hidden;
+    size_t hiddenCount;
+    MappedDelta overlay() const;
+    void mapFile(std::shared_ptr<const StaticKDTree> file);
+    bool hide(const std::vector<double>& coordinates);
+    void materializeIfLarge();
+    void materialize();
+    void clearEntries();
+    
+    // A change holds writeMutex throughout: it checks that it applies, logs
+    // and commits its record with no lock held, and only then takes the write
+    // lock to apply it through these helpers. Queries never see a change a
+    // crash could lose, and a change whose commit fails is never applied.
+    // Only writeMutex holders change the tree, index or mapped file, so they
+    // may read them without the read lock.
+    std::shared_ptr<WriteAheadLog> wal;
+    std::mutex writeMutex;
+    
+    // Snapshot files of logged bulk loads, named after the log. The log's
+    // LOAD and MERGE records refer to them, so they go when it is emptied.
+    std::vector<std::string> loadFiles;
+    std::string saveLoadFile(const PointBatch& batch);
+    template <typename Append>
+    void logChange(Append append) {
+        if (wal) {
+            wal->commit(append(*wal));
+        }
+    }
+    void insertEntry(const std::vector<double>& coordinates, const std::string& value);
+    bool removeEntry(const std::vector<double>& coordinates);
+    bool setEntryValue(const std::vector<double>& coordinates, const std::string& value);
+    void reindex(const std::vector<double>& coordinates, KDTree::ValueId oldId, KDTree::ValueId newId);
+    void applyLogRecord(const WriteAheadLog::Record& record);
+    void replaceEntries(const PointBatch& batch, CoordinateIndex positions);
+    void mergeEntries(std::vector<Point> batch);
+    void moveEntry(const std::vector<double>& oldCoords, const std::vector<double>& newCoords,
+                   const std::string& newValue);
+    
+    // Lookup without locking, for callers that already hold the lock
+    bool findValue(const std::vector<double>& coordinates, std::string& value) const;
+    bool holds(const std::vector<double>& coordinates) const;
+    
+    // Worker pool for batch queries, started on first use and reused afterwards
+    mutable std::unique_ptr<ThreadPool> pool;
+    mutable std::mutex poolMutex;
+    ThreadPool& threadPool() const;
+    
+#ifdef KD_STATS
+    mutable StatsRecorder statsRecorder;
+#endif
 
 public:
-    Database(int dims);
+    // internValues: store each distinct value once; see KDTree
+    Database(int dims, bool internValues = false);
     
     // CRUD Operations
+    // Inserting at coordinates that already hold a point replaces its value
     void insert(const std::vector<double>& coordinates, const std::string& value);
     bool remove(const std::vector<double>& coordinates);
     std::string search(const std::vector<double>& coordinates) const;
     bool update(const std::vector<double>& oldCoords, const std::string& newValue);
     bool update(const std::vector<double>& oldCoords, const std::vector<double>& newCoords, const std::string& newValue);
     
+    // Bulk Operations
+    void bulkLoad(const std::vector<std::pair<std::vector<double>, std::string>>& points,
+                  bool replace = true);
+    // The same from flat buffers (see readPointBatch), without a pair or
+    // Point per point
+    void bulkLoad(const PointBatch& points, bool replace = true);
+    
     // Query Operations
     std::vector<std::pair<std::vector<double>, std::string>> rangeQuery(
         const std::vector<double>& min, const std::vector<double>& max) const;
+    // Points within `radius` of target, boundary included. radiusCount
+    // copies nothing.
+    std::vector<std::pair<std::vector<double>, std::string>> radiusQuery(
+        const std::vector<double>& target, double radius) const;
+    size_t radiusCount(const std::vector<double>& target, double radius) const;
     std::pair<std::vector<double>, std::string> nearestNeighbor(
         const std::vector<double>& target) const;
+    // Points at squared distance maxDistSq or more are left out
     std::vector<std::pair<std::vector<double>, std::string>> kNearestNeighbors(
-        const std::vector<double>& target, int k) const;
+        const std::vector<double>& target, int k,
+        double maxDistSq = std::numeric_limits<double>::infinity()) const;
+    
+    // Approximate searches; see KDTree. A mapped snapshot is always searched exactly.
+    std::pair<std::vector<double>, std::string> nearestNeighbor(
+        const std::vector<double>& target, const SearchOptions& options, bool& exact) const;
+    std::vector<std::pair<std::vector<double>, std::string>> kNearestNeighbors(
+        const std::vector<double>& target, int k, const SearchOptions& options, bool& exact) const;
+    
+    // Streaming Query Operations
+    // Visits every point in [min, max] as a PointView without materializing
+    // results; see KDTree::forEachInRange. The read lock is held for the whole
+    // scan: the visitor may read from this Database (see ReadWriteLock) but
+    // must not change it.
+    template <typename Visitor>
+    bool forEachInRange(const std::vector<double>& min, const std::vector<double>& max,
+                        Visitor&& visit) const {
+        KD_STATS_TIME(statsRecorder, DatabaseStats::RANGE);
+        ReadGuard lock(rwLock);
+        if (mapped) {
+            return overlay().forEachInRange(min, max, std::forward<Visitor>(visit));
+        }
+        return tree.forEachInRange(min, max, std::forward<Visitor>(visit));
+    }
+    template <typename Visitor>
+    bool forEachInRadius(const std::vector<double>& target, double radius, Visitor&& visit) const {
+        KD_STATS_TIME(statsRecorder, DatabaseStats::RADIUS);
+        ReadGuard lock(rwLock);
+        if (mapped) {
+            return overlay().forEachInRadius(target, radius, std::forward<Visitor>(visit));
+        }
+        return tree.forEachInRadius(target, radius, std::forward<Visitor>(visit));
+    }
+    
+    // Snapshots
+    // saveSnapshot() writes every point to a versioned binary file. It
+    // writes from a snapshot() view, so no lock is held while it does.
+    // openSnapshot() maps such a file and answers queries from it without
+    // parsing it or building a tree, so startup cost does not grow with the
+    // point count; changes are kept apart from it until they make up a
+    // quarter of it. The file must stay unchanged while the Database serves it.
+    // Both throw std::runtime_error on I/O errors or a bad file.
+    void saveSnapshot(const std::string& path);
+    static std::unique_ptr<Database> openSnapshot(const std::string& path);
+    
+    // Returns a read-only view of the current contents in O(1). Later
+    // changes to this Database do not show through it: they copy the tree
+    // nodes they touch instead of changing them in place. Views need no
+    // locking and stay valid after the Database is gone; memory the tree
+    // has moved past is freed once every view that can see it is released.
+    DatabaseSnapshot snapshot();
+    
+    // Durability
+    // openLog() replays the write-ahead log at `path` on top of the current
+    // contents, then appends every later insert, remove, update, bulkLoad and
+    // clear to it; each change is committed under the log's sync policy
+    // before it is applied. A bulkLoad saves its batch as a snapshot file
+    // next to the log (`path` plus ".load" and a number) and logs one record
+    // naming it; a replacing one then serves that file, as openSnapshot(). A change whose commit fails throws
+    // std::runtime_error and leaves the Database as it was; if the log could
+    // not be repaired either (WriteAheadLog::hasFailed), later changes throw
+    // too until openLog() is called again. checkpoint() saves a snapshot and
+    // empties the log. recover() rebuilds a Database from the last snapshot
+    // (if the file exists) plus the log. All throw std::runtime_error on I/O
+    // errors.
+    void openLog(const std::string& path, const LogOptions& options = LogOptions());
+    void checkpoint(const std::string& snapshotPath);
+    static std::unique_ptr<Database> recover(int dims, const std::string& snapshotPath,
+                                             const std::string& logPath,
+                                             const LogOptions& options = LogOptions());
+    
+    // Batch Query Operations
+    // Each runs its queries in parallel on up to `threads` threads (0 = all
+    // cores) and returns one result per input, in input order. Every query
+    // sees a consistent tree, but writes may land between queries.
+    std::vector<std::vector<std::pair<std::vector<double>, std::string>>> rangeQueryBatch(
+        const std::vector<std::pair<std::vector<double>, std::vector<double>>>& ranges,
+        int threads = 0) const;
+    std::vector<std::pair<std::vector<double>, std::string>> nearestNeighborBatch(
+        const std::vector<std::vector<double>>& targets, int threads = 0) const;
+    std::vector<std::vector<std::pair<std::vector<double>, std::string>>> kNearestNeighborsBatch(
+        const std::vector<std::vector<double>>& targets, int k, int threads = 0) const;
+    
+    // Statistics
+    // Counts, latency histograms and search work per kind of operation since
+    // construction or the last resetStats(). Kept only in KD_STATS builds
+    // (make STATS=1); otherwise stats().enabled is false and all counts are 0.
+    DatabaseStats stats() const;
+    void resetStats();
     
     // Utility
     bool isEmpty() const;
     int getSize() const;
+    int getHeight() const;
     int getDimensions() const;
     void clear();
     void printAll() const;
@@ -42,6 +231,9 @@ public:
     
     // Get point value by coordinates
     std::string getPointValue(const std::vector<double>& coordinates) const;
+    // Copies the value into `value` (reusing its buffer) if the point exists
+    bool getPointValue(const std::vector<double>& coordinates, std::string& value) const;
+    bool contains(const std::vector<double>& coordinates) const;
 };
 
 #endif // DATABASE_H
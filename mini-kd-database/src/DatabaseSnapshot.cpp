@@ -0,0 +1,138 @@
+#include "DatabaseSnapshot.h"
+#include <stdexcept>
+
+DatabaseSnapshot::DatabaseSnapshot(std::shared_ptr<const KDTree> tree, std::shared_ptr<const StaticKDTree> mapped,
+                                   std::shared_ptr<const std::vector<bool>> hidden, size_t hiddenCount, int dims)
+    : tree(std::move(tree)), mapped(std::move(mapped)), hidden(std::move(hidden)), hiddenCount(hiddenCount),
+      dimensions(dims) {}
+
+MappedDelta DatabaseSnapshot::overlay() const {
+    return MappedDelta(*mapped, hidden.get(), hiddenCount, *tree);
+}
+
+std::vector<std::pair<std::vector<double>, std::string>> DatabaseSnapshot::rangeQuery(
+    const std::vector<double>& min, const std::vector<double>& max) const {
+    
+    if (min.size() != static_cast<size_t>(dimensions) || max.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Range dimensions do not match database dimensions");
+    }
+    
+    std::vector<std::pair<std::vector<double>, std::string>> results;
+    forEachInRange(min, max, [&results](const PointView& p) {
+        results.emplace_back(p.copyCoordinates(), p.getValue());
+        return true;
+    });
+    return results;
+}
+
+std::vector<std::pair<std::vector<double>, std::string>> DatabaseSnapshot::radiusQuery(
+    const std::vector<double>& target, double radius) const {
+    
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match database dimensions");
+    }
+    
+    std::vector<std::pair<std::vector<double>, std::string>> results;
+    forEachInRadius(target, radius, [&results](const PointView& p) {
+        results.emplace_back(p.copyCoordinates(), p.getValue());
+        return true;
+    });
+    return results;
+}
+
+size_t DatabaseSnapshot::radiusCount(const std::vector<double>& target, double radius) const {
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match database dimensions");
+    }
+    return mapped ? overlay().radiusCount(target, radius) : tree->radiusCount(target, radius);
+}
+
+std::pair<std::vector<double>, std::string> DatabaseSnapshot::nearestNeighbor(
+    const std::vector<double>& target) const {
+    
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match database dimensions");
+    }
+    
+    Point nearest = mapped ? overlay().nearestNeighbor(target) : tree->nearestNeighbor(target);
+    return {nearest.getCoordinates(), nearest.getValue()};
+}
+
+std::vector<std::pair<std::vector<double>, std::string>> DatabaseSnapshot::kNearestNeighbors(
+    const std::vector<double>& target, int k) const {
+    
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match database dimensions");
+    }
+    
+    std::vector<Neighbor> nearest;
+    kNearestNeighbors(target, k, nearest);
+    std::vector<std::pair<std::vector<double>, std::string>> results;
+    results.reserve(nearest.size());
+    for (const Neighbor& n : nearest) {
+        results.emplace_back(n.point.copyCoordinates(), n.point.getValue());
+    }
+    return results;
+}
+
+void DatabaseSnapshot::kNearestNeighbors(const std::vector<double>& target, int k,
+                                         std::vector<Neighbor>& out) const {
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match database dimensions");
+    }
+    
+    if (mapped) {
+        overlay().kNearestNeighbors(target, k, out);
+    } else {
+        tree->kNearestNeighbors(target, k, out);
+    }
+}
+
+std::string DatabaseSnapshot::getPointValue(const std::vector<double>& coordinates) const {
+    std::string value;
+    getPointValue(coordinates, value);
+    return value;
+}
+
+// The Database's coordinate index follows the live tree, so lookups walk the frozen tree instead
+bool DatabaseSnapshot::getPointValue(const std::vector<double>& coordinates, std::string& value) const {
+    return mapped ? overlay().findValue(coordinates, value) : tree->findValue(coordinates, value);
+}
+
+bool DatabaseSnapshot::contains(const std::vector<double>& coordinates) const {
+    std::string value;
+    return getPointValue(coordinates, value);
+}
+
+// An unchanged mapped file is copied as it is; otherwise the layout is
+// built from views of the stored points, with no Point copies
+void DatabaseSnapshot::save(const std::string& path) const {
+    if (mapped && hiddenCount == 0 && tree->isEmpty()) {
+        mapped->save(path);
+        return;
+    }
+    std::vector<PointView> points;
+    points.reserve(getSize());
+    auto collect = [&points](const PointView& p) {
+        points.push_back(p);
+        return true;
+    };
+    if (mapped) {
+        overlay().forEachPoint(collect);
+    } else {
+        tree->forEachPoint(collect);
+    }
+    StaticKDTree(dimensions, points).save(path);
+}
+
+bool DatabaseSnapshot::isEmpty() const {
+    return mapped ? overlay().isEmpty() : tree->isEmpty();
+}
+
+int DatabaseSnapshot::getSize() const {
+    return mapped ? overlay().size() : tree->size();
+}
+
+int DatabaseSnapshot::getDimensions() const {
+    return dimensions;
+}
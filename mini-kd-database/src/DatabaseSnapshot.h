@@ -0,0 +1,74 @@
+#ifndef DATABASE_SNAPSHOT_H
+#define DATABASE_SNAPSHOT_H
+
+#include "KDTree.h"
+#include "StaticKDTree.h"
+#include "MappedDelta.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+
+// Immutable view of a Database at the moment Database::snapshot() was
+// called. It offers the Database's query API, takes no locks, and may be
+// copied and shared between threads freely; copies share one view.
+class DatabaseSnapshot {
+private:
+    // A frozen dynamic tree. If the Database was serving a mapped file at
+    // the time, `mapped` holds it and the tree and `hidden` its changes; see
+    // MappedDelta.
+    std::shared_ptr<const KDTree> tree;
+    std::shared_ptr<const StaticKDTree> mapped;
+    std::shared_ptr<const std::vector<bool>> hidden;
+    size_t hiddenCount;
+    int dimensions;
+    
+    DatabaseSnapshot(std::shared_ptr<const KDTree> tree, std::shared_ptr<const StaticKDTree> mapped,
+                     std::shared_ptr<const std::vector<bool>> hidden, size_t hiddenCount, int dims);
+    MappedDelta overlay() const;
+    friend class Database;
+
+public:
+    // Query Operations, as in Database
+    std::vector<std::pair<std::vector<double>, std::string>> rangeQuery(
+        const std::vector<double>& min, const std::vector<double>& max) const;
+    std::vector<std::pair<std::vector<double>, std::string>> radiusQuery(
+        const std::vector<double>& target, double radius) const;
+    size_t radiusCount(const std::vector<double>& target, double radius) const;
+    std::pair<std::vector<double>, std::string> nearestNeighbor(
+        const std::vector<double>& target) const;
+    std::vector<std::pair<std::vector<double>, std::string>> kNearestNeighbors(
+        const std::vector<double>& target, int k) const;
+    // Without copies, as KDTree::kNearestNeighbors with a buffer. A snapshot
+    // never changes, so the views stay valid for as long as it is alive.
+    void kNearestNeighbors(const std::vector<double>& target, int k, std::vector<Neighbor>& out) const;
+    
+    template <typename Visitor>
+    bool forEachInRange(const std::vector<double>& min, const std::vector<double>& max,
+                        Visitor&& visit) const {
+        if (mapped) {
+            return overlay().forEachInRange(min, max, std::forward<Visitor>(visit));
+        }
+        return tree->forEachInRange(min, max, std::forward<Visitor>(visit));
+    }
+    template <typename Visitor>
+    bool forEachInRadius(const std::vector<double>& target, double radius, Visitor&& visit) const {
+        if (mapped) {
+            return overlay().forEachInRadius(target, radius, std::forward<Visitor>(visit));
+        }
+        return tree->forEachInRadius(target, radius, std::forward<Visitor>(visit));
+    }
+    
+    std::string getPointValue(const std::vector<double>& coordinates) const;
+    bool getPointValue(const std::vector<double>& coordinates, std::string& value) const;
+    bool contains(const std::vector<double>& coordinates) const;
+    
+    // Writes the view to a snapshot file, as Database::saveSnapshot
+    void save(const std::string& path) const;
+    
+    bool isEmpty() const;
+    int getSize() const;
+    int getDimensions() const;
+};
+
+#endif // DATABASE_SNAPSHOT_H
@@ -0,0 +1,99 @@
+#include "DistanceKernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KDTREE_X86_KERNELS 1
+#endif
+
+namespace {
+
+typedef void (*BatchKernel)(const double*, const double*, size_t, int, double*);
+
+void scalarKernel(const double* target, const double* points, size_t count, int dims, double* out) {
+    for (size_t i = 0; i < count; ++i) {
+        out[i] = squaredDistance(target, points + i * dims, dims);
+    }
+}
+
+#ifdef KDTREE_X86_KERNELS
+// Both vector kernels work across points rather than across dimensions:
+// each lane holds one point, so any dimension count fills the registers.
+
+__attribute__((target("sse2")))
+void sse2Kernel(const double* target, const double* points, size_t count, int dims, double* out) {
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const double* p0 = points + i * dims;
+        const double* p1 = p0 + dims;
+        __m128d acc = _mm_setzero_pd();
+        for (int d = 0; d < dims; ++d) {
+            __m128d diff = _mm_sub_pd(_mm_set_pd(p1[d], p0[d]), _mm_set1_pd(target[d]));
+            acc = _mm_add_pd(acc, _mm_mul_pd(diff, diff));
+        }
+        _mm_storeu_pd(out + i, acc);
+    }
+    scalarKernel(target, points + i * dims, count - i, dims, out + i);
+}
+
+__attribute__((target("avx2")))
+void avx2Kernel(const double* target, const double* points, size_t count, int dims, double* out) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const double* p0 = points + i * dims;
+        const double* p1 = p0 + dims;
+        const double* p2 = p1 + dims;
+        const double* p3 = p2 + dims;
+        __m256d acc = _mm256_setzero_pd();
+        for (int d = 0; d < dims; ++d) {
+            __m256d diff = _mm256_sub_pd(_mm256_set_pd(p3[d], p2[d], p1[d], p0[d]),
+                                         _mm256_set1_pd(target[d]));
+            acc = _mm256_add_pd(acc, _mm256_mul_pd(diff, diff));
+        }
+        _mm256_storeu_pd(out + i, acc);
+    }
+    sse2Kernel(target, points + i * dims, count - i, dims, out + i);
+}
+#endif
+
+struct KernelChoice {
+    BatchKernel kernel;
+    const char* name;
+};
+
+KernelChoice selectKernel() {
+#ifdef KDTREE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return {avx2Kernel, "avx2"};
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return {sse2Kernel, "sse2"};
+    }
+#endif
+    return {scalarKernel, "scalar"};
+}
+
+const KernelChoice& activeKernel() {
+    static const KernelChoice choice = selectKernel();
+    return choice;
+}
+
+}
+
+double squaredDistance(const double* a, const double* b, int dims) {
+    double sum = 0.0;
+    for (int i = 0; i < dims; ++i) {
+        double diff = a[i] - b[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+void squaredDistances(const double* target, const double* points, size_t count,
+                      int dims, double* out) {
+    activeKernel().kernel(target, points, count, dims, out);
+}
+
+const char* distanceKernelName() {
+    return activeKernel().name;
+}
@@ -0,0 +1,21 @@
+#ifndef DISTANCE_KERNELS_H
+#define DISTANCE_KERNELS_H
+
+#include <cstddef>
+
+// Squared Euclidean distance between two coordinate arrays of length dims
+double squaredDistance(const double* a, const double* b, int dims);
+
+// Squared Euclidean distances from one target to `count` points stored
+// back to back (point i starts at points + i * dims); out[i] receives the
+// distance to point i.
+//
+// On x86 the implementation is picked once at startup from the CPU's
+// features (AVX2, then SSE2); other targets use the portable loop.
+void squaredDistances(const double* target, const double* points, size_t count,
+                      int dims, double* out);
+
+// Name of the kernel selected for this CPU ("avx2", "sse2" or "scalar")
+const char* distanceKernelName();
+
+#endif // DISTANCE_KERNELS_H
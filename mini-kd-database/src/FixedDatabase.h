@@ -0,0 +1,86 @@
+#ifndef FIXED_DATABASE_H
+#define FIXED_DATABASE_H
+
+#include "FixedKDTree.h"
+#include <string>
+#include <vector>
+
+// Database over a FixedKDTree<D>. Mirrors Database, but coordinates are
+// std::array<double, D>, so dimension mismatches are compile errors rather
+// than runtime checks. As in Database, the tree's coordinate index keeps
+// one point per coordinate and serves point lookups without a tree walk.
+// Database remains the choice for arbitrary dimensions.
+template <int D>
+class FixedDatabase {
+public:
+    typedef typename FixedKDTree<D>::Coordinates Coordinates;
+    typedef typename FixedKDTree<D>::Entry Entry;
+
+private:
+    FixedKDTree<D> tree;
+
+public:
+    // CRUD Operations
+    // Replaces the value of a point already at these coordinates
+    void insert(const Coordinates& coordinates, const std::string& value) {
+        tree.insert(coordinates, value);
+    }
+
+    bool remove(const Coordinates& coordinates) {
+        return tree.remove(coordinates);
+    }
+
+    bool update(const Coordinates& coordinates, const std::string& newValue) {
+        return tree.setValue(coordinates, newValue);
+    }
+
+    bool update(const Coordinates& oldCoords, const Coordinates& newCoords, const std::string& newValue) {
+        return tree.update(oldCoords, newCoords, newValue);
+    }
+
+    std::string getPointValue(const Coordinates& coordinates) const {
+        const std::string* value = tree.findValue(coordinates);
+        return value ? *value : "";
+    }
+
+    bool getPointValue(const Coordinates& coordinates, std::string& value) const {
+        const std::string* stored = tree.findValue(coordinates);
+        if (!stored) {
+            return false;
+        }
+        value = *stored;
+        return true;
+    }
+
+    bool contains(const Coordinates& coordinates) const {
+        return tree.search(coordinates);
+    }
+
+    // Bulk Operations
+    // Repeated coordinates keep the last value, as with insert
+    void bulkLoad(const std::vector<Entry>& points, bool replace = true) {
+        tree.build(points, replace);
+    }
+
+    // Query Operations
+    std::vector<Entry> rangeQuery(const Coordinates& min, const Coordinates& max) const {
+        return tree.rangeQuery(min, max);
+    }
+
+    Entry nearestNeighbor(const Coordinates& target) const {
+        return tree.nearestNeighbor(target);
+    }
+
+    std::vector<Entry> kNearestNeighbors(const Coordinates& target, int k) const {
+        return tree.kNearestNeighbors(target, k);
+    }
+
+    // Utility
+    bool isEmpty() const { return tree.isEmpty(); }
+    int getSize() const { return tree.size(); }
+    int getHeight() const { return tree.height(); }
+    static constexpr int getDimensions() { return D; }
+    void clear() { tree.clear(); }
+};
+
+#endif // FIXED_DATABASE_H
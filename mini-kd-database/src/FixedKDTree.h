@@ -0,0 +1,591 @@
+#ifndef FIXED_KDTREE_H
+#define FIXED_KDTREE_H
+
+#include <array>
+#include <vector>
+#include <string>
+#include <queue>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <future>
+#include <thread>
+#include <numeric>
+#include <iterator>
+#include "CoordinateIndex.h"
+
+// Calls f(0), f(1), ..., f(D - 1) with the indices known at compile time,
+// so per-dimension loops are fully unrolled for small D.
+template <int I, int D>
+struct FixedLoop {
+    template <typename F>
+    static void run(F&& f) {
+        f(I);
+        FixedLoop<I + 1, D>::run(f);
+    }
+};
+
+template <int D>
+struct FixedLoop<D, D> {
+    template <typename F>
+    static void run(F&&) {}
+};
+
+// K-D tree specialised for a dimension count known at compile time.
+//
+// Coordinates are std::array<double, D> stored inline in each node, the
+// split dimension is advanced without a modulo, and distance and range
+// checks unroll over D. Nodes live in one vector and refer to their
+// children by index; values are kept in a parallel vector so traversal
+// does not drag them into cache. A CoordinateIndex maps each point to its
+// node, so there is one point per coordinate and lookups skip the tree.
+//
+// Balance is kept the scapegoat way: an insert that lands deeper than
+// log_{4/3} of the tree size rebuilds the lowest subtree on its path that
+// is too deep for its own size, and removes that take the tree below 3/4
+// of its largest size since the last full rebuild rebuild it. Use KDTree
+// when D is only known at runtime.
+template <int D>
+class FixedKDTree {
+    static_assert(D > 0, "Dimensions must be positive");
+
+public:
+    typedef std::array<double, D> Coordinates;
+    typedef std::pair<Coordinates, std::string> Entry;
+
+private:
+    struct Node {
+        Coordinates coords;
+        int32_t left;
+        int32_t right;
+    };
+
+    static const int32_t NONE = -1;
+    static const int PARALLEL_BUILD_THRESHOLD = 1 << 14;
+
+    std::vector<Node> nodes;
+    std::vector<std::string> values;
+    std::vector<int32_t> freeSlots;
+    CoordinateIndex coordinateIndex;
+    std::vector<int32_t> insertPath;
+    int32_t root;
+    int nodeCount;
+    int maxSize;  // most points held since the last full rebuild
+
+    static int nextDim(int dim) {
+        return dim + 1 == D ? 0 : dim + 1;
+    }
+
+    static double squaredDistance(const Coordinates& a, const Coordinates& b) {
+        double sum = 0.0;
+        FixedLoop<0, D>::run([&](int i) {
+            double diff = a[i] - b[i];
+            sum += diff * diff;
+        });
+        return sum;
+    }
+
+    static bool inBox(const Coordinates& p, const Coordinates& min, const Coordinates& max) {
+        bool inside = true;
+        FixedLoop<0, D>::run([&](int i) {
+            inside = inside && p[i] >= min[i] && p[i] <= max[i];
+        });
+        return inside;
+    }
+
+    int32_t allocateNode(const Coordinates& coords, const std::string& value) {
+        int32_t index;
+        if (!freeSlots.empty()) {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+            values[index] = value;
+        } else {
+            index = static_cast<int32_t>(nodes.size());
+            nodes.emplace_back();
+            values.push_back(value);
+        }
+        nodes[index].coords = coords;
+        nodes[index].left = NONE;
+        nodes[index].right = NONE;
+        nodeCount++;
+        return index;
+    }
+
+    void freeNode(int32_t index) {
+        values[index].clear();
+        freeSlots.push_back(index);
+        nodeCount--;
+    }
+
+    int32_t find(const Coordinates& coords) const {
+        uint32_t id = coordinateIndex.find(coords.data());
+        return id == CoordinateIndex::NOT_FOUND ? NONE : static_cast<int32_t>(id);
+    }
+
+    // Points the index at the node now holding coords; nothing else may be
+    // indexed at slot
+    void reindex(const Coordinates& coords, int32_t slot) {
+        coordinateIndex.erase(coords.data());
+        coordinateIndex.insert(coords.data(), static_cast<uint32_t>(slot));
+    }
+
+    // Deepest a point may sit in a subtree of `points` points
+    static int depthLimit(int points) {
+        return static_cast<int>(std::log(static_cast<double>(points)) / std::log(4.0 / 3.0));
+    }
+
+    int countNodes(int32_t index) const {
+        int count = 0;
+        std::vector<int32_t> stack;
+        if (index != NONE) {
+            stack.push_back(index);
+        }
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            count++;
+            if (node.left != NONE) stack.push_back(node.left);
+            if (node.right != NONE) stack.push_back(node.right);
+        }
+        return count;
+    }
+
+    // Link to the node at slot `target`, found by its coordinates; dim is
+    // set to the node's split dimension
+    int32_t* linkTo(int32_t target, int& dim) {
+        const Coordinates coords = nodes[target].coords;
+        int32_t* link = &root;
+        dim = 0;
+        while (*link != target) {
+            Node& node = nodes[*link];
+            link = coords[dim] < node.coords[dim] ? &node.left : &node.right;
+            dim = nextDim(dim);
+        }
+        return link;
+    }
+
+    // Builds entries[left, right) into the nodes at slots[left, right) and
+    // returns the slot of the subtree's root
+    int32_t buildTree(std::vector<Entry>& entries, const std::vector<int32_t>& slots,
+                      int dim, int left, int right, int threads) {
+        if (left >= right) {
+            return NONE;
+        }
+
+        int mid = left + (right - left) / 2;
+        std::nth_element(entries.begin() + left, entries.begin() + mid, entries.begin() + right,
+            [dim](const Entry& a, const Entry& b) { return a.first[dim] < b.first[dim]; });
+
+        // Ties go right, as in insert, so the first copy of the median becomes the node
+        double median = entries[mid].first[dim];
+        auto split = std::partition(entries.begin() + left, entries.begin() + mid,
+            [dim, median](const Entry& e) { return e.first[dim] < median; });
+        std::iter_swap(split, entries.begin() + mid);
+        mid = static_cast<int>(split - entries.begin());
+
+        Node& node = nodes[slots[mid]];
+        node.coords = entries[mid].first;
+        if (threads > 1 && right - left > PARALLEL_BUILD_THRESHOLD) {
+            auto leftTask = std::async(std::launch::async, [&, dim, left, mid, threads]() {
+                return buildTree(entries, slots, nextDim(dim), left, mid, threads / 2);
+            });
+            node.right = buildTree(entries, slots, nextDim(dim), mid + 1, right, threads - threads / 2);
+            node.left = leftTask.get();
+        } else {
+            node.left = buildTree(entries, slots, nextDim(dim), left, mid, 1);
+            node.right = buildTree(entries, slots, nextDim(dim), mid + 1, right, 1);
+        }
+        return slots[mid];
+    }
+
+    // Rebuilds the lowest subtree on the insert's path (insertPath, new
+    // node at `depth`) that sits too deep for its size. The root qualifies
+    // whenever this is called, so one is always found. Sizes are counted on
+    // the way up, which costs no more than the rebuild that follows.
+    void rebalanceAfterInsert(int32_t inserted, int depth) {
+        int32_t child = inserted;
+        int childSize = 1;
+        for (int i = static_cast<int>(insertPath.size()) - 1; i >= 0; --i) {
+            const Node& node = nodes[insertPath[i]];
+            int32_t sibling = node.left == child ? node.right : node.left;
+            int size = childSize + 1 + countNodes(sibling);
+            if (depth - i > depthLimit(size)) {
+                rebuildSubtree(i);
+                return;
+            }
+            child = insertPath[i];
+            childSize = size;
+        }
+    }
+
+    // Rebuilds the subtree at insertPath[depth] balanced, in the slots it
+    // already uses
+    void rebuildSubtree(int depth) {
+        int32_t top = insertPath[depth];
+        int32_t* link = &root;
+        if (depth > 0) {
+            Node& parent = nodes[insertPath[depth - 1]];
+            link = parent.left == top ? &parent.left : &parent.right;
+        }
+
+        std::vector<int32_t> slots;
+        std::vector<Entry> entries;
+        std::vector<int32_t> stack(1, top);
+        while (!stack.empty()) {
+            int32_t slot = stack.back();
+            stack.pop_back();
+            slots.push_back(slot);
+            entries.emplace_back(nodes[slot].coords, std::move(values[slot]));
+            if (nodes[slot].left != NONE) stack.push_back(nodes[slot].left);
+            if (nodes[slot].right != NONE) stack.push_back(nodes[slot].right);
+        }
+
+        *link = buildTree(entries, slots, depth % D, 0, static_cast<int>(entries.size()), 1);
+
+        // The index keeps each key's coordinates under its id, so a slot is
+        // only reused once the point that held it is out of the index
+        std::vector<size_t> moved;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            values[slots[i]] = std::move(entries[i].second);
+            if (find(entries[i].first) != slots[i]) {
+                coordinateIndex.erase(entries[i].first.data());
+                moved.push_back(i);
+            }
+        }
+        for (size_t i : moved) {
+            coordinateIndex.insert(entries[i].first.data(), static_cast<uint32_t>(slots[i]));
+        }
+    }
+
+    // Node with the smallest coordinate on `dimension` below index, whose
+    // split dimension is dim. Only the left side of nodes split on
+    // `dimension` can hold it.
+    int32_t findMin(int32_t index, int dimension, int dim) const {
+        int32_t minIndex = NONE;
+        std::vector<std::pair<int32_t, int>> stack;
+        stack.emplace_back(index, dim);
+        while (!stack.empty()) {
+            int32_t current = stack.back().first;
+            int currentDim = stack.back().second;
+            stack.pop_back();
+            if (current == NONE) {
+                continue;
+            }
+
+            const Node& node = nodes[current];
+            if (minIndex == NONE || node.coords[dimension] < nodes[minIndex].coords[dimension]) {
+                minIndex = current;
+            }
+            stack.emplace_back(node.left, nextDim(currentDim));
+            if (currentDim != dimension) {
+                stack.emplace_back(node.right, nextDim(currentDim));
+            }
+        }
+        return minIndex;
+    }
+
+    // Removes the node behind link, split on dim. A node with children
+    // takes the coordinates and value of the smallest point on dim in its
+    // right subtree (its left subtree moved right if it has no right one),
+    // and that donor is removed in turn, until the node to drop is a leaf.
+    void deleteNode(int32_t* link, int dim) {
+        while (true) {
+            int32_t target = *link;
+            Node& node = nodes[target];
+            if (node.left == NONE && node.right == NONE) {
+                freeNode(target);
+                *link = NONE;
+                return;
+            }
+            if (node.right == NONE) {
+                node.right = node.left;
+                node.left = NONE;
+            }
+
+            int32_t donor = findMin(node.right, dim, nextDim(dim));
+            node.coords = nodes[donor].coords;
+            values[target] = std::move(values[donor]);
+            reindex(node.coords, target);
+
+            link = &node.right;
+            dim = nextDim(dim);
+            while (*link != donor) {
+                Node& next = nodes[*link];
+                link = node.coords[dim] < next.coords[dim] ? &next.left : &next.right;
+                dim = nextDim(dim);
+            }
+        }
+    }
+
+    void rangeSearch(int32_t index, int dim, const Coordinates& min, const Coordinates& max,
+                     std::vector<Entry>& results) const {
+        if (index == NONE) return;
+
+        const Node& node = nodes[index];
+        if (inBox(node.coords, min, max)) {
+            results.emplace_back(node.coords, values[index]);
+        }
+        if (min[dim] <= node.coords[dim]) {
+            rangeSearch(node.left, nextDim(dim), min, max, results);
+        }
+        if (max[dim] >= node.coords[dim]) {
+            rangeSearch(node.right, nextDim(dim), min, max, results);
+        }
+    }
+
+    void nearestNeighbor(int32_t index, int dim, const Coordinates& target,
+                         int32_t& best, double& bestDistSq) const {
+        if (index == NONE) return;
+
+        const Node& node = nodes[index];
+        double distSq = squaredDistance(node.coords, target);
+        if (distSq < bestDistSq) {
+            bestDistSq = distSq;
+            best = index;
+        }
+
+        double diff = target[dim] - node.coords[dim];
+        int32_t near = diff < 0 ? node.left : node.right;
+        int32_t far = diff < 0 ? node.right : node.left;
+
+        nearestNeighbor(near, nextDim(dim), target, best, bestDistSq);
+        if (diff * diff < bestDistSq) {
+            nearestNeighbor(far, nextDim(dim), target, best, bestDistSq);
+        }
+    }
+
+    typedef std::priority_queue<std::pair<double, int32_t>> NeighborHeap;
+
+    void kNearestNeighbors(int32_t index, int dim, const Coordinates& target, size_t k,
+                           NeighborHeap& maxHeap) const {
+        if (index == NONE) return;
+
+        const Node& node = nodes[index];
+        double distSq = squaredDistance(node.coords, target);
+        if (maxHeap.size() < k) {
+            maxHeap.emplace(distSq, index);
+        } else if (distSq < maxHeap.top().first) {
+            maxHeap.pop();
+            maxHeap.emplace(distSq, index);
+        }
+
+        double diff = target[dim] - node.coords[dim];
+        int32_t near = diff < 0 ? node.left : node.right;
+        int32_t far = diff < 0 ? node.right : node.left;
+
+        kNearestNeighbors(near, nextDim(dim), target, k, maxHeap);
+        if (maxHeap.size() < k || diff * diff < maxHeap.top().first) {
+            kNearestNeighbors(far, nextDim(dim), target, k, maxHeap);
+        }
+    }
+
+    void collect(int32_t index, std::vector<Entry>& out) const {
+        if (index == NONE) return;
+        out.emplace_back(nodes[index].coords, values[index]);
+        collect(nodes[index].left, out);
+        collect(nodes[index].right, out);
+    }
+
+    int nodeHeight(int32_t index) const {
+        if (index == NONE) return 0;
+        return 1 + std::max(nodeHeight(nodes[index].left), nodeHeight(nodes[index].right));
+    }
+
+public:
+    FixedKDTree() : coordinateIndex(D), root(NONE), nodeCount(0), maxSize(0) {}
+
+    // Core operations
+    // Replaces the value of a point already at these coordinates
+    void insert(const Coordinates& coords, const std::string& value = "") {
+        int32_t existing = find(coords);
+        if (existing != NONE) {
+            values[existing] = value;
+            return;
+        }
+
+        insertPath.clear();
+        bool goLeft = false;
+        int32_t current = root;
+        int dim = 0;
+        while (current != NONE) {
+            insertPath.push_back(current);
+            goLeft = coords[dim] < nodes[current].coords[dim];
+            current = goLeft ? nodes[current].left : nodes[current].right;
+            dim = nextDim(dim);
+        }
+
+        int32_t slot = allocateNode(coords, value);
+        coordinateIndex.insert(coords.data(), static_cast<uint32_t>(slot));
+        if (insertPath.empty()) {
+            root = slot;
+        } else if (goLeft) {
+            nodes[insertPath.back()].left = slot;
+        } else {
+            nodes[insertPath.back()].right = slot;
+        }
+        maxSize = std::max(maxSize, nodeCount);
+
+        int depth = static_cast<int>(insertPath.size());
+        if (depth > depthLimit(nodeCount)) {
+            rebalanceAfterInsert(slot, depth);
+        }
+    }
+
+    // Same rule as insert: one point per coordinate, the last value wins,
+    // and points already in the tree come before the batch when kept
+    void build(std::vector<Entry> entries, bool replace = true) {
+        if (!replace && root != NONE) {
+            std::vector<Entry> merged = getAllPoints();
+            merged.insert(merged.end(), std::make_move_iterator(entries.begin()),
+                          std::make_move_iterator(entries.end()));
+            entries.swap(merged);
+        }
+        clear();
+        if (entries.empty()) {
+            return;
+        }
+
+        // chosen[position] is the entry that fills each position
+        coordinateIndex.reserve(entries.size());
+        std::vector<uint32_t> chosen;
+        chosen.reserve(entries.size());
+        for (size_t i = 0; i < entries.size(); ++i) {
+            uint32_t position = coordinateIndex.insertIfAbsent(entries[i].first.data(), static_cast<uint32_t>(chosen.size()));
+            if (position == CoordinateIndex::NOT_FOUND) {
+                chosen.push_back(static_cast<uint32_t>(i));
+            } else {
+                chosen[position] = static_cast<uint32_t>(i);
+            }
+        }
+        if (chosen.size() < entries.size()) {
+            std::vector<Entry> distinct;
+            distinct.reserve(chosen.size());
+            for (uint32_t i : chosen) {
+                distinct.push_back(std::move(entries[i]));
+            }
+            entries.swap(distinct);
+        }
+        coordinateIndex.clear();
+
+        // Node i takes position i of the partitioned batch, so threads never share a slot
+        nodes.resize(entries.size());
+        std::vector<int32_t> slots(entries.size());
+        std::iota(slots.begin(), slots.end(), 0);
+        int threads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+        root = buildTree(entries, slots, 0, 0, static_cast<int>(entries.size()), threads);
+
+        values.reserve(entries.size());
+        for (size_t i = 0; i < entries.size(); ++i) {
+            coordinateIndex.insert(entries[i].first.data(), static_cast<uint32_t>(i));
+            values.push_back(std::move(entries[i].second));
+        }
+        nodeCount = static_cast<int>(entries.size());
+        maxSize = nodeCount;
+    }
+
+    bool remove(const Coordinates& coords) {
+        int32_t target = find(coords);
+        if (target == NONE) {
+            return false;
+        }
+
+        coordinateIndex.erase(coords.data());
+        int dim;
+        int32_t* link = linkTo(target, dim);
+        deleteNode(link, dim);
+        if (nodeCount * 4 < maxSize * 3) {
+            build(getAllPoints());
+        }
+        return true;
+    }
+
+    bool search(const Coordinates& coords) const {
+        return find(coords) != NONE;
+    }
+
+    // Pointer to the stored value, or nullptr if no point has these coordinates
+    const std::string* findValue(const Coordinates& coords) const {
+        int32_t index = find(coords);
+        return index == NONE ? nullptr : &values[index];
+    }
+
+    bool setValue(const Coordinates& coords, const std::string& value) {
+        int32_t index = find(coords);
+        if (index == NONE) {
+            return false;
+        }
+        values[index] = value;
+        return true;
+    }
+
+    bool update(const Coordinates& oldCoords, const Coordinates& newCoords, const std::string& value) {
+        if (oldCoords == newCoords) {
+            return setValue(oldCoords, value);
+        }
+        // A point already at newCoords is replaced, as insert does
+        if (!remove(oldCoords)) {
+            return false;
+        }
+        insert(newCoords, value);
+        return true;
+    }
+
+    // Query operations
+    std::vector<Entry> rangeQuery(const Coordinates& min, const Coordinates& max) const {
+        std::vector<Entry> results;
+        rangeSearch(root, 0, min, max, results);
+        return results;
+    }
+
+    Entry nearestNeighbor(const Coordinates& target) const {
+        if (root == NONE) {
+            throw std::runtime_error("Tree is empty");
+        }
+        int32_t best = root;
+        double bestDistSq = squaredDistance(nodes[root].coords, target);
+        nearestNeighbor(root, 0, target, best, bestDistSq);
+        return Entry(nodes[best].coords, values[best]);
+    }
+
+    std::vector<Entry> kNearestNeighbors(const Coordinates& target, int k) const {
+        if (k <= 0 || root == NONE) {
+            return {};
+        }
+
+        NeighborHeap maxHeap;
+        kNearestNeighbors(root, 0, target, static_cast<size_t>(k), maxHeap);
+
+        std::vector<Entry> result(maxHeap.size());
+        for (size_t i = result.size(); i-- > 0; maxHeap.pop()) {
+            int32_t index = maxHeap.top().second;
+            result[i] = Entry(nodes[index].coords, values[index]);
+        }
+        return result;
+    }
+
+    // Utility
+    bool isEmpty() const { return root == NONE; }
+    int size() const { return nodeCount; }
+    int height() const { return nodeHeight(root); }
+    static constexpr int getDimensions() { return D; }
+
+    void clear() {
+        nodes.clear();
+        values.clear();
+        freeSlots.clear();
+        coordinateIndex.clear();
+        root = NONE;
+        nodeCount = 0;
+        maxSize = 0;
+    }
+
+    std::vector<Entry> getAllPoints() const {
+        std::vector<Entry> out;
+        collect(root, out);
+        return out;
+    }
+};
+
+#endif // FIXED_KDTREE_H
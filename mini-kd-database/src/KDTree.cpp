@@ -1,256 +1,954 @@
 #include "KDTree.h"
 #include <cmath>
+#include <cstring>
 #include <limits>
-#include <queue>
 #include <algorithm>
 #include <stdexcept>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <set>
+#include <deque>
 
-KDNode::KDNode(const Point& p) : point(p), left(nullptr), right(nullptr) {}
+namespace {
+// Subtrees smaller than this are always built on the calling thread;
+// below it the cost of spawning a task outweighs the work.
+const int PARALLEL_BUILD_THRESHOLD = 1 << 14;
 
-KDTree::KDTree(int dims) : dimensions(dims) {
+// Ranges of more than 8 times this many points pick their split dimension
+// from about this many points spread evenly over the range
+const size_t SPREAD_SAMPLE = 1024;
+
+// Scapegoat balancing parameter: a leaf deeper than log base 1/alpha of
+// the number of leaves a subtree needs triggers a rebuild of one subtree
+// on its path. Smaller values keep the tree flatter but rebuild more often.
+const double BALANCE_ALPHA = 0.7;
+
+// Removes leave leaves part empty; once the uncompacted removes below an
+// inner node make up this share of its subtree, it is rebuilt with full leaves
+const double COMPACT_REMOVED_FRACTION = 0.25;
+
+// findEntry id that matches any point at the given coordinates
+const ValueStore::ValueId ANY_VALUE = UINT32_MAX;
+
+int balancedDepth(int count) {
+    static const double logInverseAlpha = std::log(1.0 / BALANCE_ALPHA);
+    return static_cast<int>(std::log(static_cast<double>(count)) / logInverseAlpha);
+}
+
+std::vector<Point> toPoints(const std::vector<Neighbor>& neighbors) {
+    std::vector<Point> points;
+    points.reserve(neighbors.size());
+    for (const Neighbor& n : neighbors) {
+        points.push_back(n.point.toPoint());
+    }
+    return points;
+}
+}
+
+const uint32_t KDTree::SCAN_CHUNK;
+
+struct KDTree::Storage {
+    Arena arena;
+    ValueStore values;
+    
+    // Bumped by every snapshot; nodes from earlier epochs may be shared
+    uint32_t epoch;
+    
+    // Epochs of the snapshots still referenced. Snapshots are released from
+    // any thread, so these are guarded; everything else is the writer's.
+    std::mutex snapshotMutex;
+    std::multiset<uint32_t> liveSnapshots;
+    std::atomic<int> snapshotCount;
+    
+    // Nodes and values that left the tree at `epoch` while snapshots were
+    // alive. Only snapshots taken before that epoch can reach them, so each
+    // is freed once no such snapshot remains. Either node or value is set.
+    struct Retired {
+        uint32_t epoch;
+        KDNode* node;
+        ValueStore::ValueId value;
+    };
+    std::deque<Retired> retired;
+    
+    explicit Storage(bool internValues) : values(internValues), epoch(0), snapshotCount(0) {}
+};
+
+KDTree::KDTree(int dims, int bucketSize, bool internValues)
+    : storage(std::make_shared<Storage>(internValues)), root(nullptr), dimensions(dims), bucketSize(bucketSize),
+      nodeCount(0), isSnapshot(false), snapshotEpoch(0) {
     if (dims <= 0) {
         throw std::invalid_argument("Dimensions must be positive");
     }
+    if (bucketSize <= 0) {
+        throw std::invalid_argument("Bucket size must be positive");
+    }
 }
 
-void KDTree::insert(const Point& point) {
-    if (point.getDimensions() != dimensions) {
-        throw std::invalid_argument("Point dimensions do not match tree dimensions");
+// A snapshot is a read-only tree over the live tree's storage and root
+KDTree::KDTree(const KDTree& live, uint32_t epoch)
+    : storage(live.storage), root(live.root), dimensions(live.dimensions), bucketSize(live.bucketSize),
+      nodeCount(live.nodeCount), isSnapshot(true), snapshotEpoch(epoch) {
+    std::lock_guard<std::mutex> lock(storage->snapshotMutex);
+    storage->liveSnapshots.insert(epoch);
+    storage->snapshotCount++;
+}
+
+KDTree::~KDTree() {
+    if (isSnapshot) {
+        std::lock_guard<std::mutex> lock(storage->snapshotMutex);
+        storage->liveSnapshots.erase(storage->liveSnapshots.find(snapshotEpoch));
+        storage->snapshotCount--;
     }
-    root = insertNode(std::move(root), point, 0);
 }
 
-std::unique_ptr<KDNode> KDTree::insertNode(std::unique_ptr<KDNode> node, 
-                                           const Point& point, int depth) {
-    if (!node) {
-        return std::make_unique<KDNode>(point);
+// The moved-from tree is left empty on fresh storage
+KDTree::KDTree(KDTree&& other)
+    : storage(std::move(other.storage)), root(other.root), dimensions(other.dimensions),
+      bucketSize(other.bucketSize), nodeCount(other.nodeCount), isSnapshot(false), snapshotEpoch(0) {
+    other.storage = std::make_shared<Storage>(storage->values.interning());
+    other.root = nullptr;
+    other.nodeCount = 0;
+}
+
+KDTree& KDTree::operator=(KDTree&& other) {
+    if (this != &other) {
+        storage = std::move(other.storage);
+        root = other.root;
+        dimensions = other.dimensions;
+        bucketSize = other.bucketSize;
+        nodeCount = other.nodeCount;
+        other.storage = std::make_shared<Storage>(storage->values.interning());
+        other.root = nullptr;
+        other.nodeCount = 0;
+    }
+    return *this;
+}
+
+std::shared_ptr<const KDTree> KDTree::snapshot() {
+    std::shared_ptr<const KDTree> view(new KDTree(*this, storage->epoch));
+    // Every node that exists now is reachable from the view, so later writes copy them
+    storage->epoch++;
+    return view;
+}
+
+KDTree::ValueId KDTree::insert(const Point& point) {
+    if (point.getDimensions() != dimensions) {
+        throw std::invalid_argument("Point dimensions do not match tree dimensions");
     }
     
-    int currentDim = depth % dimensions;
+    reclaim();
     
-    if (point.getCoordinate(currentDim) < node->point.getCoordinate(currentDim)) {
-        node->left = insertNode(std::move(node->left), point, depth + 1);
-    } else {
-        node->right = insertNode(std::move(node->right), point, depth + 1);
+    const std::vector<double>& coords = point.getCoordinates();
+    ValueId id = storage->values.add(point.getValue());
+    if (!root) {
+        root = newLeaf(bucketSize);
     }
     
-    return std::move(node);
+    // Walk down to the leaf the point belongs in, counting it into every
+    // subtree on the way and remembering the path
+    insertPath.clear();
+    KDNode** link = &root;
+    while (!(*link)->isLeaf()) {
+        KDNode* node = writable(*link);
+        node->size++;
+        growBox(node, coords.data());
+        insertPath.push_back(node);
+        link = coords[node->dimension] < node->split ? &node->left : &node->right;
+    }
+    nodeCount++;
+    
+    if ((*link)->size < (*link)->capacity) {
+        KDNode* leaf = writable(*link);
+        std::memcpy(leaf->coords + static_cast<size_t>(leaf->size) * dimensions, coords.data(), coordBytes());
+        leaf->valueIds[leaf->size++] = id;
+        growBox(leaf, coords.data());
+        return id;
+    }
+    
+    // A full leaf is split: its points and the new one are built into a small subtree
+    KDNode* full = *link;
+    std::vector<Entry> entries;
+    entries.reserve(full->size + 1);
+    for (uint32_t i = 0; i < full->size; ++i) {
+        entries.push_back({full->coords + static_cast<size_t>(i) * dimensions, full->valueIds[i], 0.0});
+    }
+    entries.push_back({coords.data(), id, 0.0});
+    *link = buildTree(entries.data(), entries.data() + entries.size(), nullptr);
+    dropNode(full);
+    
+    int depth = static_cast<int>(insertPath.size()) + ((*link)->isLeaf() ? 0 : 1);
+    if (depth > depthLimit(static_cast<uint32_t>(nodeCount))) {
+        rebalanceAfterInsert(depth);
+    }
+    return id;
 }
 
-bool KDTree::remove(const Point& point) {
-    if (point.getDimensions() != dimensions) {
-        return false;
+// Deepest a leaf may sit in a subtree of `points` points: balanced for the
+// number of leaves the points fill when each leaf is half full
+int KDTree::depthLimit(uint32_t points) const {
+    return balancedDepth(static_cast<int>(2 * points / bucketSize + 1));
+}
+
+// Rebuilds the lowest subtree on the path whose new leaf (at `depth`) sits
+// too deep for the subtree's size. The root qualifies whenever this is
+// called, so one is always found; going for the lowest keeps rebuilds small.
+void KDTree::rebalanceAfterInsert(int depth) {
+    for (int i = static_cast<int>(insertPath.size()) - 1; i >= 0; --i) {
+        KDNode* node = insertPath[i];
+        if (depth - i <= depthLimit(node->size)) {
+            continue;
+        }
+        
+        // The rebuild compacts the removes below the node as well
+        for (int j = 0; j < i; ++j) {
+            insertPath[j]->removed -= node->removed;
+        }
+        KDNode* parent = i > 0 ? insertPath[i - 1] : nullptr;
+        KDNode** link = !parent ? &root : (parent->left == node ? &parent->left : &parent->right);
+        *link = rebuildSubtree(node);
+        return;
     }
-    
-    int initialSize = size();
-    root = deleteNode(std::move(root), point, 0);
-    return size() < initialSize;
 }
 
-std::unique_ptr<KDNode> KDTree::deleteNode(std::unique_ptr<KDNode> node, 
-                                           const Point& point, int depth) {
-    if (!node) {
-        return nullptr;
+// Rebuilds the lowest inner node on the remove's path (insertPath, leaf
+// last) whose uncompacted removes have crossed COMPACT_REMOVED_FRACTION.
+// Before the remove every inner node was within the limit, so the one that
+// crosses has a leaf child and usually holds a few leaves, not the tree. A
+// rebuild of m points follows at least m / 3 removes below the node that
+// no earlier rebuild compacted, so each remove pays O(log m) for it.
+void KDTree::compactAfterRemove() {
+    if (nodeCount == 0) {
+        clear();
+        return;
+    }
+    for (int i = static_cast<int>(insertPath.size()) - 2; i >= 0; --i) {
+        KDNode* node = insertPath[i];
+        if (node->removed <= COMPACT_REMOVED_FRACTION * (node->size + node->removed)) {
+            continue;
+        }
+        for (int j = 0; j < i; ++j) {
+            insertPath[j]->removed -= node->removed;
+        }
+        KDNode* parent = i > 0 ? insertPath[i - 1] : nullptr;
+        KDNode** link = !parent ? &root : (parent->left == node ? &parent->left : &parent->right);
+        *link = rebuildSubtree(node);
+        return;
+    }
+}
+
+// Rebuilds the subtree under `node` into a balanced one with fresh leaves.
+// The old nodes are dropped only afterwards, since the new leaves are
+// filled from their coordinates.
+KDNode* KDTree::rebuildSubtree(KDNode* node) {
+    std::vector<Entry> entries;
+    std::vector<KDNode*> nodes;
+    entries.reserve(node->size);
+    collectEntries(node, entries, nodes);
+    
+    KDNode* rebuilt = entries.empty() ? newLeaf(bucketSize)
+                                      : buildTree(entries.data(), entries.data() + entries.size(), nullptr);
+    for (KDNode* old : nodes) {
+        dropNode(old);
+    }
+    return rebuilt;
+}
+
+// Builds a subtree over [first, last), reordering the entries. Each level
+// splits the widest dimension at its median until at most bucketSize points
+// are left; large ranges judge the width and the median from a sample.
+// Allocation goes through `allocation` when other threads build alongside.
+KDNode* KDTree::buildTree(Entry* first, Entry* last, std::mutex* allocation, int threads) {
+    size_t count = static_cast<size_t>(last - first);
+    
+    // Widest spread over every step-th entry, and its dimension
+    auto spread = [this, first, last](size_t step, int& dim) {
+        std::vector<double> lo(first->coords, first->coords + dimensions);
+        std::vector<double> hi(lo);
+        for (const Entry* e = first + step; e < last; e += step) {
+            for (int d = 0; d < dimensions; ++d) {
+                lo[d] = std::min(lo[d], e->coords[d]);
+                hi[d] = std::max(hi[d], e->coords[d]);
+            }
+        }
+        double widest = 0.0;
+        for (int d = 0; d < dimensions; ++d) {
+            if (hi[d] - lo[d] > widest) {
+                widest = hi[d] - lo[d];
+                dim = d;
+            }
+        }
+        return widest;
+    };
+    
+    int dim = 0;
+    double widest = 0.0;
+    if (count > static_cast<size_t>(bucketSize)) {
+        size_t step = count > 8 * SPREAD_SAMPLE ? count / SPREAD_SAMPLE : 1;
+        widest = spread(step, dim);
+        // A sample that sees one position proves nothing about the rest
+        if (widest == 0.0 && step > 1) {
+            widest = spread(1, dim);
+        }
     }
     
-    int currentDim = depth % dimensions;
+    // Points that all share one position cannot be split, so they get a leaf big enough for them
+    if (count <= static_cast<size_t>(bucketSize) || widest == 0.0) {
+        uint32_t capacity = static_cast<uint32_t>(count <= static_cast<size_t>(bucketSize) ? bucketSize : 2 * count);
+        std::unique_lock<std::mutex> lock;
+        if (allocation) lock = std::unique_lock<std::mutex>(*allocation);
+        KDNode* leaf = newLeaf(capacity);
+        lock = std::unique_lock<std::mutex>();
+        for (size_t i = 0; i < count; ++i) {
+            std::memcpy(leaf->coords + i * dimensions, first[i].coords, coordBytes());
+            leaf->valueIds[i] = first[i].id;
+        }
+        leaf->size = static_cast<uint32_t>(count);
+        refitBox(leaf);
+        return leaf;
+    }
     
-    if (point.equals(node->point)) {
-        if (!node->left && !node->right) {
-            return nullptr;
+    Entry* cut;
+    double split;
+    if (count > 8 * SPREAD_SAMPLE) {
+        // Large ranges split at the median of a sample, which one partition
+        // pass applies; selecting the exact median takes several passes
+        std::vector<double> sample;
+        sample.reserve(SPREAD_SAMPLE + 1);
+        for (const Entry* e = first; e < last; e += count / SPREAD_SAMPLE) {
+            sample.push_back(e->coords[dim]);
         }
-        
-        if (!node->left) {
-            return std::move(node->right);
+        std::nth_element(sample.begin(), sample.begin() + sample.size() / 2, sample.end());
+        split = sample[sample.size() / 2];
+        cut = std::partition(first, last, [dim, split](const Entry& e) { return e.coords[dim] < split; });
+        if (cut == first) {
+            // As below, points equal to a minimal split go left
+            cut = std::partition(first, last, [dim, split](const Entry& e) { return e.coords[dim] <= split; });
+            split = std::min_element(cut, last, [dim](const Entry& a, const Entry& b) {
+                return a.coords[dim] < b.coords[dim];
+            })->coords[dim];
         }
-        
-        if (!node->right) {
-            return std::move(node->left);
+    } else {
+        for (Entry* e = first; e != last; ++e) {
+            e->key = e->coords[dim];
         }
-        
-        // Find minimum in right subtree
-        auto minNode = findMin(std::move(node->right), currentDim, (depth + 1) % dimensions);
-        node->point = minNode->point;
-        node->right = deleteNode(std::move(node->right), minNode->point, depth + 1);
-        
-    } else if (point.getCoordinate(currentDim) < node->point.getCoordinate(currentDim)) {
-        node->left = deleteNode(std::move(node->left), point, depth + 1);
+        auto key = [](const Entry& e) { return e.key; };
+        Entry* mid = first + count / 2;
+        std::nth_element(first, mid, last, [&key](const Entry& a, const Entry& b) {
+            return key(a) < key(b);
+        });
+        split = key(*mid);
+        // Only the lower half can hold copies of the median that must move right
+        cut = std::partition(first, mid, [&key, split](const Entry& e) { return key(e) < split; });
+        if (cut == first) {
+            // The median is also the minimum: the points equal to it go left
+            // and the split moves up to the next larger coordinate
+            cut = std::partition(mid, last, [&key, split](const Entry& e) { return key(e) <= split; });
+            split = key(*std::min_element(cut, last, [&key](const Entry& a, const Entry& b) {
+                return key(a) < key(b);
+            }));
+        }
+    }
+    
+    // The two halves are disjoint ranges of the batch, so they can be built concurrently
+    KDNode* left;
+    KDNode* right;
+    if (threads > 1 && count > static_cast<size_t>(PARALLEL_BUILD_THRESHOLD)) {
+        auto leftTask = std::async(std::launch::async, [this, first, cut, allocation, threads]() {
+            return buildTree(first, cut, allocation, threads / 2);
+        });
+        right = buildTree(cut, last, allocation, threads - threads / 2);
+        left = leftTask.get();
     } else {
-        node->right = deleteNode(std::move(node->right), point, depth + 1);
+        left = buildTree(first, cut, allocation);
+        right = buildTree(cut, last, allocation);
     }
     
-    return std::move(node);
+    std::unique_lock<std::mutex> lock;
+    if (allocation) lock = std::unique_lock<std::mutex>(*allocation);
+    return newInner(dim, split, left, right);
 }
 
-std::unique_ptr<KDNode> KDTree::findMin(std::unique_ptr<KDNode> node, 
-                                        int dimension, int currentDim) {
-    if (!node) {
-        return nullptr;
+// Builds the tree over entries whose ids index the input, then swaps each
+// id for the handle addValue(id) returns for that input's value. Sets
+// (*ids)[input] to the handle if ids is given.
+template <typename AddValue>
+void KDTree::buildEntries(std::vector<Entry>& entries, AddValue addValue, std::vector<ValueId>* ids) {
+    int threads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    std::mutex allocation;
+    root = buildTree(entries.data(), entries.data() + entries.size(), threads > 1 ? &allocation : nullptr, threads);
+    nodeCount = static_cast<int>(entries.size());
+    
+    // The value store is single-threaded, so values are filled in afterwards,
+    // leaf by leaf, which also lays them out in the order scans read them
+    if (ids) {
+        ids->resize(entries.size());
     }
-    
-    if (dimension == currentDim) {
-        if (!node->left) {
-            return std::move(node);
+    std::vector<KDNode*> pending(1, root);
+    while (!pending.empty()) {
+        KDNode* node = pending.back();
+        pending.pop_back();
+        if (!node->isLeaf()) {
+            pending.push_back(node->right);
+            pending.push_back(node->left);
+            continue;
+        }
+        for (uint32_t i = 0; i < node->size; ++i) {
+            ValueId input = node->valueIds[i];
+            node->valueIds[i] = addValue(input);
+            if (ids) {
+                (*ids)[input] = node->valueIds[i];
+            }
+        }
+    }
+}
+
+void KDTree::build(std::vector<Point> points, bool replace, std::vector<ValueId>* ids) {
+    for (const Point& p : points) {
+        if (p.getDimensions() != dimensions) {
+            throw std::invalid_argument("Point dimensions do not match tree dimensions");
         }
-        return findMin(std::move(node->left), dimension, (currentDim + 1) % dimensions);
     }
     
-    auto leftMin = findMin(std::move(node->left), dimension, (currentDim + 1) % dimensions);
-    auto rightMin = findMin(std::move(node->right), dimension, (currentDim + 1) % dimensions);
+    // Merging folds the current contents into the batch so the result is one balanced tree
+    if (!replace) {
+        collectPoints(root, points);
+    }
+    clear();
     
-    auto minNode = std::move(node);
+    if (points.empty()) {
+        return;
+    }
     
-    if (leftMin && leftMin->point.getCoordinate(dimension) < minNode->point.getCoordinate(dimension)) {
-        minNode = std::move(leftMin);
+    // Entries carry point indices through the build
+    std::vector<Entry> entries(points.size());
+    for (size_t i = 0; i < points.size(); ++i) {
+        entries[i].coords = points[i].getCoordinates().data();
+        entries[i].id = static_cast<ValueId>(i);
     }
+    buildEntries(entries, [this, &points](ValueId input) {
+        return storage->values.add(points[input].getValue());
+    }, ids);
+}
+
+// Same as build(points, true, ids), but the entries point straight into the
+// batch's buffers, so no Point is made along the way
+void KDTree::build(const PointBatch& batch, std::vector<ValueId>* ids) {
+    if (batch.getDimensions() != dimensions) {
+        throw std::invalid_argument("Point dimensions do not match tree dimensions");
+    }
+    clear();
     
-    if (rightMin && rightMin->point.getCoordinate(dimension) < minNode->point.getCoordinate(dimension)) {
-        minNode = std::move(rightMin);
+    if (batch.empty()) {
+        return;
     }
     
-    return minNode;
+    std::vector<Entry> entries(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+        entries[i].coords = batch.coordinatesOf(i);
+        entries[i].id = static_cast<ValueId>(i);
+    }
+    const uint64_t* offsets = batch.valueOffsets().data();
+    const char* values = batch.values().data();
+    buildEntries(entries, [this, offsets, values](ValueId input) {
+        return storage->values.add(values + offsets[input], offsets[input + 1] - offsets[input]);
+    }, ids);
 }
 
-bool KDTree::search(const Point& point) const {
-    const KDNode* current = root.get();
-    int depth = 0;
-    
-    while (current) {
-        if (point.equals(current->point)) {
-            return true;
-        }
-        
-        int currentDim = depth % dimensions;
-        if (point.getCoordinate(currentDim) < current->point.getCoordinate(currentDim)) {
-            current = current->left.get();
-        } else {
-            current = current->right.get();
-        }
-        depth++;
+bool KDTree::remove(const Point& point) {
+    if (point.getDimensions() != dimensions) {
+        return false;
     }
     
-    return false;
+    reclaim();
+    int index = findEntry(point.getCoordinates(), ANY_VALUE);
+    if (index < 0) {
+        return false;
+    }
+    eraseEntry(static_cast<uint32_t>(index));
+    return true;
 }
 
-std::vector<Point> KDTree::rangeQuery(const std::vector<double>& min, 
-                                     const std::vector<double>& max) const {
-    if (min.size() != dimensions || max.size() != dimensions) {
-        throw std::invalid_argument("Range dimensions do not match tree dimensions");
+// Removes the point holding `id`; coords must be the ones it was stored with
+bool KDTree::remove(const std::vector<double>& coords, ValueId id) {
+    if (coords.size() != static_cast<size_t>(dimensions)) {
+        return false;
     }
     
-    std::vector<Point> results;
-    rangeSearch(root.get(), min, max, 0, results);
-    return results;
+    reclaim();
+    int index = findEntry(coords, id);
+    if (index < 0) {
+        return false;
+    }
+    eraseEntry(static_cast<uint32_t>(index));
+    return true;
 }
 
-void KDTree::rangeSearch(const KDNode* node, const std::vector<double>& min, 
-                        const std::vector<double>& max, int depth, 
-                        std::vector<Point>& results) const {
-    if (!node) return;
+// Removes entry `index` of the leaf at the end of insertPath (as left by
+// findEntry); the leaf's last entry moves into the hole
+void KDTree::eraseEntry(uint32_t index) {
+    KDNode* leaf = ownPath(insertPath);
+    for (size_t i = 0; i + 1 < insertPath.size(); ++i) {
+        insertPath[i]->size--;
+        insertPath[i]->removed++;
+    }
     
-    const Point& point = node->point;
-    bool inRange = true;
+    dropValue(leaf->valueIds[index]);
+    uint32_t last = --leaf->size;
+    if (index != last) {
+        std::memcpy(leaf->coords + static_cast<size_t>(index) * dimensions,
+                    leaf->coords + static_cast<size_t>(last) * dimensions, coordBytes());
+        leaf->valueIds[index] = leaf->valueIds[last];
+    }
     
-    for (int i = 0; i < dimensions; ++i) {
-        if (point.getCoordinate(i) < min[i] || point.getCoordinate(i) > max[i]) {
-            inRange = false;
-            break;
-        }
+    // Boxes shrink back to the points left, from the leaf up
+    for (size_t i = insertPath.size(); i-- > 0;) {
+        refitBox(insertPath[i]);
+    }
+    nodeCount--;
+    compactAfterRemove();
+}
+
+// Leaves the path from the root to the leaf for `coords` in insertPath and
+// returns the index of the entry holding `id` (any entry at coords for
+// ANY_VALUE) in that leaf, or -1
+int KDTree::findEntry(const std::vector<double>& coords, ValueId id) {
+    insertPath.clear();
+    KDNode* node = root;
+    if (!node) {
+        return -1;
     }
+    while (!node->isLeaf()) {
+        insertPath.push_back(node);
+        node = coords[node->dimension] < node->split ? node->left : node->right;
+    }
+    insertPath.push_back(node);
     
-    if (inRange) {
-        results.push_back(point);
+    for (uint32_t i = 0; i < node->size; ++i) {
+        if (id == ANY_VALUE ? matches(node, i, coords) : node->valueIds[i] == id) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+// The leaf whose cell holds `coords`, or nullptr for an empty tree
+const KDNode* KDTree::findLeaf(const std::vector<double>& coords) const {
+    const KDNode* node = root;
+    while (node && !node->isLeaf()) {
+        node = coords[node->dimension] < node->split ? node->left : node->right;
+    }
+    return node;
+}
+
+std::string KDTree::getValue(ValueId id) const {
+    return storage->values.get(id);
+}
+
+void KDTree::getValue(ValueId id, std::string& out) const {
+    out.assign(storage->values.data(id), storage->values.length(id));
+}
+
+KDTree::ValueId KDTree::setValue(const std::vector<double>& coords, ValueId id, const std::string& value) {
+    // With no snapshot alive nobody else can see the old bytes
+    if (storage->snapshotCount.load() == 0) {
+        storage->values.set(id, value);
+        return id;
     }
     
-    int currentDim = depth % dimensions;
+    reclaim();
+    int index = coords.size() == static_cast<size_t>(dimensions) ? findEntry(coords, id) : -1;
+    if (index < 0) {
+        return id;
+    }
+    KDNode* leaf = ownPath(insertPath);
+    leaf->valueIds[index] = storage->values.add(value);
+    dropValue(id);
+    return leaf->valueIds[index];
+}
+
+bool KDTree::findValue(const std::vector<double>& coords, std::string& value) const {
+    if (coords.size() != static_cast<size_t>(dimensions)) {
+        return false;
+    }
     
-    if (min[currentDim] <= point.getCoordinate(currentDim)) {
-        rangeSearch(node->left.get(), min, max, depth + 1, results);
+    const KDNode* leaf = findLeaf(coords);
+    for (uint32_t i = 0; leaf && i < leaf->size; ++i) {
+        if (matches(leaf, i, coords)) {
+            getValue(leaf->valueIds[i], value);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool KDTree::search(const Point& point) const {
+    if (point.getDimensions() != dimensions) {
+        return false;
     }
     
-    if (max[currentDim] >= point.getCoordinate(currentDim)) {
-        rangeSearch(node->right.get(), min, max, depth + 1, results);
+    const std::vector<double>& coords = point.getCoordinates();
+    const KDNode* leaf = findLeaf(coords);
+    for (uint32_t i = 0; leaf && i < leaf->size; ++i) {
+        if (matches(leaf, i, coords)) {
+            return true;
+        }
     }
+    return false;
+}
+
+std::vector<Point> KDTree::rangeQuery(const std::vector<double>& min,
+                                     const std::vector<double>& max) const {
+    std::vector<Point> results;
+    forEachInRange(min, max, [&results](const PointView& p) {
+        results.push_back(p.toPoint());
+        return true;
+    });
+    return results;
+}
+
+std::vector<Point> KDTree::radiusQuery(const std::vector<double>& target, double radius) const {
+    return radiusQuery(target, radius, EuclideanMetric());
+}
+
+size_t KDTree::radiusCount(const std::vector<double>& target, double radius) const {
+    return radiusCount(target, radius, EuclideanMetric());
 }
 
 Point KDTree::nearestNeighbor(const std::vector<double>& target) const {
-    if (target.size() != dimensions) {
+    return nearestNeighbor(target, EuclideanMetric());
+}
+
+Point KDTree::nearestNeighbor(const std::vector<double>& target, const SearchOptions& options, bool& exact) const {
+    if (target.size() != static_cast<size_t>(dimensions)) {
         throw std::invalid_argument("Target dimensions do not match tree dimensions");
     }
     
-    if (!root) {
+    if (nodeCount == 0) {
         throw std::runtime_error("Tree is empty");
     }
     
-    Point best = root->point;
-    double bestDist = distance(root->point, target);
-    
-    nearestNeighbor(root.get(), target, 0, best, bestDist);
-    return best;
+    EuclideanMetric metric;
+    const KDNode* best = nullptr;
+    uint32_t bestIndex = 0;
+    double bestDistSq = std::numeric_limits<double>::infinity();
+    SearchBudget budget(options, metric);
+    nearestNeighbor(root, target, metric, best, bestIndex, bestDistSq, budget);
+    
+    // A tiny budget can run out before the first leaf; keep walking until some point turns up
+    if (!best) {
+        budget.visitsLeft = std::numeric_limits<size_t>::max();
+        budget.pruneScale = 1.0;
+        nearestNeighbor(root, target, metric, best, bestIndex, bestDistSq, budget);
+    }
+    exact = budget.exact;
+    return toPoint(best, bestIndex);
 }
 
-void KDTree::nearestNeighbor(const KDNode* node, const std::vector<double>& target, 
-                            int depth, Point& best, double& bestDist) const {
-    if (!node) return;
-    
-    double dist = distance(node->point, target);
-    if (dist < bestDist) {
-        bestDist = dist;
-        best = node->point;
+KDNode* KDTree::newInner(int dimension, double split, KDNode* left, KDNode* right) {
+    KDNode* node = static_cast<KDNode*>(storage->arena.allocate(sizeof(KDNode) + 2 * coordBytes()));
+    node->size = left->size + right->size;
+    node->epoch = storage->epoch;
+    node->left = left;
+    node->right = right;
+    node->split = split;
+    node->dimension = dimension;
+    node->removed = 0;
+    node->capacity = 0;
+    placeArrays(node);
+    refitBox(node);
+    return node;
+}
+
+// One arena block holds the leaf, its box, then its coordinates, then its
+// value ids. The leaf takes whatever room the block's size class has beyond
+// `capacity`.
+KDNode* KDTree::newLeaf(uint32_t capacity) {
+    size_t headerBytes = sizeof(KDNode) + 2 * coordBytes();
+    size_t entryBytes = coordBytes() + sizeof(ValueId);
+    size_t bytes = Arena::roundedSize(headerBytes + capacity * entryBytes);
+    KDNode* leaf = static_cast<KDNode*>(storage->arena.allocate(bytes));
+    leaf->size = 0;
+    leaf->epoch = storage->epoch;
+    leaf->left = nullptr;
+    leaf->right = nullptr;
+    leaf->split = 0.0;
+    leaf->dimension = 0;
+    leaf->removed = 0;
+    leaf->capacity = static_cast<uint32_t>((bytes - headerBytes) / entryBytes);
+    placeArrays(leaf);
+    refitBox(leaf);
+    return leaf;
+}
+
+// Points the array members into the node's own block
+void KDTree::placeArrays(KDNode* node) const {
+    node->box = reinterpret_cast<double*>(node + 1);
+    if (node->isLeaf()) {
+        node->coords = node->box + 2 * dimensions;
+        node->valueIds = reinterpret_cast<ValueId*>(node->coords + static_cast<size_t>(node->capacity) * dimensions);
+    } else {
+        node->coords = nullptr;
+        node->valueIds = nullptr;
+    }
+}
+
+size_t KDTree::nodeBytes(const KDNode* node) const {
+    size_t bytes = sizeof(KDNode) + 2 * coordBytes();
+    if (node->isLeaf()) {
+        bytes += node->capacity * (coordBytes() + sizeof(ValueId));
+    }
+    return Arena::roundedSize(bytes);
+}
+
+// Widens the node's box to take in `point`
+void KDTree::growBox(KDNode* node, const double* point) const {
+    double* low = node->box;
+    double* high = node->box + dimensions;
+    for (int d = 0; d < dimensions; ++d) {
+        low[d] = std::min(low[d], point[d]);
+        high[d] = std::max(high[d], point[d]);
+    }
+}
+
+// Recomputes the box from the leaf's points or the children's boxes. An
+// empty leaf gets an inverted box, which no query overlaps.
+void KDTree::refitBox(KDNode* node) const {
+    double* low = node->box;
+    double* high = node->box + dimensions;
+    if (!node->isLeaf()) {
+        for (int d = 0; d < dimensions; ++d) {
+            low[d] = std::min(node->left->box[d], node->right->box[d]);
+            high[d] = std::max(node->left->box[dimensions + d], node->right->box[dimensions + d]);
+        }
+        return;
+    }
+    std::fill(low, low + dimensions, std::numeric_limits<double>::infinity());
+    std::fill(high, high + dimensions, -std::numeric_limits<double>::infinity());
+    for (uint32_t i = 0; i < node->size; ++i) {
+        growBox(node, node->coords + static_cast<size_t>(i) * dimensions);
+    }
+}
+
+// Nodes are freed one by one only when replaced; their values are handled separately
+void KDTree::freeNode(KDNode* node) {
+    storage->arena.deallocate(node, nodeBytes(node));
+}
+
+// A node from an earlier epoch is reachable from a snapshot, unless none is alive
+bool KDTree::isShared(const KDNode* node) const {
+    return node->epoch != storage->epoch && storage->snapshotCount.load() > 0;
+}
+
+// The copy takes over the points; the original keeps them for snapshots
+KDNode* KDTree::copyNode(KDNode* node) {
+    size_t bytes = nodeBytes(node);
+    KDNode* copy = static_cast<KDNode*>(storage->arena.allocate(bytes));
+    std::memcpy(copy, node, bytes);
+    placeArrays(copy);
+    copy->epoch = storage->epoch;
+    dropNode(node);
+    return copy;
+}
+
+// Returns the node `link` points to, first replacing it with a copy if it is shared
+KDNode* KDTree::writable(KDNode*& link) {
+    if (isShared(link)) {
+        link = copyNode(link);
+    }
+    return link;
+}
+
+// Makes every node on a root-to-node path writable, top down, so each copy
+// is linked into an already private parent. Returns the last node.
+KDNode* KDTree::ownPath(std::vector<KDNode*>& path) {
+    KDNode** link = &root;
+    for (size_t i = 0; i < path.size(); ++i) {
+        KDNode* node = writable(*link);
+        if (i + 1 < path.size()) {
+            link = node->left == path[i + 1] ? &node->left : &node->right;
+        }
+        path[i] = node;
+    }
+    return path.back();
+}
+
+void KDTree::dropNode(KDNode* node) {
+    if (isShared(node)) {
+        storage->retired.push_back({storage->epoch, node, ANY_VALUE});
+    } else {
+        freeNode(node);
+    }
+}
+
+void KDTree::dropValue(ValueId id) {
+    if (storage->snapshotCount.load() > 0) {
+        storage->retired.push_back({storage->epoch, nullptr, id});
+    } else {
+        storage->values.remove(id);
+    }
+}
+
+// Called before each change; frees what the released snapshots were holding
+void KDTree::reclaim() {
+    std::deque<Storage::Retired>& retired = storage->retired;
+    if (retired.empty()) {
+        return;
     }
     
-    int currentDim = depth % dimensions;
-    double diff = target[currentDim] - node->point.getCoordinate(currentDim);
-    
-    const KDNode* near = diff < 0 ? node->left.get() : node->right.get();
-    const KDNode* far = diff < 0 ? node->right.get() : node->left.get();
-    
-    nearestNeighbor(near, target, depth + 1, best, bestDist);
-    
-    if (std::abs(diff) < bestDist) {
-        nearestNeighbor(far, target, depth + 1, best, bestDist);
+    uint32_t oldest = UINT32_MAX;
+    {
+        std::lock_guard<std::mutex> lock(storage->snapshotMutex);
+        if (!storage->liveSnapshots.empty()) {
+            oldest = *storage->liveSnapshots.begin();
+        }
+    }
+    // Retirement epochs only grow, so the freeable entries are at the front
+    while (!retired.empty() && retired.front().epoch <= oldest) {
+        if (retired.front().node) {
+            freeNode(retired.front().node);
+        } else {
+            storage->values.remove(retired.front().value);
+        }
+        retired.pop_front();
+    }
+}
+
+size_t KDTree::coordBytes() const {
+    return dimensions * sizeof(double);
+}
+
+bool KDTree::matches(const KDNode* leaf, uint32_t i, const std::vector<double>& coords) const {
+    const double* point = leaf->coords + static_cast<size_t>(i) * dimensions;
+    for (int d = 0; d < dimensions; ++d) {
+        if (std::abs(point[d] - coords[d]) > 1e-10) {
+            return false;
+        }
     }
+    return true;
 }
 
-double KDTree::distance(const Point& p1, const Point& p2) const {
-    return p1.distanceTo(p2);
+Point KDTree::toPoint(const KDNode* leaf, uint32_t i) const {
+    const double* point = leaf->coords + static_cast<size_t>(i) * dimensions;
+    return Point(std::vector<double>(point, point + dimensions), storage->values.get(leaf->valueIds[i]));
 }
 
-double KDTree::distance(const Point& p, const std::vector<double>& coords) const {
-    return p.distanceTo(coords);
+PointView KDTree::view(const KDNode* leaf, uint32_t i) const {
+    const ValueStore& values = storage->values;
+    ValueId id = leaf->valueIds[i];
+    return PointView(leaf->coords + static_cast<size_t>(i) * dimensions, dimensions, values.data(id),
+                     values.length(id), id);
 }
 
 bool KDTree::isEmpty() const {
-    return !root;
+    return nodeCount == 0;
 }
 
+// Nodes own nothing outside the arena and the value store, so dropping both
+// frees the whole tree at once. While snapshots hold the storage, the tree
+// moves to new storage instead and the old one goes with the last snapshot.
 void KDTree::clear() {
-    root.reset();
+    if (storage->snapshotCount.load() > 0) {
+        storage = std::make_shared<Storage>(storage->values.interning());
+    } else {
+        storage->arena.release();
+        storage->values.clear();
+        storage->retired.clear();
+    }
+    root = nullptr;
+    nodeCount = 0;
 }
 
 int KDTree::size() const {
-    return countNodes(root.get());
+    return nodeCount;
 }
 
-int KDTree::countNodes(const KDNode* node) const {
+// Levels of inner nodes plus the leaf level
+int KDTree::height() const {
+    return nodeHeight(root);
+}
+
+size_t KDTree::memoryUsage() const {
+    size_t bytes = 0;
+    std::vector<const KDNode*> pending;
+    if (root) pending.push_back(root);
+    while (!pending.empty()) {
+        const KDNode* node = pending.back();
+        pending.pop_back();
+        bytes += nodeBytes(node);
+        if (!node->isLeaf()) {
+            pending.push_back(node->left);
+            pending.push_back(node->right);
+        }
+    }
+    return bytes;
+}
+
+size_t KDTree::valueMemoryUsage() const {
+    return storage->values.memoryUsage();
+}
+
+int KDTree::nodeHeight(const KDNode* node) const {
     if (!node) return 0;
-    return 1 + countNodes(node->left.get()) + countNodes(node->right.get());
+    if (node->isLeaf()) return 1;
+    return 1 + std::max(nodeHeight(node->left), nodeHeight(node->right));
+}
+
+void KDTree::collectPoints(const KDNode* node, std::vector<Point>& out) const {
+    if (!node) return;
+    if (node->isLeaf()) {
+        for (uint32_t i = 0; i < node->size; ++i) {
+            out.push_back(toPoint(node, i));
+        }
+        return;
+    }
+    collectPoints(node->left, out);
+    collectPoints(node->right, out);
+}
+
+// Lists the points under `node` as entries and every node of the subtree
+void KDTree::collectEntries(KDNode* node, std::vector<Entry>& entries, std::vector<KDNode*>& nodes) const {
+    nodes.push_back(node);
+    // Breadth-first over the vector itself, so no recursion on a degenerate subtree
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        const KDNode* current = nodes[n];
+        if (!current->isLeaf()) {
+            nodes.push_back(current->left);
+            nodes.push_back(current->right);
+            continue;
+        }
+        for (uint32_t i = 0; i < current->size; ++i) {
+            entries.push_back({current->coords + static_cast<size_t>(i) * dimensions, current->valueIds[i], 0.0});
+        }
+    }
 }
 
 int KDTree::getDimensions() const {
     return dimensions;
 }
 
+std::vector<Point> KDTree::getAllPoints() const {
+    std::vector<Point> points;
+    collectPoints(root, points);
+    return points;
+}
+
 void KDTree::print() const {
-    printInOrder(root.get());
+    printInOrder(root);
 }
 
 void KDTree::printInOrder(const KDNode* node) const {
     if (!node) return;
     
-    printInOrder(node->left.get());
-    node->point.print();
-    printInOrder(node->right.get());
+    if (node->isLeaf()) {
+        for (uint32_t i = 0; i < node->size; ++i) {
+            toPoint(node, i).print();
+        }
+        return;
+    }
+    printInOrder(node->left);
+    printInOrder(node->right);
 }
 
 void KDTree::update(const Point& oldPoint, const Point& newPoint) {
@@ -261,22 +959,13 @@ void KDTree::update(const Point& oldPoint, const Point& newPoint) {
     // If the points are the same, just update the value
     if (oldPoint.equals(newPoint)) {
         // Find the existing point and update its value
-        KDNode* current = root.get();
-        int depth = 0;
-        
-        while (current) {
-            if (oldPoint.equals(current->point)) {
-                current->point.setValue(newPoint.getValue());
+        const std::vector<double>& coords = oldPoint.getCoordinates();
+        const KDNode* leaf = findLeaf(coords);
+        for (uint32_t i = 0; leaf && i < leaf->size; ++i) {
+            if (matches(leaf, i, coords)) {
+                setValue(coords, leaf->valueIds[i], newPoint.getValue());
                 return;
             }
-            
-            int currentDim = depth % dimensions;
-            if (oldPoint.getCoordinate(currentDim) < current->point.getCoordinate(currentDim)) {
-                current = current->left.get();
-            } else {
-                current = current->right.get();
-            }
-            depth++;
         }
         return;
     }
@@ -287,110 +976,25 @@ void KDTree::update(const Point& oldPoint, const Point& newPoint) {
     }
 }
 
-std::vector<Point> KDTree::kNearestNeighbors(const std::vector<double>& target, int k) const {
-    if (target.size() != dimensions) {
-        throw std::invalid_argument("Target dimensions do not match tree dimensions");
-    }
-    
-    if (k <= 0) {
-        return {};
-    }
-    
-    if (!root) {
-        return {};
-    }
-    
-    // Use a max-heap to keep track of k nearest neighbors
-    auto cmp = [](const std::pair<Point, double>& a, const std::pair<Point, double>& b) {
-        return a.second < b.second;
-    };
-    std::priority_queue<std::pair<Point, double>, std::vector<std::pair<Point, double>>, decltype(cmp)> maxHeap(cmp);
-    
-    // Helper lambda for k-nearest neighbor search
-    std::function<void(const KDNode*, int)> search = [&](const KDNode* node, int depth) {
-        if (!node) return;
-        
-        double dist = distance(node->point, target);
-        
-        if (maxHeap.size() < static_cast<size_t>(k)) {
-            maxHeap.emplace(node->point, dist);
-        } else if (dist < maxHeap.top().second) {
-            maxHeap.pop();
-            maxHeap.emplace(node->point, dist);
-        }
-        
-        int currentDim = depth % dimensions;
-        double diff = target[currentDim] - node->point.getCoordinate(currentDim);
-        
-        const KDNode* near = diff < 0 ? node->left.get() : node->right.get();
-        const KDNode* far = diff < 0 ? node->right.get() : node->left.get();
-        
-        search(near, depth + 1);
-        
-        if (maxHeap.size() < static_cast<size_t>(k) || std::abs(diff) < maxHeap.top().second) {
-            search(far, depth + 1);
-        }
-    };
-    
-    search(root.get(), 0);
-    
-    std::vector<Point> result;
-    while (!maxHeap.empty()) {
-        result.push_back(maxHeap.top().first);
-        maxHeap.pop();
-    }
-    
-    // Reverse to get ascending order by distance
-    std::reverse(result.begin(), result.end());
-    return result;
-}
-
-std::unique_ptr<KDNode> KDTree::buildTree(std::vector<Point>& points, int depth, int left, int right) {
-    if (left >= right) {
-        return nullptr;
-    }
-    
-    int currentDim = depth % dimensions;
-    
-    // Find median using nth_element
-    int mid = left + (right - left) / 2;
-    std::nth_element(points.begin() + left, points.begin() + mid, points.begin() + right,
-        [currentDim](const Point& a, const Point& b) {
-            return a.getCoordinate(currentDim) < b.getCoordinate(currentDim);
-        });
-    
-    auto node = std::make_unique<KDNode>(points[mid]);
-    node->left = buildTree(points, depth + 1, left, mid);
-    node->right = buildTree(points, depth + 1, mid + 1, right);
-    
-    return node;
+std::vector<Point> KDTree::kNearestNeighbors(const std::vector<double>& target, int k, double maxDistSq) const {
+    std::vector<Neighbor> nearest;
+    kNearestNeighbors(target, k, nearest, maxDistSq);
+    return toPoints(nearest);
 }
 
-double KDTree::findMedian(std::vector<Point>& points, int left, int right, int dimension) {
-    if (left >= right) {
-        return 0.0;
-    }
-    
-    int mid = left + (right - left) / 2;
-    std::nth_element(points.begin() + left, points.begin() + mid, points.begin() + right,
-        [dimension](const Point& a, const Point& b) {
-            return a.getCoordinate(dimension) < b.getCoordinate(dimension);
-        });
-    
-    return points[mid].getCoordinate(dimension);
+void KDTree::kNearestNeighbors(const std::vector<double>& target, int k, std::vector<Neighbor>& out,
+                               double maxDistSq) const {
+    EuclideanMetric metric;
+    SearchBudget budget(SearchOptions(), metric);
+    findNearest(target, k, maxDistSq, metric, budget, out);
 }
 
-int KDTree::partition(std::vector<Point>& points, int left, int right, int pivot, int dimension) {
-    std::swap(points[pivot], points[right - 1]);
-    int store = left;
-    
-    for (int i = left; i < right - 1; ++i) {
-        if (points[i].getCoordinate(dimension) < points[right - 1].getCoordinate(dimension)) {
-            std::swap(points[i], points[store]);
-            ++store;
-        }
-    }
-    
-    std::swap(points[store], points[right - 1]);
-    return store;
+std::vector<Point> KDTree::kNearestNeighbors(const std::vector<double>& target, int k,
+                                             const SearchOptions& options, bool& exact) const {
+    EuclideanMetric metric;
+    SearchBudget budget(options, metric);
+    std::vector<Neighbor> nearest;
+    findNearest(target, k, std::numeric_limits<double>::infinity(), metric, budget, nearest);
+    exact = budget.exact;
+    return toPoints(nearest);
 }
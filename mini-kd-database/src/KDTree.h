@@ -2,72 +2,711 @@
 #define KDTREE_H
 
 #include "Point.h"
+#include "Arena.h"
+#include "ValueStore.h"
+#include "Metric.h"
+#include "QueryStats.h"
 #include <vector>
 #include <memory>
 #include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <limits>
+#include <mutex>
 
+// Limits for approximate nearest-neighbor searches
+struct SearchOptions {
+    // A subtree is skipped once (1 + epsilon) times its distance reaches the
+    // current best, so each result is within (1 + epsilon) of the true one
+    double epsilon = 0.0;
+    // Nodes to examine before giving up with the best found so far (0 = no limit)
+    size_t maxVisits = 0;
+};
+
+// One kNN result: a view of the stored point (valid as long as any
+// PointView from the same tree) and its squared distance to the target, or
+// its reduced distance (see Metric.h) for a search under another metric
+struct Neighbor {
+    PointView point;
+    double distSq;
+    
+    // Heap order for the k best so far: the farthest on top
+    static bool closer(const Neighbor& a, const Neighbor& b) { return a.distSq < b.distSq; }
+};
+
+// Inner nodes only route: points with coords[dimension] < split live on the
+// left. Points live in leaves (no children), up to `capacity` of them back
+// to back: `size` coordinate tuples in `coords` and the matching value ids
+// in `valueIds`, both in the same arena block as the leaf itself. Values
+// live in the tree's ValueStore.
+// Every node also keeps the tight bounding box of the points under it in
+// `box` (low corner, then high corner), right behind the node in its block.
+// Nodes created before the latest snapshot (epoch older than the tree's)
+// may be shared with snapshots and are copied rather than changed.
+// An inner node counts the removes below it that no rebuild has compacted
+// yet in `removed`; see KDTree::compactAfterRemove.
 class KDNode {
 public:
-    Point point;
-    std::unique_ptr<KDNode> left;
-    std::unique_ptr<KDNode> right;
+    uint32_t size;  // points in this subtree
+    uint32_t epoch;
+    KDNode* left;
+    KDNode* right;
+    double* box;
+    
+    // Inner nodes
+    double split;
+    int dimension;
+    uint32_t removed;
     
-    KDNode(const Point& p);
+    // Leaves
+    uint32_t capacity;
+    double* coords;
+    ValueStore::ValueId* valueIds;
+    
+    bool isLeaf() const { return !left; }
 };
 
 class KDTree {
+public:
+    typedef ValueStore::ValueId ValueId;
+
+    static const int DEFAULT_BUCKET_SIZE = 32;
+
 private:
-    std::unique_ptr<KDNode> root;
+    // Leaf distances are computed this many points at a time by the batch kernel
+    static const uint32_t SCAN_CHUNK = 64;
+    
+    // Arena, value store and snapshot bookkeeping; shared with snapshots
+    struct Storage;
+    std::shared_ptr<Storage> storage;
+    KDNode* root;
     int dimensions;
+    int bucketSize;
+    int nodeCount;  // points
+    std::vector<KDNode*> insertPath;  // path buffer reused by every update
+    
+    // Set on trees returned by snapshot()
+    bool isSnapshot;
+    uint32_t snapshotEpoch;
+    KDTree(const KDTree& live, uint32_t epoch);
+    
+    // A point on its way into a leaf: its coordinates and value handle.
+    // buildTree copies the coordinate it splits on into key, so the median
+    // search compares in place instead of following coords.
+    struct Entry {
+        const double* coords;
+        ValueId id;
+        double key;
+    };
     
     // Helper methods
-    std::unique_ptr<KDNode> buildTree(std::vector<Point>& points, int depth, int left, int right);
-    int partition(std::vector<Point>& points, int left, int right, int pivot, int dimension);
-    double findMedian(std::vector<Point>& points, int left, int right, int dimension);
+    KDNode* buildTree(Entry* first, Entry* last, std::mutex* allocation, int threads = 1);
+    template <typename AddValue>
+    void buildEntries(std::vector<Entry>& entries, AddValue addValue, std::vector<ValueId>* ids);
+    KDNode* rebuildSubtree(KDNode* node);
+    void rebalanceAfterInsert(int depth);
+    void compactAfterRemove();
+    int depthLimit(uint32_t points) const;
+    
+    // Search helpers. Distance searches are templates over a Metric policy
+    // (see Metric.h) and work in its reduced distances throughout.
+    template <typename Visitor>
+    bool visitRange(const KDNode* node, const std::vector<double>& min,
+                    const std::vector<double>& max, Visitor& visit) const;
+    template <typename Visitor>
+    bool visitAll(const KDNode* node, Visitor& visit) const;
+    template <typename Metric, typename Visitor>
+    bool visitRadius(const KDNode* node, const std::vector<double>& target, double bound, const Metric& metric,
+                     Visitor& visit) const;
+    template <typename Metric>
+    size_t countInRadius(const KDNode* node, const std::vector<double>& target, double bound,
+                         const Metric& metric) const;
+    template <typename Metric, typename OnPoint>
+    void scanLeaf(const KDNode* leaf, const double* target, const Metric& metric, OnPoint onPoint) const;
+    template <typename Metric>
+    void nearestNeighbor(const KDNode* node, const std::vector<double>& target, const Metric& metric,
+                         const KDNode*& best, uint32_t& bestIndex, double& bestDist) const;
+    template <typename Metric>
+    void checkMetric(const Metric&) const {}
+    void checkMetric(const WeightedEuclideanMetric& metric) const;
+    int findEntry(const std::vector<double>& coords, ValueId id);
+    const KDNode* findLeaf(const std::vector<double>& coords) const;
+    void eraseEntry(uint32_t index);
     
-    // Search helpers
-    void rangeSearch(const KDNode* node, const std::vector<double>& min, 
-                    const std::vector<double>& max, int depth, std::vector<Point>& results) const;
-    void nearestNeighbor(const KDNode* node, const std::vector<double>& target, 
-                        int depth, Point& best, double& bestDist) const;
+    // Pruning state of one search; exact searches use pruneScale 1 and no visit limit
+    struct SearchBudget {
+        double pruneScale;  // (1 + epsilon) in the metric's reduced terms
+        size_t visitsLeft;
+        bool exact;
+        
+        template <typename Metric>
+        SearchBudget(const SearchOptions& options, const Metric& metric)
+            : pruneScale(metric.reduce(1.0 + options.epsilon)),
+              visitsLeft(options.maxVisits > 0 ? options.maxVisits : std::numeric_limits<size_t>::max()),
+              exact(true) {}
+    };
+    template <typename Metric>
+    void nearestNeighbor(const KDNode* node, const std::vector<double>& target, const Metric& metric,
+                         const KDNode*& best, uint32_t& bestIndex, double& bestDist, SearchBudget& budget) const;
+    template <typename Metric>
+    void findNearest(const std::vector<double>& target, int k, double maxDist, const Metric& metric,
+                     SearchBudget& budget, std::vector<Neighbor>& out) const;
+    template <typename Metric>
+    void collectNearest(const KDNode* node, const std::vector<double>& target, size_t k, double maxDist,
+                        const Metric& metric, SearchBudget& budget, std::vector<Neighbor>& heap) const;
     
-    // Insert helpers
-    std::unique_ptr<KDNode> insertNode(std::unique_ptr<KDNode> node, const Point& point, int depth);
+    // Node storage
+    KDNode* newInner(int dimension, double split, KDNode* left, KDNode* right);
+    KDNode* newLeaf(uint32_t capacity);
+    void freeNode(KDNode* node);
+    size_t nodeBytes(const KDNode* node) const;
+    size_t coordBytes() const;
+    void placeArrays(KDNode* node) const;
     
-    // Delete helpers
-    std::unique_ptr<KDNode> deleteNode(std::unique_ptr<KDNode> node, const Point& point, int depth);
-    std::unique_ptr<KDNode> findMin(std::unique_ptr<KDNode> node, int dimension, int currentDim);
+    // Bounding boxes
+    void growBox(KDNode* node, const double* point) const;
+    void refitBox(KDNode* node) const;
+    template <typename Metric>
+    double boxDistance(const KDNode* node, const std::vector<double>& target, const Metric& metric) const;
+    template <typename Metric>
+    double boxFarDistance(const KDNode* node, const std::vector<double>& target, const Metric& metric) const;
+    bool boxOverlaps(const KDNode* node, const std::vector<double>& min, const std::vector<double>& max) const;
+    bool boxInside(const KDNode* node, const std::vector<double>& min, const std::vector<double>& max) const;
+    
+    // Copy-on-write: shared nodes are copied before a change, and whatever
+    // leaves the tree is parked until no snapshot can reach it
+    bool isShared(const KDNode* node) const;
+    KDNode* copyNode(KDNode* node);
+    KDNode* writable(KDNode*& link);
+    KDNode* ownPath(std::vector<KDNode*>& path);
+    void dropNode(KDNode* node);
+    void dropValue(ValueId id);
+    void reclaim();
     
     // Utility
-    double distance(const Point& p1, const Point& p2) const;
-    double distance(const Point& p, const std::vector<double>& coords) const;
+    bool matches(const KDNode* leaf, uint32_t i, const std::vector<double>& coords) const;
+    Point toPoint(const KDNode* leaf, uint32_t i) const;
+    PointView view(const KDNode* leaf, uint32_t i) const;
 
 public:
-    KDTree(int dims);
+    // Leaves hold up to bucketSize points and split in two when one more
+    // arrives. With internValues, points with equal values share one copy
+    // of the value bytes (see ValueStore); worth it when labels repeat.
+    explicit KDTree(int dims, int bucketSize = DEFAULT_BUCKET_SIZE, bool internValues = false);
+    ~KDTree();
+    KDTree(KDTree&& other);
+    KDTree& operator=(KDTree&& other);
     
     // Core operations
-    void insert(const Point& point);
+    ValueId insert(const Point& point);
+    // Replaces (or, without replace, merges into) the contents with a
+    // balanced tree of `points`. If ids is given, (*ids)[i] is set to the
+    // ValueId of points[i]; the current contents come after the batch when
+    // merging.
+    void build(std::vector<Point> points, bool replace = true, std::vector<ValueId>* ids = nullptr);
+    void build(const PointBatch& batch, std::vector<ValueId>* ids = nullptr);
     bool remove(const Point& point);
     bool search(const Point& point) const;
     void update(const Point& oldPoint, const Point& newPoint);
     
+    // Value handles
+    // Every stored point has a ValueId (returned by insert, exposed by
+    // PointView::getValueId) that stays valid until the point is removed or
+    // the tree is rebuilt. Reads through it skip the tree walk. setValue
+    // returns the id now holding the value: the same one, unless a snapshot
+    // still shows the old value, in which case the point gets a new id.
+    bool remove(const std::vector<double>& coords, ValueId id);
+    std::string getValue(ValueId id) const;
+    void getValue(ValueId id, std::string& out) const;
+    ValueId setValue(const std::vector<double>& coords, ValueId id, const std::string& value);
+    bool findValue(const std::vector<double>& coords, std::string& value) const;
+    
+    // Snapshots
+    // Returns an immutable view of the tree as it is now, in O(1). The view
+    // shares every node with this tree; from then on a write copies the
+    // O(depth) nodes on its path instead of changing shared ones, and clear()
+    // moves the tree to fresh storage. Memory only the view still uses is
+    // reclaimed once the last reference to it is released. A snapshot can be
+    // queried from any thread while this tree keeps changing.
+    std::shared_ptr<const KDTree> snapshot();
+    
+    // forEachInRange over the whole tree, in no particular order
+    template <typename Visitor>
+    bool forEachPoint(Visitor&& visit) const;
+    
     // Query operations
+    // In a KD_STATS build every range, radius and nearest-neighbor search
+    // adds its work to threadQueryStats(); see QueryStats.h.
     std::vector<Point> rangeQuery(const std::vector<double>& min, const std::vector<double>& max) const;
+    // Ball queries: the points within `radius` of target, boundary included.
+    // radiusCount takes the size of every subtree whose box lies inside the
+    // ball without looking at its points, and copies nothing.
+    std::vector<Point> radiusQuery(const std::vector<double>& target, double radius) const;
+    size_t radiusCount(const std::vector<double>& target, double radius) const;
     Point nearestNeighbor(const std::vector<double>& target) const;
-    std::vector<Point> kNearestNeighbors(const std::vector<double>& target, int k) const;
+    // Only points strictly closer than sqrt(maxDistSq) qualify, so a caller
+    // that already holds k candidates can pass its current k-th distance
+    std::vector<Point> kNearestNeighbors(const std::vector<double>& target, int k,
+                                         double maxDistSq = std::numeric_limits<double>::infinity()) const;
+    // The same search into a caller-owned buffer: `out` is cleared and
+    // refilled nearest first, reusing its capacity, so repeated queries
+    // allocate nothing. The views point into the tree; nothing is copied.
+    void kNearestNeighbors(const std::vector<double>& target, int k, std::vector<Neighbor>& out,
+                           double maxDistSq = std::numeric_limits<double>::infinity()) const;
+    
+    // Approximate versions of the two searches above, bounded by `options`.
+    // `exact` tells whether the result is still guaranteed exact: it is
+    // false once a subtree was skipped only thanks to epsilon, or the visit
+    // budget ran out before the search was done.
+    Point nearestNeighbor(const std::vector<double>& target, const SearchOptions& options, bool& exact) const;
+    std::vector<Point> kNearestNeighbors(const std::vector<double>& target, int k, const SearchOptions& options,
+                                         bool& exact) const;
+    
+    // Searches under another distance, given as a policy from Metric.h (or
+    // any type with the same members). They prune on the metric's own
+    // plane and box bounds; the Euclidean versions above are these with
+    // EuclideanMetric. `radius` is a true distance, while Neighbor::distSq
+    // holds the metric's reduced distance.
+    template <typename Metric>
+    Point nearestNeighbor(const std::vector<double>& target, const Metric& metric) const;
+    template <typename Metric>
+    void kNearestNeighbors(const std::vector<double>& target, int k, const Metric& metric,
+                           std::vector<Neighbor>& out) const;
+    template <typename Metric>
+    std::vector<Point> radiusQuery(const std::vector<double>& target, double radius, const Metric& metric) const;
+    template <typename Metric>
+    size_t radiusCount(const std::vector<double>& target, double radius, const Metric& metric) const;
+    
+    // Streaming queries
+    // Calls visit(const PointView&) for every point inside [min, max] without
+    // collecting them. Returning false from visit stops the scan early; the
+    // result tells whether the scan ran to completion.
+    template <typename Visitor>
+    bool forEachInRange(const std::vector<double>& min, const std::vector<double>& max,
+                        Visitor&& visit) const;
+    // The same for every point within `radius` of target
+    template <typename Visitor>
+    bool forEachInRadius(const std::vector<double>& target, double radius, Visitor&& visit) const;
+    template <typename Metric, typename Visitor>
+    bool forEachInRadius(const std::vector<double>& target, double radius, const Metric& metric,
+                         Visitor&& visit) const;
     
     // Utility
     bool isEmpty() const;
     void clear();
     void print() const;
     int size() const;
+    int height() const;
+    // Bytes of arena blocks held by the nodes, coordinates included (values not)
+    size_t memoryUsage() const;
+    // Bytes held for the values, as ValueStore::memoryUsage
+    size_t valueMemoryUsage() const;
     
     // Getters
     int getDimensions() const;
+    std::vector<Point> getAllPoints() const;
     
 private:
-    int countNodes(const KDNode* node) const;
+    int nodeHeight(const KDNode* node) const;
+    void collectPoints(const KDNode* node, std::vector<Point>& out) const;
+    void collectEntries(KDNode* node, std::vector<Entry>& entries, std::vector<KDNode*>& nodes) const;
     void printInOrder(const KDNode* node) const;
 };
 
+template <typename Visitor>
+bool KDTree::forEachInRange(const std::vector<double>& min, const std::vector<double>& max,
+                            Visitor&& visit) const {
+    if (min.size() != static_cast<size_t>(dimensions) || max.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Range dimensions do not match tree dimensions");
+    }
+    return visitRange(root, min, max, visit);
+}
+
+template <typename Visitor>
+bool KDTree::forEachInRadius(const std::vector<double>& target, double radius, Visitor&& visit) const {
+    return forEachInRadius(target, radius, EuclideanMetric(), visit);
+}
+
+template <typename Metric, typename Visitor>
+bool KDTree::forEachInRadius(const std::vector<double>& target, double radius, const Metric& metric,
+                             Visitor&& visit) const {
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match tree dimensions");
+    }
+    checkMetric(metric);
+    return !root || radius < 0 || visitRadius(root, target, metric.reduce(radius), metric, visit);
+}
+
+template <typename Metric>
+std::vector<Point> KDTree::radiusQuery(const std::vector<double>& target, double radius,
+                                       const Metric& metric) const {
+    std::vector<Point> results;
+    forEachInRadius(target, radius, metric, [&results](const PointView& p) {
+        results.push_back(p.toPoint());
+        return true;
+    });
+    return results;
+}
+
+template <typename Metric>
+size_t KDTree::radiusCount(const std::vector<double>& target, double radius, const Metric& metric) const {
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match tree dimensions");
+    }
+    checkMetric(metric);
+    if (!root || radius < 0) {
+        return 0;
+    }
+    return countInRadius(root, target, metric.reduce(radius), metric);
+}
+
+template <typename Metric>
+Point KDTree::nearestNeighbor(const std::vector<double>& target, const Metric& metric) const {
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match tree dimensions");
+    }
+    checkMetric(metric);
+    
+    if (nodeCount == 0) {
+        throw std::runtime_error("Tree is empty");
+    }
+    
+    // The search runs on reduced distances; no root is needed to pick the winner
+    const KDNode* best = nullptr;
+    uint32_t bestIndex = 0;
+    double bestDist = std::numeric_limits<double>::infinity();
+    
+    nearestNeighbor(root, target, metric, best, bestIndex, bestDist);
+    return toPoint(best, bestIndex);
+}
+
+template <typename Metric>
+void KDTree::kNearestNeighbors(const std::vector<double>& target, int k, const Metric& metric,
+                               std::vector<Neighbor>& out) const {
+    SearchBudget budget(SearchOptions(), metric);
+    findNearest(target, k, std::numeric_limits<double>::infinity(), metric, budget, out);
+}
+
+inline void KDTree::checkMetric(const WeightedEuclideanMetric& metric) const {
+    if (metric.getDimensions() != dimensions) {
+        throw std::invalid_argument("Metric dimensions do not match tree dimensions");
+    }
+}
+
+template <typename Visitor>
+bool KDTree::forEachPoint(Visitor&& visit) const {
+    return !root || visitAll(root, visit);
+}
+
+// Reduced distance from target to the nearest point of the node's box; a
+// lower bound for every point in the subtree
+template <typename Metric>
+double KDTree::boxDistance(const KDNode* node, const std::vector<double>& target, const Metric& metric) const {
+    const double* low = node->box;
+    const double* high = node->box + dimensions;
+    double sum = 0.0;
+    for (int d = 0; d < dimensions; ++d) {
+        double gap = target[d] < low[d] ? low[d] - target[d] : (target[d] > high[d] ? target[d] - high[d] : 0.0);
+        sum = metric.combine(sum, metric.planeDistance(gap, d));
+    }
+    return sum;
+}
+
+// Reduced distance from target to the farthest corner of the node's box
+template <typename Metric>
+double KDTree::boxFarDistance(const KDNode* node, const std::vector<double>& target, const Metric& metric) const {
+    const double* low = node->box;
+    const double* high = node->box + dimensions;
+    double sum = 0.0;
+    for (int d = 0; d < dimensions; ++d) {
+        double reach = std::max(target[d] - low[d], high[d] - target[d]);
+        sum = metric.combine(sum, metric.planeDistance(reach, d));
+    }
+    return sum;
+}
+
+inline bool KDTree::boxOverlaps(const KDNode* node, const std::vector<double>& min, const std::vector<double>& max) const {
+    for (int d = 0; d < dimensions; ++d) {
+        if (node->box[d] > max[d] || node->box[dimensions + d] < min[d]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline bool KDTree::boxInside(const KDNode* node, const std::vector<double>& min, const std::vector<double>& max) const {
+    for (int d = 0; d < dimensions; ++d) {
+        if (node->box[d] < min[d] || node->box[dimensions + d] > max[d]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Subtrees whose box misses the range are skipped, and subtrees whose box
+// lies inside it are reported whole without looking at coordinates
+template <typename Visitor>
+bool KDTree::visitRange(const KDNode* node, const std::vector<double>& min,
+                        const std::vector<double>& max, Visitor& visit) const {
+    if (!node) return true;
+    if (!boxOverlaps(node, min, max)) {
+        KD_STATS_ADD(subtreesPruned, 1);
+        return true;
+    }
+    KD_STATS_VISIT();
+    
+    if (boxInside(node, min, max)) {
+        return visitAll(node, visit);
+    }
+    
+    if (node->isLeaf()) {
+        KD_STATS_ADD(distanceEvaluations, node->size);
+        const double* coords = node->coords;
+        for (uint32_t i = 0; i < node->size; ++i, coords += dimensions) {
+            bool inRange = true;
+            for (int d = 0; d < dimensions; ++d) {
+                if (coords[d] < min[d] || coords[d] > max[d]) {
+                    inRange = false;
+                    break;
+                }
+            }
+            if (inRange && !visit(view(node, i))) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    return visitRange(node->left, min, max, visit) && visitRange(node->right, min, max, visit);
+}
+
+// As visitRange, with the ball (reduced radius `bound`) in place of the box
+template <typename Metric, typename Visitor>
+bool KDTree::visitRadius(const KDNode* node, const std::vector<double>& target, double bound,
+                         const Metric& metric, Visitor& visit) const {
+    if (boxDistance(node, target, metric) > bound) {
+        KD_STATS_ADD(subtreesPruned, 1);
+        return true;
+    }
+    KD_STATS_VISIT();
+    
+    if (boxFarDistance(node, target, metric) <= bound) {
+        return visitAll(node, visit);
+    }
+    
+    if (node->isLeaf()) {
+        KD_STATS_ADD(distanceEvaluations, node->size);
+        const double* coords = node->coords;
+        for (uint32_t i = 0; i < node->size; ++i, coords += dimensions) {
+            if (metric.distance(coords, target.data(), dimensions) <= bound && !visit(view(node, i))) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    return visitRadius(node->left, target, bound, metric, visit)
+           && visitRadius(node->right, target, bound, metric, visit);
+}
+
+// Subtrees inside the ball count with their size, unvisited
+template <typename Metric>
+size_t KDTree::countInRadius(const KDNode* node, const std::vector<double>& target, double bound,
+                             const Metric& metric) const {
+    if (boxDistance(node, target, metric) > bound) {
+        KD_STATS_ADD(subtreesPruned, 1);
+        return 0;
+    }
+    KD_STATS_VISIT();
+    if (boxFarDistance(node, target, metric) <= bound) {
+        return node->size;
+    }
+    if (!node->isLeaf()) {
+        return countInRadius(node->left, target, bound, metric) + countInRadius(node->right, target, bound, metric);
+    }
+    
+    size_t count = 0;
+    scanLeaf(node, target.data(), metric, [&count, bound](uint32_t, double dist) {
+        count += dist <= bound ? 1 : 0;
+    });
+    return count;
+}
+
+// Calls onPoint(i, reduced distance to target) for every point of a leaf,
+// computing the distances SCAN_CHUNK points at a time
+template <typename Metric, typename OnPoint>
+void KDTree::scanLeaf(const KDNode* leaf, const double* target, const Metric& metric, OnPoint onPoint) const {
+    KD_STATS_ADD(distanceEvaluations, leaf->size);
+    double distances[SCAN_CHUNK];
+    for (uint32_t start = 0; start < leaf->size; start += SCAN_CHUNK) {
+        uint32_t count = std::min(SCAN_CHUNK, leaf->size - start);
+        metric.distances(target, leaf->coords + static_cast<size_t>(start) * dimensions, count, dimensions,
+                         distances);
+        for (uint32_t i = 0; i < count; ++i) {
+            onPoint(start + i, distances[i]);
+        }
+    }
+}
+
+// Leaves are scanned whole. The child whose box is nearer goes first, and a
+// child is searched only while its box is closer than the best point so far.
+// Until some point is found every child is searched and the first point
+// scanned is taken, so targets whose distances overflow to infinity or are
+// NaN still get an answer.
+template <typename Metric>
+void KDTree::nearestNeighbor(const KDNode* node, const std::vector<double>& target, const Metric& metric,
+                             const KDNode*& best, uint32_t& bestIndex, double& bestDist) const {
+    KD_STATS_VISIT();
+    if (node->isLeaf()) {
+        scanLeaf(node, target.data(), metric, [&](uint32_t i, double dist) {
+            if (!best || dist < bestDist) {
+                bestDist = dist;
+                best = node;
+                bestIndex = i;
+            }
+        });
+        return;
+    }
+    
+    double leftDist = boxDistance(node->left, target, metric);
+    double rightDist = boxDistance(node->right, target, metric);
+    bool leftFirst = leftDist <= rightDist;
+    const KDNode* near = leftFirst ? node->left : node->right;
+    const KDNode* far = leftFirst ? node->right : node->left;
+    
+    if (!best || std::min(leftDist, rightDist) < bestDist) {
+        nearestNeighbor(near, target, metric, best, bestIndex, bestDist);
+    } else {
+        KD_STATS_ADD(subtreesPruned, 1);
+    }
+    if (!best || std::max(leftDist, rightDist) < bestDist) {
+        nearestNeighbor(far, target, metric, best, bestIndex, bestDist);
+    } else {
+        KD_STATS_ADD(subtreesPruned, 1);
+    }
+}
+
+// The exact search above with pruning scaled by (1 + epsilon) and a visit limit
+template <typename Metric>
+void KDTree::nearestNeighbor(const KDNode* node, const std::vector<double>& target, const Metric& metric,
+                             const KDNode*& best, uint32_t& bestIndex, double& bestDist,
+                             SearchBudget& budget) const {
+    if (budget.visitsLeft == 0) {
+        budget.exact = false;
+        return;
+    }
+    budget.visitsLeft--;
+    KD_STATS_VISIT();
+    
+    if (node->isLeaf()) {
+        scanLeaf(node, target.data(), metric, [&](uint32_t i, double dist) {
+            if (!best || dist < bestDist) {
+                bestDist = dist;
+                best = node;
+                bestIndex = i;
+            }
+        });
+        return;
+    }
+    
+    double leftDist = boxDistance(node->left, target, metric);
+    double rightDist = boxDistance(node->right, target, metric);
+    bool leftFirst = leftDist <= rightDist;
+    const KDNode* children[2] = {leftFirst ? node->left : node->right, leftFirst ? node->right : node->left};
+    double distances[2] = {std::min(leftDist, rightDist), std::max(leftDist, rightDist)};
+    
+    for (int c = 0; c < 2; ++c) {
+        if (!best || distances[c] * budget.pruneScale < bestDist) {
+            nearestNeighbor(children[c], target, metric, best, bestIndex, bestDist, budget);
+            continue;
+        }
+        KD_STATS_ADD(subtreesPruned, 1);
+        if (distances[c] < bestDist) {
+            budget.exact = false;
+        }
+    }
+}
+
+// `out` serves as a max-heap of the k best so far, then is sorted nearest first
+template <typename Metric>
+void KDTree::findNearest(const std::vector<double>& target, int k, double maxDist, const Metric& metric,
+                         SearchBudget& budget, std::vector<Neighbor>& out) const {
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match tree dimensions");
+    }
+    checkMetric(metric);
+    
+    out.clear();
+    if (k <= 0 || nodeCount == 0) {
+        return;
+    }
+    
+    collectNearest(root, target, static_cast<size_t>(k), maxDist, metric, budget, out);
+    std::sort_heap(out.begin(), out.end(), Neighbor::closer);
+}
+
+template <typename Metric>
+void KDTree::collectNearest(const KDNode* node, const std::vector<double>& target, size_t k, double maxDist,
+                            const Metric& metric, SearchBudget& budget, std::vector<Neighbor>& heap) const {
+    if (budget.visitsLeft == 0) {
+        budget.exact = false;
+        return;
+    }
+    budget.visitsLeft--;
+    KD_STATS_VISIT();
+    
+    // Without a caller's bound the first k points are taken whatever their
+    // distance, so targets whose distances are inf or NaN still get k results
+    bool unbounded = maxDist == std::numeric_limits<double>::infinity();
+    if (node->isLeaf()) {
+        scanLeaf(node, target.data(), metric, [&](uint32_t i, double dist) {
+            if (heap.size() < k) {
+                if (unbounded || dist < maxDist) {
+                    heap.push_back({view(node, i), dist});
+                    std::push_heap(heap.begin(), heap.end(), Neighbor::closer);
+                }
+            } else if (dist < heap.front().distSq) {
+                std::pop_heap(heap.begin(), heap.end(), Neighbor::closer);
+                heap.back() = {view(node, i), dist};
+                std::push_heap(heap.begin(), heap.end(), Neighbor::closer);
+            }
+        });
+        return;
+    }
+    
+    // Nearer box first; a box no closer than the k-th best cannot improve on it
+    double leftDist = boxDistance(node->left, target, metric);
+    double rightDist = boxDistance(node->right, target, metric);
+    bool leftFirst = leftDist <= rightDist;
+    const KDNode* children[2] = {leftFirst ? node->left : node->right, leftFirst ? node->right : node->left};
+    double distances[2] = {std::min(leftDist, rightDist), std::max(leftDist, rightDist)};
+    
+    for (int c = 0; c < 2; ++c) {
+        // Distance a point must beat: the k-th best so far, or the caller's bound until there are k
+        double bound = heap.size() < k ? maxDist : heap.front().distSq;
+        if ((unbounded && heap.size() < k) || distances[c] * budget.pruneScale < bound) {
+            collectNearest(children[c], target, k, maxDist, metric, budget, heap);
+            continue;
+        }
+        KD_STATS_ADD(subtreesPruned, 1);
+        if (distances[c] < bound) {
+            budget.exact = false;
+        }
+    }
+}
+
+template <typename Visitor>
+bool KDTree::visitAll(const KDNode* node, Visitor& visit) const {
+    KD_STATS_VISIT();
+    if (node->isLeaf()) {
+        for (uint32_t i = 0; i < node->size; ++i) {
+            if (!visit(view(node, i))) {
+                return false;
+            }
+        }
+        return true;
+    }
+    return visitAll(node->left, visit) && visitAll(node->right, visit);
+}
+
 #endif // KDTREE_H
@@ -0,0 +1,101 @@
+#include "MappedDelta.h"
+#include <algorithm>
+#include <stdexcept>
+#include <iterator>
+
+MappedDelta::MappedDelta(const StaticKDTree& file, const std::vector<bool>* hidden, size_t hiddenCount,
+                         const KDTree& changes)
+    : file(file), hidden(hidden), hiddenCount(hiddenCount), changes(changes) {}
+
+// A changed point is hidden in the file, so the two never both answer
+bool MappedDelta::findValue(const std::vector<double>& coordinates, std::string& value) const {
+    if (changes.findValue(coordinates, value)) {
+        return true;
+    }
+    size_t position = file.locate(coordinates);
+    if (position == StaticKDTree::NOT_FOUND || (hidden && (*hidden)[position])) {
+        return false;
+    }
+    file.valueAt(position, value);
+    return true;
+}
+
+size_t MappedDelta::radiusCount(const std::vector<double>& target, double radius) const {
+    size_t found = changes.radiusCount(target, radius);
+    if (!hidden) {
+        return found + file.radiusCount(target, radius);
+    }
+    file.forEachInRadius(target, radius, [this, &found](const PointView& p) {
+        found += isHidden(p) ? 0 : 1;
+        return true;
+    });
+    return found;
+}
+
+Point MappedDelta::nearestNeighbor(const std::vector<double>& target) const {
+    std::vector<Neighbor> nearest;
+    kNearestNeighbors(target, 1, nearest);
+    if (nearest.empty()) {
+        throw std::runtime_error("Tree is empty");
+    }
+    return nearest.front().point.toPoint();
+}
+
+std::vector<Point> MappedDelta::kNearestNeighbors(const std::vector<double>& target, int k) const {
+    std::vector<Neighbor> nearest;
+    kNearestNeighbors(target, k, nearest);
+    std::vector<Point> result;
+    result.reserve(nearest.size());
+    for (const Neighbor& n : nearest) {
+        result.push_back(n.point.toPoint());
+    }
+    return result;
+}
+
+// Both searches return nearest first, so their results merge in one pass
+void MappedDelta::kNearestNeighbors(const std::vector<double>& target, int k, std::vector<Neighbor>& out) const {
+    file.kNearestNeighbors(target, k, out, hidden);
+    if (changes.isEmpty()) {
+        return;
+    }
+    std::vector<Neighbor> changed;
+    changes.kNearestNeighbors(target, k, changed);
+    size_t fromFile = out.size();
+    out.insert(out.end(), changed.begin(), changed.end());
+    std::inplace_merge(out.begin(), out.begin() + fromFile, out.end(), Neighbor::closer);
+    if (out.size() > static_cast<size_t>(k)) {
+        out.erase(out.begin() + k, out.end());
+    }
+}
+
+bool MappedDelta::isEmpty() const {
+    return size() == 0;
+}
+
+int MappedDelta::size() const {
+    return file.size() - static_cast<int>(hiddenCount) + changes.size();
+}
+
+int MappedDelta::height() const {
+    return std::max(file.height(), changes.height());
+}
+
+// StaticKDTree::getAllPoints returns the points in layout order
+std::vector<Point> MappedDelta::getAllPoints() const {
+    std::vector<Point> points = file.getAllPoints();
+    if (hidden) {
+        size_t kept = 0;
+        for (size_t i = 0; i < points.size(); ++i) {
+            if (!(*hidden)[i]) {
+                if (kept != i) {
+                    points[kept] = std::move(points[i]);
+                }
+                ++kept;
+            }
+        }
+        points.erase(points.begin() + kept, points.end());
+    }
+    std::vector<Point> changed = changes.getAllPoints();
+    points.insert(points.end(), std::make_move_iterator(changed.begin()), std::make_move_iterator(changed.end()));
+    return points;
+}
@@ -0,0 +1,62 @@
+#ifndef MAPPED_DELTA_H
+#define MAPPED_DELTA_H
+
+#include "KDTree.h"
+#include "StaticKDTree.h"
+#include <vector>
+#include <string>
+
+// Queries over a mapped snapshot file plus the changes made since it was
+// mapped. Points inserted or updated since live in `changes`; the file's
+// copies of points removed or overwritten since are marked in `hidden` by
+// layout position and skipped. Database and DatabaseSnapshot answer
+// through one of these while they serve a mapped file. It only refers to
+// its parts, which must outlive it.
+class MappedDelta {
+private:
+    const StaticKDTree& file;
+    const std::vector<bool>* hidden;  // null while nothing is hidden
+    size_t hiddenCount;
+    const KDTree& changes;
+
+    bool isHidden(const PointView& p) const {
+        return hidden && (*hidden)[p.getValueId()];
+    }
+
+public:
+    MappedDelta(const StaticKDTree& file, const std::vector<bool>* hidden, size_t hiddenCount,
+                const KDTree& changes);
+
+    // Query operations, as in StaticKDTree
+    bool findValue(const std::vector<double>& coordinates, std::string& value) const;
+    size_t radiusCount(const std::vector<double>& target, double radius) const;
+    Point nearestNeighbor(const std::vector<double>& target) const;
+    std::vector<Point> kNearestNeighbors(const std::vector<double>& target, int k) const;
+    void kNearestNeighbors(const std::vector<double>& target, int k, std::vector<Neighbor>& out) const;
+
+    // The file's points first, then the changes
+    template <typename Visitor>
+    bool forEachInRange(const std::vector<double>& min, const std::vector<double>& max,
+                        Visitor&& visit) const {
+        auto visible = [this, &visit](const PointView& p) { return isHidden(p) || visit(p); };
+        return file.forEachInRange(min, max, visible) && changes.forEachInRange(min, max, visit);
+    }
+    template <typename Visitor>
+    bool forEachInRadius(const std::vector<double>& target, double radius, Visitor&& visit) const {
+        auto visible = [this, &visit](const PointView& p) { return isHidden(p) || visit(p); };
+        return file.forEachInRadius(target, radius, visible) && changes.forEachInRadius(target, radius, visit);
+    }
+    template <typename Visitor>
+    bool forEachPoint(Visitor&& visit) const {
+        auto visible = [this, &visit](const PointView& p) { return isHidden(p) || visit(p); };
+        return file.forEachPoint(visible) && changes.forEachPoint(visit);
+    }
+
+    // Utility
+    bool isEmpty() const;
+    int size() const;
+    int height() const;
+    std::vector<Point> getAllPoints() const;
+};
+
+#endif // MAPPED_DELTA_H
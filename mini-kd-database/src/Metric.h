@@ -0,0 +1,120 @@
+#ifndef METRIC_H
+#define METRIC_H
+
+#include "DistanceKernels.h"
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+#include <stdexcept>
+
+// Distance policies for KDTree searches.
+//
+// A policy works in "reduced" distances: the true distance raised to a
+// fixed power (the square for the L2 metrics), which orders points the
+// same way without the root. Each policy supplies
+//   distance(a, b, dims)      reduced distance between two points
+//   distances(target, points, count, dims, out)
+//                             the same from target to `count` points
+//                             stored back to back
+//   planeDistance(diff, d)    reduced distance to a point that differs by
+//                             `diff` along dimension d only; a lower bound
+//                             for every point beyond a splitting plane
+//   combine(sum, term)        folds planeDistance terms of several
+//                             dimensions into the distance to a box
+//   reduce(r), expand(d)      true distance to reduced and back
+// Searches are templates over the policy, so all of these inline into the
+// search loops and no virtual call is made per point or per node.
+
+// Straight-line distance; reduced distance is the squared distance, and
+// leaves are scanned with the SIMD batch kernels
+struct EuclideanMetric {
+    double distance(const double* a, const double* b, int dims) const {
+        return squaredDistance(a, b, dims);
+    }
+    void distances(const double* target, const double* points, size_t count, int dims, double* out) const {
+        squaredDistances(target, points, count, dims, out);
+    }
+    double planeDistance(double diff, int) const { return diff * diff; }
+    double combine(double sum, double term) const { return sum + term; }
+    double reduce(double distance) const { return distance * distance; }
+    double expand(double reduced) const { return std::sqrt(reduced); }
+};
+
+// Sum of absolute coordinate differences (L1)
+struct ManhattanMetric {
+    double distance(const double* a, const double* b, int dims) const {
+        double sum = 0.0;
+        for (int d = 0; d < dims; ++d) {
+            sum += std::abs(a[d] - b[d]);
+        }
+        return sum;
+    }
+    void distances(const double* target, const double* points, size_t count, int dims, double* out) const {
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = distance(target, points + i * dims, dims);
+        }
+    }
+    double planeDistance(double diff, int) const { return std::abs(diff); }
+    double combine(double sum, double term) const { return sum + term; }
+    double reduce(double distance) const { return distance; }
+    double expand(double reduced) const { return reduced; }
+};
+
+// Largest absolute coordinate difference (L-infinity)
+struct ChebyshevMetric {
+    double distance(const double* a, const double* b, int dims) const {
+        double largest = 0.0;
+        for (int d = 0; d < dims; ++d) {
+            largest = std::max(largest, std::abs(a[d] - b[d]));
+        }
+        return largest;
+    }
+    void distances(const double* target, const double* points, size_t count, int dims, double* out) const {
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = distance(target, points + i * dims, dims);
+        }
+    }
+    double planeDistance(double diff, int) const { return std::abs(diff); }
+    double combine(double sum, double term) const { return std::max(sum, term); }
+    double reduce(double distance) const { return distance; }
+    double expand(double reduced) const { return reduced; }
+};
+
+// L2 with a non-negative weight per dimension: sqrt(sum w[d] * diff[d]^2).
+// It must hold one weight for each dimension of the tree it searches.
+class WeightedEuclideanMetric {
+private:
+    std::vector<double> weights;
+
+public:
+    explicit WeightedEuclideanMetric(const std::vector<double>& weights) : weights(weights) {
+        for (double w : weights) {
+            if (!(w >= 0.0)) {
+                throw std::invalid_argument("Metric weights must be non-negative");
+            }
+        }
+    }
+
+    double distance(const double* a, const double* b, int dims) const {
+        double sum = 0.0;
+        for (int d = 0; d < dims; ++d) {
+            double diff = a[d] - b[d];
+            sum += weights[d] * diff * diff;
+        }
+        return sum;
+    }
+    void distances(const double* target, const double* points, size_t count, int dims, double* out) const {
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = distance(target, points + i * dims, dims);
+        }
+    }
+    double planeDistance(double diff, int dimension) const { return weights[dimension] * diff * diff; }
+    double combine(double sum, double term) const { return sum + term; }
+    double reduce(double distance) const { return distance * distance; }
+    double expand(double reduced) const { return std::sqrt(reduced); }
+
+    int getDimensions() const { return static_cast<int>(weights.size()); }
+};
+
+#endif // METRIC_H
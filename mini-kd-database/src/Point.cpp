@@ -1,4 +1,5 @@
 #include "Point.h"
+#include "DistanceKernels.h"
 #include <cmath>
 #include <stdexcept>
 
@@ -40,12 +41,7 @@ double Point::distanceTo(const std::vector<double>& coords) const {
         throw std::invalid_argument("Dimension mismatch");
     }
     
-    double sum = 0.0;
-    for (size_t i = 0; i < coordinates.size(); ++i) {
-        double diff = coordinates[i] - coords[i];
-        sum += diff * diff;
-    }
-    return std::sqrt(sum);
+    return std::sqrt(squaredDistance(coordinates.data(), coords.data(), static_cast<int>(coords.size())));
 }
 
 bool Point::equals(const Point& other) const {
@@ -73,3 +69,104 @@ void Point::print() const {
     }
     std::cout << ") = " << value << std::endl;
 }
+
+
+PointView::PointView(const double* coords, int dims, const char* val, size_t valLength,
+                     uint32_t valId)
+    : coordinates(coords), dimensions(dims), value(val), valueLength(valLength), valueId(valId) {}
+
+const double* PointView::getCoordinates() const {
+    return coordinates;
+}
+
+double PointView::getCoordinate(int dimension) const {
+    return coordinates[dimension];
+}
+
+int PointView::getDimensions() const {
+    return dimensions;
+}
+
+const char* PointView::getValueData() const {
+    return value;
+}
+
+size_t PointView::getValueLength() const {
+    return valueLength;
+}
+
+uint32_t PointView::getValueId() const {
+    return valueId;
+}
+
+std::string PointView::getValue() const {
+    return std::string(value, valueLength);
+}
+
+std::vector<double> PointView::copyCoordinates() const {
+    return std::vector<double>(coordinates, coordinates + dimensions);
+}
+
+Point PointView::toPoint() const {
+    return Point(copyCoordinates(), getValue());
+}
+
+
+PointBatch::PointBatch(int dims) : dimensions(dims), offsets(1, 0) {}
+
+void PointBatch::reserve(size_t points, size_t valueBytes) {
+    coords.reserve(points * dimensions);
+    offsets.reserve(points + 1);
+    blob.reserve(valueBytes);
+}
+
+void PointBatch::add(const double* point, const char* value, size_t valueLength) {
+    coords.insert(coords.end(), point, point + dimensions);
+    blob.append(value, valueLength);
+    offsets.push_back(blob.size());
+}
+
+void PointBatch::add(const std::vector<double>& point, const std::string& value) {
+    if (point.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Point dimensions do not match batch dimensions");
+    }
+    add(point.data(), value.data(), value.size());
+}
+
+size_t PointBatch::size() const {
+    return offsets.size() - 1;
+}
+
+bool PointBatch::empty() const {
+    return offsets.size() == 1;
+}
+
+int PointBatch::getDimensions() const {
+    return dimensions;
+}
+
+const double* PointBatch::coordinatesOf(size_t i) const {
+    return coords.data() + i * dimensions;
+}
+
+PointView PointBatch::view(size_t i) const {
+    return PointView(coordinatesOf(i), dimensions, blob.data() + offsets[i], offsets[i + 1] - offsets[i],
+                     static_cast<uint32_t>(i));
+}
+
+const std::vector<double>& PointBatch::coordinates() const {
+    return coords;
+}
+
+const std::vector<uint64_t>& PointBatch::valueOffsets() const {
+    return offsets;
+}
+
+const std::string& PointBatch::values() const {
+    return blob;
+}
+
+bool PointBatch::operator==(const PointBatch& other) const {
+    return dimensions == other.dimensions && coords == other.coords && offsets == other.offsets
+           && blob == other.blob;
+}
@@ -4,6 +4,10 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include "Metric.h"
 
 class Point {
 private:
@@ -26,6 +30,15 @@ public:
     // Utility functions
     double distanceTo(const Point& other) const;
     double distanceTo(const std::vector<double>& coords) const;
+    // True distance under a policy from Metric.h
+    template <typename Metric>
+    double distanceTo(const Point& other, const Metric& metric) const {
+        if (other.coordinates.size() != coordinates.size()) {
+            throw std::invalid_argument("Dimension mismatch");
+        }
+        return metric.expand(metric.distance(coordinates.data(), other.coordinates.data(),
+                                             static_cast<int>(coordinates.size())));
+    }
     bool equals(const Point& other) const;
     
     // Dimension
@@ -35,4 +48,65 @@ public:
     void print() const;
 };
 
+// Non-owning handle to a point stored inside a tree. It points straight at
+// the tree's coordinate and value storage, so it is only valid until the
+// tree is next modified; call toPoint() to keep a copy.
+class PointView {
+private:
+    const double* coordinates;
+    int dimensions;
+    const char* value;
+    size_t valueLength;
+    uint32_t valueId;
+
+public:
+    PointView(const double* coords, int dims, const char* val, size_t valLength,
+              uint32_t valId = 0);
+    
+    // Getters
+    const double* getCoordinates() const;
+    double getCoordinate(int dimension) const;
+    int getDimensions() const;
+    const char* getValueData() const;
+    size_t getValueLength() const;
+    // Handle of the value inside the owning tree (see KDTree::ValueId)
+    uint32_t getValueId() const;
+    
+    // Copies
+    std::string getValue() const;
+    std::vector<double> copyCoordinates() const;
+    Point toPoint() const;
+};
+
+// Points packed into flat buffers, the way point files and bulk loads carry
+// them: point i's coordinates are coordinates()[i * dimensions] onwards and
+// its value is values()[valueOffsets()[i], valueOffsets()[i + 1]). Filling
+// one allocates per buffer, not per point.
+class PointBatch {
+private:
+    int dimensions;
+    std::vector<double> coords;
+    std::vector<uint64_t> offsets;  // size() + 1 entries, starting at 0
+    std::string blob;
+
+public:
+    explicit PointBatch(int dims);
+    
+    void reserve(size_t points, size_t valueBytes = 0);
+    void add(const double* point, const char* value, size_t valueLength);
+    void add(const std::vector<double>& point, const std::string& value);
+    
+    size_t size() const;
+    bool empty() const;
+    int getDimensions() const;
+    const double* coordinatesOf(size_t i) const;
+    PointView view(size_t i) const;
+    
+    const std::vector<double>& coordinates() const;
+    const std::vector<uint64_t>& valueOffsets() const;
+    const std::string& values() const;
+    
+    bool operator==(const PointBatch& other) const;
+};
+
 #endif // POINT_H
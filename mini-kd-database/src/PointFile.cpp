@@ -0,0 +1,274 @@
+#include "PointFile.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+// Packed file layout; see PointFile.h. The header is a multiple of 8 bytes,
+// so the coordinates stay aligned in the mapping.
+const char POINT_FILE_MAGIC[8] = {'K', 'D', 'P', 'O', 'I', 'N', 'T', 'S'};
+const uint32_t POINT_FILE_VERSION = 1;
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+struct PointFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t dimensions;
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t blobSize;
+};
+
+// m * 10^e and m / 10^e are correctly rounded when m < 2^53 and both
+// factors are exact doubles, which holds up to 10^22
+const double POWERS_OF_TEN[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+const int MAX_EXACT_POWER = 22;
+const uint64_t MAX_EXACT_MANTISSA = uint64_t(1) << 53;
+// Decimal digits that always fit in the uint64_t mantissa
+const int MAX_MANTISSA_DIGITS = 19;
+
+bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+const char* skipSpaces(const char* p, const char* last) {
+    while (p < last && (*p == ' ' || *p == '\t')) ++p;
+    return p;
+}
+
+std::runtime_error csvError(const std::string& path, size_t line, const std::string& message) {
+    return std::runtime_error(path + ":" + std::to_string(line) + ": " + message);
+}
+
+PointBatch readCsv(const MappedFile& file, const std::string& path, int dims) {
+    const char* p = file.getData();
+    const char* end = p + file.getSize();
+    PointBatch points(dims);
+    points.reserve(std::count(p, end, '\n') + 1);
+    
+    std::vector<double> coords(dims);
+    size_t lineNumber = 0;
+    bool headerAllowed = true;
+    while (p < end) {
+        const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        const char* next = lineEnd ? lineEnd + 1 : end;
+        if (!lineEnd) lineEnd = end;
+        if (lineEnd > p && lineEnd[-1] == '\r') --lineEnd;
+        ++lineNumber;
+        
+        const char* c = skipSpaces(p, lineEnd);
+        p = next;
+        if (c == lineEnd || *c == '#') {
+            continue;
+        }
+        
+        const char* after = parseDouble(c, lineEnd, coords[0]);
+        if (!after && headerAllowed) {
+            headerAllowed = false;
+            continue;
+        }
+        headerAllowed = false;
+        for (int d = 0; d < dims; ++d) {
+            if (d > 0) {
+                c = skipSpaces(c, lineEnd);
+                if (c == lineEnd || *c != ',') {
+                    throw csvError(path, lineNumber, "expected " + std::to_string(dims) + " coordinates");
+                }
+                c = skipSpaces(c + 1, lineEnd);
+                after = parseDouble(c, lineEnd, coords[d]);
+            }
+            if (!after) {
+                throw csvError(path, lineNumber, "bad number in coordinate " + std::to_string(d + 1));
+            }
+            if (!std::isfinite(coords[d])) {
+                throw csvError(path, lineNumber, "coordinate " + std::to_string(d + 1) + " is out of range");
+            }
+            c = after;
+        }
+        
+        c = skipSpaces(c, lineEnd);
+        if (c < lineEnd && *c != ',') {
+            throw csvError(path, lineNumber, "expected ',' after the coordinates");
+        }
+        const char* value = c < lineEnd ? c + 1 : lineEnd;
+        points.add(coords.data(), value, lineEnd - value);
+    }
+    return points;
+}
+
+PointBatch readPacked(const MappedFile& file, const std::string& path, int dims) {
+    PointFileHeader header;
+    if (file.getSize() < sizeof(header)) {
+        throw std::runtime_error("Truncated point file: " + path);
+    }
+    std::memcpy(&header, file.getData(), sizeof(header));
+    if (header.byteOrder != BYTE_ORDER_MARK) {
+        throw std::runtime_error("Point file was written with a different byte order: " + path);
+    }
+    if (header.version != POINT_FILE_VERSION) {
+        throw std::runtime_error("Unsupported point file version " + std::to_string(header.version) + ": " + path);
+    }
+    if (header.dimensions != static_cast<uint32_t>(dims)) {
+        throw std::runtime_error("Point file dimensions do not match database dimensions: " + path);
+    }
+    
+    // Size checks come first so the offset arithmetic below cannot overflow
+    uint64_t fileSize = file.getSize();
+    uint64_t coordBytes = header.count * header.dimensions * sizeof(double);
+    if (header.count > fileSize / sizeof(double) / header.dimensions || header.blobSize > fileSize
+        || sizeof(header) + coordBytes + (header.count + 1) * sizeof(uint64_t) + header.blobSize != fileSize) {
+        throw std::runtime_error("Truncated or corrupt point file: " + path);
+    }
+    const char* coords = file.getData() + sizeof(header);
+    const char* offsets = coords + coordBytes;
+    const char* blob = offsets + (header.count + 1) * sizeof(uint64_t);
+    
+    PointBatch points(dims);
+    points.reserve(header.count, header.blobSize);
+    std::vector<double> point(dims);
+    uint64_t start;
+    std::memcpy(&start, offsets, sizeof(start));
+    for (uint64_t i = 0; i < header.count; ++i) {
+        uint64_t stop;
+        std::memcpy(&stop, offsets + (i + 1) * sizeof(uint64_t), sizeof(stop));
+        if (stop < start || stop > header.blobSize) {
+            throw std::runtime_error("Truncated or corrupt point file: " + path);
+        }
+        std::memcpy(point.data(), coords + i * dims * sizeof(double), dims * sizeof(double));
+        points.add(point.data(), blob + start, stop - start);
+        start = stop;
+    }
+    return points;
+}
+}
+
+const char* parseDouble(const char* first, const char* last, double& value) {
+    const char* p = first;
+    bool negative = p < last && *p == '-';
+    if (p < last && (*p == '-' || *p == '+')) ++p;
+    
+    // Collect up to MAX_MANTISSA_DIGITS significant digits; the number is
+    // mantissa * 10^exponent unless later nonzero digits were dropped
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool anyDigits = false;
+    bool truncated = false;
+    for (; p < last && isDigit(*p); ++p) {
+        anyDigits = true;
+        if (digits < MAX_MANTISSA_DIGITS) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa > 0 ? 1 : 0;
+        } else {
+            truncated = truncated || *p != '0';
+            exponent++;
+        }
+    }
+    if (p < last && *p == '.') {
+        for (++p; p < last && isDigit(*p); ++p) {
+            anyDigits = true;
+            if (digits < MAX_MANTISSA_DIGITS) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa > 0 ? 1 : 0;
+                exponent--;
+            } else {
+                truncated = truncated || *p != '0';
+            }
+        }
+    }
+    if (!anyDigits) {
+        return nullptr;
+    }
+    
+    // An 'e' without digits after it is not part of the number
+    if (p < last && (*p == 'e' || *p == 'E')) {
+        const char* e = p + 1;
+        bool negativeExponent = e < last && *e == '-';
+        if (e < last && (*e == '-' || *e == '+')) ++e;
+        if (e < last && isDigit(*e)) {
+            int written = 0;
+            for (; e < last && isDigit(*e); ++e) {
+                if (written < 100000) written = written * 10 + (*e - '0');
+            }
+            exponent += negativeExponent ? -written : written;
+            p = e;
+        }
+    }
+    
+    if (!truncated && mantissa <= MAX_EXACT_MANTISSA && exponent >= -MAX_EXACT_POWER
+        && exponent <= MAX_EXACT_POWER) {
+        double result = static_cast<double>(mantissa);
+        result = exponent < 0 ? result / POWERS_OF_TEN[-exponent] : result * POWERS_OF_TEN[exponent];
+        value = negative ? -result : result;
+        return p;
+    }
+    // Long or extreme numbers: strtod rounds them correctly but needs a
+    // terminated string
+    std::string text(first, p);
+    value = std::strtod(text.c_str(), nullptr);
+    return p;
+}
+
+PointBatch readPointBatch(const std::string& path, int dims) {
+    if (dims <= 0) {
+        throw std::invalid_argument("Dimensions must be positive");
+    }
+    MappedFile file(path);
+    if (file.getSize() >= sizeof(POINT_FILE_MAGIC)
+        && std::memcmp(file.getData(), POINT_FILE_MAGIC, sizeof(POINT_FILE_MAGIC)) == 0) {
+        return readPacked(file, path, dims);
+    }
+    return readCsv(file, path, dims);
+}
+
+std::vector<std::pair<std::vector<double>, std::string>> readPointFile(const std::string& path, int dims) {
+    PointBatch batch = readPointBatch(path, dims);
+    std::vector<std::pair<std::vector<double>, std::string>> points;
+    points.reserve(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+        PointView view = batch.view(i);
+        points.emplace_back(view.copyCoordinates(), view.getValue());
+    }
+    return points;
+}
+
+void writeBinaryPointFile(const std::string& path, const PointBatch& points) {
+    PointFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, POINT_FILE_MAGIC, sizeof(header.magic));
+    header.version = POINT_FILE_VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.dimensions = static_cast<uint32_t>(points.getDimensions());
+    header.count = points.size();
+    header.blobSize = points.values().size();
+    
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(points.coordinates().data()), points.coordinates().size() * sizeof(double));
+    out.write(reinterpret_cast<const char*>(points.valueOffsets().data()),
+              points.valueOffsets().size() * sizeof(uint64_t));
+    out.write(points.values().data(), points.values().size());
+    out.flush();
+    if (!out) {
+        throw std::runtime_error("Cannot write point file: " + path);
+    }
+}
+
+void writeBinaryPointFile(const std::string& path, int dims,
+                          const std::vector<std::pair<std::vector<double>, std::string>>& points) {
+    PointBatch batch(dims);
+    for (const auto& pr : points) {
+        if (pr.first.size() != static_cast<size_t>(dims)) {
+            throw std::invalid_argument("Point dimensions do not match file dimensions");
+        }
+        batch.add(pr.first, pr.second);
+    }
+    writeBinaryPointFile(path, batch);
+}
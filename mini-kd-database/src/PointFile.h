@@ -0,0 +1,43 @@
+#ifndef POINT_FILE_H
+#define POINT_FILE_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include "Point.h"
+
+// Point data files for batch loading (kdtree_app --data).
+//
+// CSV: one point per line, its coordinates and then an optional value,
+// separated by commas: "1.5,2,-3e2,corner cafe". The value runs to the end
+// of the line, commas included. Blank lines, lines starting with '#' and a
+// first line that does not start with a number (a column header) are
+// skipped; "\r\n" line ends are accepted. Coordinates must be finite, so
+// one that overflows (1e400) is an error.
+//
+// Packed binary, all in host byte order:
+//   header (magic "KDPOINTS", version, byte order mark, dimensions, count)
+//   | coordinates (count * dimensions doubles)
+//   | value offsets (count + 1 uint64) | value blob
+//
+// Both are read through a memory mapping and parsed in place. Errors throw
+// std::runtime_error naming the file and, for CSV, the line.
+
+// Reads one number from [first, last) in the manner of C++17 std::from_chars:
+// no leading whitespace, no locale, and no terminating '\0' needed. Returns
+// the end of the number, or nullptr (leaving value alone) if [first, last)
+// does not start with one. Short decimals are converted exactly in place;
+// longer ones fall back to strtod on a copy.
+const char* parseDouble(const char* first, const char* last, double& value);
+
+// Reads a CSV or packed binary file, told apart by the binary magic, into
+// flat buffers; feed the result to Database::bulkLoad as it is
+PointBatch readPointBatch(const std::string& path, int dims);
+// The same points, one pair each
+std::vector<std::pair<std::vector<double>, std::string>> readPointFile(const std::string& path, int dims);
+
+void writeBinaryPointFile(const std::string& path, const PointBatch& points);
+void writeBinaryPointFile(const std::string& path, int dims,
+                          const std::vector<std::pair<std::vector<double>, std::string>>& points);
+
+#endif // POINT_FILE_H
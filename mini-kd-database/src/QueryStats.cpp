@@ -0,0 +1,112 @@
+#include "QueryStats.h"
+#include <cmath>
+
+const int OperationStats::LATENCY_BUCKETS;
+
+double OperationStats::meanMicros() const {
+    return count > 0 ? totalNanos / 1000.0 / count : 0.0;
+}
+
+double OperationStats::percentileMicros(double fraction) const {
+    if (count == 0) {
+        return 0.0;
+    }
+    // Rank of the wanted operation in latency order, counting from 1
+    uint64_t rank = static_cast<uint64_t>(std::ceil(fraction * count));
+    if (rank == 0) rank = 1;
+    if (rank > count) rank = count;
+    
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+        seen += latencyHistogram[i];
+        if (seen >= rank) {
+            return static_cast<double>(uint64_t(1) << (i + 1)) / 1000.0;
+        }
+    }
+    return static_cast<double>(uint64_t(1) << LATENCY_BUCKETS) / 1000.0;
+}
+
+const char* DatabaseStats::operationName(Operation op) {
+    switch (op) {
+        case INSERT: return "insert";
+        case REMOVE: return "remove";
+        case UPDATE: return "update";
+        case BULK_LOAD: return "bulk load";
+        case LOOKUP: return "lookup";
+        case RANGE: return "range";
+        case RADIUS: return "radius";
+        case NEAREST: return "nearest";
+        case K_NEAREST: return "k-nearest";
+        default: return "unknown";
+    }
+}
+
+#ifdef KD_STATS
+
+namespace {
+// Bucket i holds latencies in [2^i, 2^(i+1)) ns
+int latencyBucket(uint64_t nanos) {
+    int bucket = 0;
+    while (nanos > 1 && bucket < OperationStats::LATENCY_BUCKETS - 1) {
+        nanos >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+}
+
+StatsRecorder::StatsRecorder() {
+    reset();
+}
+
+// Relaxed atomics: each counter is exact, but a snapshot taken while
+// operations finish may see some of their counters and not others
+void StatsRecorder::record(DatabaseStats::Operation op, uint64_t nanos, const QueryStats& work) {
+    Counters& c = counters[op];
+    c.count.fetch_add(1, std::memory_order_relaxed);
+    c.totalNanos.fetch_add(nanos, std::memory_order_relaxed);
+    c.latencyHistogram[latencyBucket(nanos)].fetch_add(1, std::memory_order_relaxed);
+    c.nodesVisited.fetch_add(work.nodesVisited, std::memory_order_relaxed);
+    c.distanceEvaluations.fetch_add(work.distanceEvaluations, std::memory_order_relaxed);
+    c.subtreesPruned.fetch_add(work.subtreesPruned, std::memory_order_relaxed);
+    
+    uint32_t deepest = c.maxDepth.load(std::memory_order_relaxed);
+    while (work.maxDepth > deepest
+           && !c.maxDepth.compare_exchange_weak(deepest, work.maxDepth, std::memory_order_relaxed)) {
+    }
+}
+
+DatabaseStats StatsRecorder::snapshot() const {
+    DatabaseStats stats;
+    stats.enabled = true;
+    for (int op = 0; op < DatabaseStats::OPERATION_COUNT; ++op) {
+        const Counters& c = counters[op];
+        OperationStats& out = stats.operations[op];
+        out.count = c.count.load(std::memory_order_relaxed);
+        out.totalNanos = c.totalNanos.load(std::memory_order_relaxed);
+        for (int i = 0; i < OperationStats::LATENCY_BUCKETS; ++i) {
+            out.latencyHistogram[i] = c.latencyHistogram[i].load(std::memory_order_relaxed);
+        }
+        out.work.nodesVisited = c.nodesVisited.load(std::memory_order_relaxed);
+        out.work.distanceEvaluations = c.distanceEvaluations.load(std::memory_order_relaxed);
+        out.work.subtreesPruned = c.subtreesPruned.load(std::memory_order_relaxed);
+        out.work.maxDepth = c.maxDepth.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+void StatsRecorder::reset() {
+    for (Counters& c : counters) {
+        c.count.store(0, std::memory_order_relaxed);
+        c.totalNanos.store(0, std::memory_order_relaxed);
+        for (auto& bucket : c.latencyHistogram) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        c.nodesVisited.store(0, std::memory_order_relaxed);
+        c.distanceEvaluations.store(0, std::memory_order_relaxed);
+        c.subtreesPruned.store(0, std::memory_order_relaxed);
+        c.maxDepth.store(0, std::memory_order_relaxed);
+    }
+}
+
+#endif // KD_STATS
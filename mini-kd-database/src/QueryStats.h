@@ -0,0 +1,168 @@
+#ifndef QUERY_STATS_H
+#define QUERY_STATS_H
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <chrono>
+
+// Query instrumentation, compiled in only with -DKD_STATS (make STATS=1).
+// Without it the counting hooks below expand to nothing, so KDTree searches
+// and Database operations carry no extra work, and Database::stats()
+// reports enabled = false with every count at zero.
+
+// Work done by KDTree searches. nodesVisited counts the nodes a search
+// entered, distanceEvaluations the stored points it measured against the
+// target (or tested against the box, for range queries), subtreesPruned
+// the subtrees it skipped because their bounding box ruled them out.
+struct QueryStats {
+    uint64_t nodesVisited = 0;
+    uint64_t distanceEvaluations = 0;
+    uint64_t subtreesPruned = 0;
+    uint32_t maxDepth = 0;  // deepest recursion reached, the root being 1
+    
+    void reset() { *this = QueryStats(); }
+    void add(const QueryStats& other) {
+        nodesVisited += other.nodesVisited;
+        distanceEvaluations += other.distanceEvaluations;
+        subtreesPruned += other.subtreesPruned;
+        if (other.maxDepth > maxDepth) maxDepth = other.maxDepth;
+    }
+};
+
+// Totals of the searches run on the calling thread. Reset it before a
+// query and read it afterwards to get the work of that one query.
+inline QueryStats& threadQueryStats() {
+    static thread_local QueryStats stats;
+    return stats;
+}
+
+// Cumulative statistics of one kind of Database operation
+struct OperationStats {
+    static const int LATENCY_BUCKETS = 32;
+    
+    uint64_t count = 0;
+    uint64_t totalNanos = 0;
+    // latencyHistogram[i] counts operations that took [2^i, 2^(i+1)) ns;
+    // the last bucket also holds everything slower
+    uint64_t latencyHistogram[LATENCY_BUCKETS] = {};
+    // Search work summed over all operations; maxDepth is the largest seen.
+    // Queries served from a mapped snapshot add latency only.
+    QueryStats work;
+    
+    double meanMicros() const;
+    // Upper bound of the histogram bucket holding the given fraction of
+    // operations, e.g. 0.99 for the 99th percentile
+    double percentileMicros(double fraction) const;
+};
+
+struct DatabaseStats {
+    // Lookups are search, getPointValue and contains; batch queries count
+    // once per query in the batch
+    enum Operation {
+        INSERT,
+        REMOVE,
+        UPDATE,
+        BULK_LOAD,
+        LOOKUP,
+        RANGE,
+        RADIUS,
+        NEAREST,
+        K_NEAREST,
+        OPERATION_COUNT
+    };
+    
+    bool enabled = false;
+    OperationStats operations[OPERATION_COUNT];
+    
+    const OperationStats& operator[](Operation op) const { return operations[op]; }
+    static const char* operationName(Operation op);
+};
+
+#ifdef KD_STATS
+
+// Thread-safe accumulator behind Database::stats()
+class StatsRecorder {
+private:
+    struct Counters {
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> totalNanos;
+        std::atomic<uint64_t> latencyHistogram[OperationStats::LATENCY_BUCKETS];
+        std::atomic<uint64_t> nodesVisited;
+        std::atomic<uint64_t> distanceEvaluations;
+        std::atomic<uint64_t> subtreesPruned;
+        std::atomic<uint32_t> maxDepth;
+    };
+    Counters counters[DatabaseStats::OPERATION_COUNT];
+
+public:
+    StatsRecorder();
+    
+    StatsRecorder(const StatsRecorder&) = delete;
+    StatsRecorder& operator=(const StatsRecorder&) = delete;
+    
+    void record(DatabaseStats::Operation op, uint64_t nanos, const QueryStats& work);
+    DatabaseStats snapshot() const;
+    void reset();
+};
+
+// Times one Database operation and records it with the search work done on
+// this thread meanwhile. Operations may nest; the outer one's work
+// includes the inner one's.
+class OperationTimer {
+private:
+    StatsRecorder& recorder;
+    DatabaseStats::Operation op;
+    QueryStats outer;
+    std::chrono::steady_clock::time_point start;
+
+public:
+    OperationTimer(StatsRecorder& recorder, DatabaseStats::Operation op)
+        : recorder(recorder), op(op), outer(threadQueryStats()), start(std::chrono::steady_clock::now()) {
+        threadQueryStats().reset();
+    }
+    ~OperationTimer() {
+        auto nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        QueryStats& work = threadQueryStats();
+        recorder.record(op, static_cast<uint64_t>(nanos.count()), work);
+        outer.add(work);
+        work = outer;
+    }
+    
+    OperationTimer(const OperationTimer&) = delete;
+    OperationTimer& operator=(const OperationTimer&) = delete;
+};
+
+// Marks a search entering one node, for as long as it stays in the node's subtree
+class NodeVisit {
+private:
+    static uint32_t& depth() {
+        static thread_local uint32_t current = 0;
+        return current;
+    }
+
+public:
+    NodeVisit() {
+        QueryStats& stats = threadQueryStats();
+        stats.nodesVisited++;
+        if (++depth() > stats.maxDepth) stats.maxDepth = depth();
+    }
+    ~NodeVisit() { depth()--; }
+    
+    NodeVisit(const NodeVisit&) = delete;
+    NodeVisit& operator=(const NodeVisit&) = delete;
+};
+
+#define KD_STATS_ADD(counter, n) (threadQueryStats().counter += (n))
+#define KD_STATS_VISIT() NodeVisit kdStatsVisit
+#define KD_STATS_TIME(recorder, op) OperationTimer kdStatsTimer((recorder), (op))
+
+#else
+
+#define KD_STATS_ADD(counter, n) ((void)0)
+#define KD_STATS_VISIT() ((void)0)
+#define KD_STATS_TIME(recorder, op) ((void)0)
+
+#endif // KD_STATS
+
+#endif // QUERY_STATS_H
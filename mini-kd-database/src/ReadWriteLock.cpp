@@ -0,0 +1,64 @@
+#include "ReadWriteLock.h"
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+namespace {
+// Shared locks the calling thread holds, one entry per acquisition
+std::vector<const ReadWriteLock*>& heldShared() {
+    static thread_local std::vector<const ReadWriteLock*> held;
+    return held;
+}
+
+bool holdsShared(const ReadWriteLock* lock) {
+    const std::vector<const ReadWriteLock*>& held = heldShared();
+    return std::find(held.begin(), held.end(), lock) != held.end();
+}
+}
+
+ReadWriteLock::ReadWriteLock() : waitingWriters(0) {}
+
+// The gate is held while waiting for readers to drain, which holds back
+// new readers and queues the other writers
+void ReadWriteLock::lock() {
+    waitingWriters.fetch_add(1);
+    std::lock_guard<std::mutex> gate(writerGate);
+    rw.lock();
+    waitingWriters.fetch_sub(1);
+}
+
+bool ReadWriteLock::try_lock() {
+    return rw.try_lock();
+}
+
+void ReadWriteLock::unlock() {
+    rw.unlock();
+}
+
+void ReadWriteLock::lock_shared() {
+    if (!holdsShared(this)) {
+        while (waitingWriters.load() > 0) {
+            // Wait for the writer to get the lock, then queue for a shared one behind it
+            std::lock_guard<std::mutex> gate(writerGate);
+        }
+    }
+    rw.lock_shared();
+    heldShared().push_back(this);
+}
+
+bool ReadWriteLock::try_lock_shared() {
+    if ((waitingWriters.load() > 0 && !holdsShared(this)) || !rw.try_lock_shared()) {
+        return false;
+    }
+    heldShared().push_back(this);
+    return true;
+}
+
+void ReadWriteLock::unlock_shared() {
+    std::vector<const ReadWriteLock*>& held = heldShared();
+    auto last = std::find(held.rbegin(), held.rend(), this);
+    if (last != held.rend()) {
+        held.erase(std::next(last).base());
+    }
+    rw.unlock_shared();
+}
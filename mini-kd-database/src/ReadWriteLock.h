@@ -0,0 +1,45 @@
+#ifndef READ_WRITE_LOCK_H
+#define READ_WRITE_LOCK_H
+
+#include <shared_mutex>
+#include <mutex>
+#include <atomic>
+
+// Reader-writer lock that lets a waiting writer in ahead of new readers.
+//
+// std::shared_timed_mutex is reader-preferring on glibc, so a steady stream
+// of overlapping queries could keep a writer out indefinitely. Here a
+// writer announces itself before waiting; readers that see the
+// announcement queue behind it instead of joining the current readers.
+// Readers only read the counter when no writer is waiting, so they do not
+// contend with each other. Meets the SharedMutex requirements, so it works
+// with std::unique_lock and std::shared_lock.
+//
+// A thread may take the shared lock again while it holds it, e.g. to read
+// from a Database inside a streaming visitor. The nested acquisition skips
+// the writer queue, since queueing behind a writer that waits for this
+// thread's first lock would never end; it relies on the underlying mutex
+// granting shared locks while a writer waits, as glibc's does. Locking
+// exclusively while holding the shared lock still deadlocks.
+class ReadWriteLock {
+private:
+    std::shared_timed_mutex rw;
+    std::mutex writerGate;
+    std::atomic<int> waitingWriters;
+
+public:
+    ReadWriteLock();
+
+    ReadWriteLock(const ReadWriteLock&) = delete;
+    ReadWriteLock& operator=(const ReadWriteLock&) = delete;
+
+    void lock();
+    bool try_lock();
+    void unlock();
+
+    void lock_shared();
+    bool try_lock_shared();
+    void unlock_shared();
+};
+
+#endif // READ_WRITE_LOCK_H
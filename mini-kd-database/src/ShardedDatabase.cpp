@@ -0,0 +1,426 @@
+#include "ShardedDatabase.h"
+#include "DistanceKernels.h"
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <iterator>
+#include <atomic>
+
+namespace {
+// Planning looks at no more points than this; medians of a strided sample
+// are close enough for balancing shards
+const size_t MAX_SAMPLE = 65536;
+
+const double INF = std::numeric_limits<double>::infinity();
+
+// A plan with fewer cells than shards (made without a sample, or from a
+// tiny one) is remade from the stored points once inserts and merges have
+// added this many points per shard
+const size_t POINTS_PER_SHARD_TO_PLAN = 256;
+}
+
+ShardedDatabase::ShardedDatabase(int dims, int shardCount, const std::vector<std::vector<double>>& sample)
+    : dimensions(dims), unplannedPoints(0) {
+    if (dims <= 0) {
+        throw std::invalid_argument("Dimensions must be positive");
+    }
+    if (shardCount <= 0) {
+        throw std::invalid_argument("Shard count must be positive");
+    }
+    for (const auto& p : sample) {
+        if (p.size() != static_cast<size_t>(dims)) {
+            throw std::invalid_argument("Point dimensions do not match database dimensions");
+        }
+    }
+    
+    for (int i = 0; i < shardCount; ++i) {
+        shards.emplace_back(new Database(dims));
+    }
+    plan(sample);
+}
+
+// Cuts space into at most one cell per shard, never more cells than sample points
+void ShardedDatabase::plan(std::vector<std::vector<double>> sample) {
+    if (sample.size() > MAX_SAMPLE) {
+        size_t stride = sample.size() / MAX_SAMPLE;
+        for (size_t i = 0; i < MAX_SAMPLE; ++i) {
+            sample[i].swap(sample[i * stride]);
+        }
+        sample.resize(MAX_SAMPLE);
+    }
+    
+    int active = static_cast<int>(std::min(shards.size(), std::max<size_t>(sample.size(), 1)));
+    unplannedPoints = 0;
+    splits.clear();
+    cells.assign(active, Cell());
+    Cell whole{std::vector<double>(dimensions, -INF), std::vector<double>(dimensions, INF)};
+    planCell(sample, 0, sample.size(), 0, active, 0, whole);
+}
+
+// Gives shards [shardBegin, shardEnd) the sample points [left, right),
+// splitting both in proportion at the median of the depth's dimension.
+// Each side keeps at least as many points as shards, so no cell is empty.
+int ShardedDatabase::planCell(std::vector<std::vector<double>>& sample, size_t left, size_t right,
+                              int shardBegin, int shardEnd, int depth, Cell cell) {
+    int shardCount = shardEnd - shardBegin;
+    if (shardCount == 1) {
+        cells[shardBegin] = std::move(cell);
+        return ~shardBegin;
+    }
+    
+    int dim = depth % dimensions;
+    int leftShards = shardCount / 2;
+    size_t pos = left + (right - left) * leftShards / shardCount;
+    std::nth_element(sample.begin() + left, sample.begin() + pos, sample.begin() + right,
+        [dim](const std::vector<double>& a, const std::vector<double>& b) { return a[dim] < b[dim]; });
+    double value = sample[pos][dim];
+    
+    int index = static_cast<int>(splits.size());
+    splits.push_back(Split{dim, value, 0, 0});
+    Cell leftCell = cell;
+    leftCell.hi[dim] = value;
+    cell.lo[dim] = value;
+    int leftChild = planCell(sample, left, pos, shardBegin, shardBegin + leftShards, depth + 1, std::move(leftCell));
+    int rightChild = planCell(sample, pos, right, shardBegin + leftShards, shardEnd, depth + 1, std::move(cell));
+    splits[index].left = leftChild;
+    splits[index].right = rightChild;
+    return index;
+}
+
+int ShardedDatabase::shardFor(const std::vector<double>& coordinates) const {
+    int node = splits.empty() ? ~0 : 0;
+    while (node >= 0) {
+        const Split& split = splits[node];
+        node = coordinates[split.dimension] < split.value ? split.left : split.right;
+    }
+    return ~node;
+}
+
+std::vector<int> ShardedDatabase::shardsOverlapping(const std::vector<double>& min,
+                                                     const std::vector<double>& max) const {
+    if (min.size() != static_cast<size_t>(dimensions) || max.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Range dimensions do not match database dimensions");
+    }
+    
+    std::vector<int> result;
+    for (size_t i = 0; i < cells.size(); ++i) {
+        bool overlaps = true;
+        for (int d = 0; d < dimensions && overlaps; ++d) {
+            overlaps = cells[i].lo[d] <= max[d] && min[d] < cells[i].hi[d];
+        }
+        if (overlaps) {
+            result.push_back(static_cast<int>(i));
+        }
+    }
+    return result;
+}
+
+// Squared distance from target to the nearest point of the shard's cell
+double ShardedDatabase::cellDistance(int shard, const std::vector<double>& target) const {
+    const Cell& cell = cells[shard];
+    double sum = 0.0;
+    for (int d = 0; d < dimensions; ++d) {
+        double gap = target[d] < cell.lo[d] ? cell.lo[d] - target[d]
+                   : (target[d] > cell.hi[d] ? target[d] - cell.hi[d] : 0.0);
+        sum += gap * gap;
+    }
+    return sum;
+}
+
+// Replaces every shard's contents with its part of `points`, one shard per thread
+void ShardedDatabase::reload(const std::vector<std::pair<std::vector<double>, std::string>>& points) {
+    std::vector<std::vector<std::pair<std::vector<double>, std::string>>> parts(shards.size());
+    for (const auto& pr : points) {
+        parts[shardFor(pr.first)].push_back(pr);
+    }
+    threadPool().parallelFor(shards.size(), [&](size_t i) {
+        shards[i]->bulkLoad(parts[i], true);
+    }, 0, 1);
+}
+
+ThreadPool& ShardedDatabase::threadPool() const {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (!pool) {
+        int cores = static_cast<int>(std::thread::hardware_concurrency());
+        pool.reset(new ThreadPool(std::max(cores - 1, 1)));
+    }
+    return *pool;
+}
+
+void ShardedDatabase::insert(const std::vector<double>& coordinates, const std::string& value) {
+    if (coordinates.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Point dimensions do not match database dimensions");
+    }
+    bool replan;
+    {
+        ReadGuard lock(planLock);
+        shards[shardFor(coordinates)]->insert(coordinates, value);
+        replan = countUnplanned(1);
+    }
+    if (replan) {
+        planFromStored();
+    }
+}
+
+// Adds points that arrived under a plan with fewer cells than shards; true
+// once there are enough of them to plan every shard. Needs the plan lock.
+bool ShardedDatabase::countUnplanned(size_t points) {
+    if (cells.size() == shards.size()) {
+        return false;
+    }
+    size_t before = unplannedPoints.fetch_add(points);
+    size_t needed = POINTS_PER_SHARD_TO_PLAN * shards.size();
+    return before < needed && before + points >= needed;
+}
+
+void ShardedDatabase::planFromStored() {
+    WriteGuard lock(planLock);
+    if (cells.size() < shards.size()) {
+        redistribute();
+    }
+}
+
+bool ShardedDatabase::remove(const std::vector<double>& coordinates) {
+    if (coordinates.size() != static_cast<size_t>(dimensions)) {
+        return false;
+    }
+    ReadGuard lock(planLock);
+    return shards[shardFor(coordinates)]->remove(coordinates);
+}
+
+std::string ShardedDatabase::search(const std::vector<double>& coordinates) const {
+    if (coordinates.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Point dimensions do not match database dimensions");
+    }
+    return getPointValue(coordinates);
+}
+
+bool ShardedDatabase::update(const std::vector<double>& oldCoords, const std::string& newValue) {
+    if (oldCoords.size() != static_cast<size_t>(dimensions)) {
+        return false;
+    }
+    ReadGuard lock(planLock);
+    return shards[shardFor(oldCoords)]->update(oldCoords, newValue);
+}
+
+bool ShardedDatabase::update(const std::vector<double>& oldCoords, const std::vector<double>& newCoords,
+                             const std::string& newValue) {
+    if (oldCoords.size() != static_cast<size_t>(dimensions) || newCoords.size() != static_cast<size_t>(dimensions)) {
+        return false;
+    }
+    ReadGuard lock(planLock);
+    int from = shardFor(oldCoords);
+    int to = shardFor(newCoords);
+    if (from == to) {
+        return shards[from]->update(oldCoords, newCoords, newValue);
+    }
+    if (!shards[from]->remove(oldCoords)) {
+        return false;
+    }
+    shards[to]->insert(newCoords, newValue);
+    return true;
+}
+
+void ShardedDatabase::bulkLoad(const std::vector<std::pair<std::vector<double>, std::string>>& points,
+                               bool replace) {
+    for (const auto& pr : points) {
+        if (pr.first.size() != static_cast<size_t>(dimensions)) {
+            throw std::invalid_argument("Point dimensions do not match database dimensions");
+        }
+    }
+    
+    if (replace) {
+        WriteGuard lock(planLock);
+        std::vector<std::vector<double>> sample;
+        size_t stride = std::max<size_t>(points.size() / MAX_SAMPLE, 1);
+        for (size_t i = 0; i < points.size(); i += stride) {
+            sample.push_back(points[i].first);
+        }
+        plan(std::move(sample));
+        reload(points);
+        return;
+    }
+    
+    bool replan;
+    {
+        ReadGuard lock(planLock);
+        std::vector<std::vector<std::pair<std::vector<double>, std::string>>> parts(shards.size());
+        for (const auto& pr : points) {
+            parts[shardFor(pr.first)].push_back(pr);
+        }
+        threadPool().parallelFor(shards.size(), [&](size_t i) {
+            if (!parts[i].empty()) {
+                shards[i]->bulkLoad(parts[i], false);
+            }
+        }, 0, 1);
+        replan = countUnplanned(points.size());
+    }
+    if (replan) {
+        planFromStored();
+    }
+}
+
+void ShardedDatabase::repartition() {
+    WriteGuard lock(planLock);
+    redistribute();
+}
+
+// Plans new cells from the stored points and reloads the shards; needs the
+// exclusive plan lock
+void ShardedDatabase::redistribute() {
+    std::vector<double> everywhereMin(dimensions, -INF), everywhereMax(dimensions, INF);
+    std::vector<std::pair<std::vector<double>, std::string>> points;
+    std::vector<std::vector<double>> sample;
+    for (const auto& shard : shards) {
+        shard->forEachInRange(everywhereMin, everywhereMax, [&](const PointView& p) {
+            points.emplace_back(p.copyCoordinates(), p.getValue());
+            return true;
+        });
+    }
+    size_t stride = std::max<size_t>(points.size() / MAX_SAMPLE, 1);
+    for (size_t i = 0; i < points.size(); i += stride) {
+        sample.push_back(points[i].first);
+    }
+    plan(std::move(sample));
+    reload(points);
+}
+
+std::vector<std::pair<std::vector<double>, std::string>> ShardedDatabase::rangeQuery(
+    const std::vector<double>& min, const std::vector<double>& max) const {
+    
+    ReadGuard lock(planLock);
+    std::vector<int> overlapping = shardsOverlapping(min, max);
+    std::vector<std::vector<std::pair<std::vector<double>, std::string>>> parts(overlapping.size());
+    threadPool().parallelFor(overlapping.size(), [&](size_t i) {
+        parts[i] = shards[overlapping[i]]->rangeQuery(min, max);
+    }, 0, 1);
+    
+    std::vector<std::pair<std::vector<double>, std::string>> results;
+    for (auto& part : parts) {
+        std::move(part.begin(), part.end(), std::back_inserter(results));
+    }
+    return results;
+}
+
+std::pair<std::vector<double>, std::string> ShardedDatabase::nearestNeighbor(
+    const std::vector<double>& target) const {
+    
+    std::vector<std::pair<std::vector<double>, std::string>> nearest = kNearestNeighbors(target, 1);
+    if (nearest.empty()) {
+        throw std::runtime_error("Tree is empty");
+    }
+    return nearest.front();
+}
+
+// Shards are searched in parallel, nearest cell first. The k-th distance
+// found so far, over every shard, is shared through an atomic: each search
+// starts bounded by it, and a shard whose cell is no closer is skipped.
+std::vector<std::pair<std::vector<double>, std::string>> ShardedDatabase::kNearestNeighbors(
+    const std::vector<double>& target, int k) const {
+    
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match database dimensions");
+    }
+    if (k <= 0) {
+        return {};
+    }
+    
+    ReadGuard lock(planLock);
+    std::vector<std::pair<double, int>> order;
+    for (size_t i = 0; i < cells.size(); ++i) {
+        order.emplace_back(cellDistance(static_cast<int>(i), target), static_cast<int>(i));
+    }
+    std::sort(order.begin(), order.end());
+    
+    // Best k so far, ascending by squared distance. Until there are k,
+    // every shard is searched: targets whose distances are inf or NaN must
+    // still get their k results. The bound is stored before `full` is set.
+    std::vector<std::pair<double, std::pair<std::vector<double>, std::string>>> best;
+    std::mutex merging;
+    std::atomic<bool> full(false);
+    std::atomic<double> bound(INF);
+    threadPool().parallelFor(order.size(), [&](size_t i) {
+        bool bounded = full.load();
+        double limit = bounded ? bound.load() : INF;
+        if (bounded && !(order[i].first < limit)) {
+            return;
+        }
+        std::vector<std::pair<std::vector<double>, std::string>> found =
+            shards[order[i].second]->kNearestNeighbors(target, k, limit);
+        
+        std::lock_guard<std::mutex> guard(merging);
+        for (auto& p : found) {
+            double distSq = squaredDistance(p.first.data(), target.data(), dimensions);
+            auto pos = std::upper_bound(best.begin(), best.end(), distSq,
+                [](double d, const std::pair<double, std::pair<std::vector<double>, std::string>>& e) {
+                    return d < e.first;
+                });
+            best.insert(pos, std::make_pair(distSq, std::move(p)));
+            if (best.size() > static_cast<size_t>(k)) {
+                best.pop_back();
+            }
+        }
+        if (best.size() == static_cast<size_t>(k)) {
+            bound.store(best.back().first);
+            full.store(true);
+        }
+    }, 0, 1);
+    
+    std::vector<std::pair<std::vector<double>, std::string>> results;
+    for (auto& entry : best) {
+        results.push_back(std::move(entry.second));
+    }
+    return results;
+}
+
+std::string ShardedDatabase::getPointValue(const std::vector<double>& coordinates) const {
+    if (coordinates.size() != static_cast<size_t>(dimensions)) {
+        return "";
+    }
+    ReadGuard lock(planLock);
+    return shards[shardFor(coordinates)]->getPointValue(coordinates);
+}
+
+bool ShardedDatabase::contains(const std::vector<double>& coordinates) const {
+    if (coordinates.size() != static_cast<size_t>(dimensions)) {
+        return false;
+    }
+    ReadGuard lock(planLock);
+    return shards[shardFor(coordinates)]->contains(coordinates);
+}
+
+bool ShardedDatabase::isEmpty() const {
+    return getSize() == 0;
+}
+
+int ShardedDatabase::getSize() const {
+    int total = 0;
+    for (const auto& shard : shards) {
+        total += shard->getSize();
+    }
+    return total;
+}
+
+int ShardedDatabase::getDimensions() const {
+    return dimensions;
+}
+
+int ShardedDatabase::getShardCount() const {
+    return static_cast<int>(shards.size());
+}
+
+std::vector<int> ShardedDatabase::getShardSizes() const {
+    std::vector<int> sizes;
+    for (const auto& shard : shards) {
+        sizes.push_back(shard->getSize());
+    }
+    return sizes;
+}
+
+void ShardedDatabase::clear() {
+    ReadGuard lock(planLock);
+    for (const auto& shard : shards) {
+        shard->clear();
+    }
+}
@@ -0,0 +1,132 @@
+#ifndef SHARDED_DATABASE_H
+#define SHARDED_DATABASE_H
+
+#include "Database.h"
+#include "ThreadPool.h"
+#include "ReadWriteLock.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <utility>
+
+// Splits space into cells, one Database ("shard") per cell, so writes to
+// different cells run in parallel and each shard's tree stays small.
+//
+// The cells come from a few top-level K-D splits at the medians of a
+// sample of the data. A point always lives in the one shard whose cell
+// contains it; range queries visit only the shards whose cells overlap the
+// range, and kNN searches shards in parallel, nearest cell first, skipping
+// every cell farther away than the k-th best point found so far.
+//
+// Thread safety: every method may be called from any number of threads.
+// Each shard has its own lock. A move between two shards (update with new
+// coordinates) is a remove followed by an insert, and queries spanning
+// several shards read each shard at a slightly different moment.
+class ShardedDatabase {
+private:
+    typedef std::shared_lock<ReadWriteLock> ReadGuard;
+    typedef std::unique_lock<ReadWriteLock> WriteGuard;
+    
+    // Inner nodes of the split tree; a negative child c stands for shard ~c
+    struct Split {
+        int dimension;
+        double value;
+        int left;
+        int right;
+    };
+    
+    // Cell of a shard: lo <= x < hi in every dimension
+    struct Cell {
+        std::vector<double> lo;
+        std::vector<double> hi;
+    };
+    
+    int dimensions;
+    std::vector<std::unique_ptr<Database>> shards;
+    
+    // The plan is replaced only by repartitioning, under the exclusive lock
+    mutable ReadWriteLock planLock;
+    std::vector<Split> splits;
+    std::vector<Cell> cells;
+    
+    void plan(std::vector<std::vector<double>> sample);
+    int planCell(std::vector<std::vector<double>>& sample, size_t left, size_t right, int shardBegin,
+                 int shardEnd, int depth, Cell cell);
+    int shardFor(const std::vector<double>& coordinates) const;
+    std::vector<int> shardsOverlapping(const std::vector<double>& min, const std::vector<double>& max) const;
+    double cellDistance(int shard, const std::vector<double>& target) const;
+    void reload(const std::vector<std::pair<std::vector<double>, std::string>>& points);
+    void redistribute();
+    
+    // Points added since a plan with fewer cells than shards
+    std::atomic<size_t> unplannedPoints;
+    bool countUnplanned(size_t points);
+    void planFromStored();
+    
+    mutable std::unique_ptr<ThreadPool> pool;
+    mutable std::mutex poolMutex;
+    ThreadPool& threadPool() const;
+
+public:
+    // Plans the cells from `sample`. Without a sample there is one cell until
+    // the first bulkLoad() or repartition(), or until inserts and merges
+    // have added 256 points per shard: the cells are then planned from the
+    // stored points. A sample smaller than the shard count is topped up the
+    // same way.
+    ShardedDatabase(int dims, int shardCount,
+                    const std::vector<std::vector<double>>& sample = std::vector<std::vector<double>>());
+    
+    // CRUD Operations, as in Database
+    void insert(const std::vector<double>& coordinates, const std::string& value);
+    bool remove(const std::vector<double>& coordinates);
+    std::string search(const std::vector<double>& coordinates) const;
+    bool update(const std::vector<double>& oldCoords, const std::string& newValue);
+    bool update(const std::vector<double>& oldCoords, const std::vector<double>& newCoords, const std::string& newValue);
+    
+    // A replacing load plans new cells from the batch; a merging one keeps
+    // the cells. Either way each shard loads its part on its own thread.
+    void bulkLoad(const std::vector<std::pair<std::vector<double>, std::string>>& points,
+                  bool replace = true);
+    // Plans new cells from the stored points and redistributes them
+    void repartition();
+    
+    // Query Operations
+    // rangeQuery scans the overlapping shards in parallel
+    std::vector<std::pair<std::vector<double>, std::string>> rangeQuery(
+        const std::vector<double>& min, const std::vector<double>& max) const;
+    std::pair<std::vector<double>, std::string> nearestNeighbor(
+        const std::vector<double>& target) const;
+    // Searches the shards in parallel, bounded by a k-th distance they share
+    std::vector<std::pair<std::vector<double>, std::string>> kNearestNeighbors(
+        const std::vector<double>& target, int k) const;
+    
+    // Visits the overlapping shards one after another; see Database::forEachInRange
+    template <typename Visitor>
+    bool forEachInRange(const std::vector<double>& min, const std::vector<double>& max,
+                        Visitor&& visit) const {
+        ReadGuard lock(planLock);
+        for (int shard : shardsOverlapping(min, max)) {
+            if (!shards[shard]->forEachInRange(min, max, visit)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    std::string getPointValue(const std::vector<double>& coordinates) const;
+    bool contains(const std::vector<double>& coordinates) const;
+    
+    // Utility
+    bool isEmpty() const;
+    int getSize() const;
+    int getDimensions() const;
+    int getShardCount() const;
+    // Points stored in each shard, in shard order
+    std::vector<int> getShardSizes() const;
+    void clear();
+};
+
+#endif // SHARDED_DATABASE_H
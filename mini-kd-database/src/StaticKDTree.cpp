@@ -0,0 +1,588 @@
+#include "StaticKDTree.h"
+#include "DistanceKernels.h"
+#include <cmath>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <future>
+#include <thread>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+// Same cut-off as KDTree::build: smaller ranges are laid out on the calling thread
+const size_t PARALLEL_BUILD_THRESHOLD = 1 << 14;
+
+// Snapshot file layout, all in host byte order:
+//   SnapshotHeader | coordinates (count * dimensions doubles)
+//   | value offsets (count + 1 uint64) | value blob
+// The header is a multiple of 8 bytes, so both arrays stay aligned in the mapping.
+const char SNAPSHOT_MAGIC[8] = {'K', 'D', 'S', 'N', 'A', 'P', '\0', '\0'};
+const uint32_t SNAPSHOT_VERSION = 1;
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t dimensions;
+    uint32_t leafSize;
+    uint64_t count;
+    uint64_t blobSize;
+};
+
+uint64_t coordsOffset() {
+    return sizeof(SnapshotHeader);
+}
+
+uint64_t offsetsOffset(const SnapshotHeader& header) {
+    return coordsOffset() + header.count * header.dimensions * sizeof(double);
+}
+
+uint64_t blobOffset(const SnapshotHeader& header) {
+    return offsetsOffset(header) + (header.count + 1) * sizeof(uint64_t);
+}
+
+// fsync()s a file or directory by name; false if it cannot be opened or synced
+bool syncPath(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    return synced;
+}
+
+std::string parentDirectory(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    if (slash == std::string::npos) {
+        return ".";
+    }
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+std::vector<PointView> viewsOf(const KDTree& tree) {
+    std::vector<PointView> points;
+    points.reserve(tree.size());
+    tree.forEachPoint([&points](const PointView& p) {
+        points.push_back(p);
+        return true;
+    });
+    return points;
+}
+}
+
+const size_t StaticKDTree::LEAF_SIZE;
+
+StaticKDTree::StaticKDTree()
+    : dimensions(0), count(0), coordData(nullptr), offsetData(nullptr), blobData(nullptr) {}
+
+StaticKDTree::StaticKDTree(int dims, const std::vector<Point>& points)
+    : dimensions(dims), count(points.size()) {
+    if (dims <= 0) {
+        throw std::invalid_argument("Dimensions must be positive");
+    }
+    
+    // Gather coordinates once so the build partitions 4-byte indices, not Points
+    std::vector<double> scratch;
+    scratch.reserve(count * dimensions);
+    for (const Point& p : points) {
+        if (p.getDimensions() != dimensions) {
+            throw std::invalid_argument("Point dimensions do not match tree dimensions");
+        }
+        scratch.insert(scratch.end(), p.getCoordinates().begin(), p.getCoordinates().end());
+    }
+    
+    std::vector<uint32_t> order = layOut(scratch);
+    for (size_t i = 0; i < count; ++i) {
+        const std::string& value = points[order[i]].getValue();
+        valueBlob.insert(valueBlob.end(), value.begin(), value.end());
+        valueOffsets.push_back(valueBlob.size());
+    }
+    offsetData = valueOffsets.data();
+    blobData = valueBlob.data();
+}
+
+StaticKDTree::StaticKDTree(int dims, const std::vector<PointView>& points)
+    : dimensions(dims), count(points.size()) {
+    if (dims <= 0) {
+        throw std::invalid_argument("Dimensions must be positive");
+    }
+    
+    std::vector<double> scratch;
+    scratch.reserve(count * dimensions);
+    for (const PointView& p : points) {
+        if (p.getDimensions() != dimensions) {
+            throw std::invalid_argument("Point dimensions do not match tree dimensions");
+        }
+        scratch.insert(scratch.end(), p.getCoordinates(), p.getCoordinates() + dimensions);
+    }
+    
+    std::vector<uint32_t> order = layOut(scratch);
+    for (size_t i = 0; i < count; ++i) {
+        const PointView& p = points[order[i]];
+        valueBlob.insert(valueBlob.end(), p.getValueData(), p.getValueData() + p.getValueLength());
+        valueOffsets.push_back(valueBlob.size());
+    }
+    offsetData = valueOffsets.data();
+    blobData = valueBlob.data();
+}
+
+StaticKDTree::StaticKDTree(const KDTree& tree)
+    : StaticKDTree(tree.getDimensions(), viewsOf(tree)) {}
+
+// Fills coords with `scratch` (the input coordinates, point after point)
+// in tree order and returns the input index of each position. The caller
+// appends the values in that order to valueBlob and valueOffsets.
+std::vector<uint32_t> StaticKDTree::layOut(const std::vector<double>& scratch) {
+    std::vector<uint32_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+    buildLayout(scratch, order, 0, 0, count, std::max(threads, 1));
+    
+    coords.resize(count * dimensions);
+    for (size_t i = 0; i < count; ++i) {
+        std::copy_n(scratch.begin() + static_cast<size_t>(order[i]) * dimensions, dimensions,
+                    coords.begin() + i * dimensions);
+    }
+    coordData = coords.data();
+    valueOffsets.reserve(count + 1);
+    valueOffsets.push_back(0);
+    return order;
+}
+
+void StaticKDTree::buildLayout(const std::vector<double>& scratch, std::vector<uint32_t>& order,
+                               int depth, size_t left, size_t right, int threads) {
+    if (right - left <= LEAF_SIZE) {
+        return;
+    }
+    
+    int currentDim = depth % dimensions;
+    size_t mid = left + (right - left) / 2;
+    std::nth_element(order.begin() + left, order.begin() + mid, order.begin() + right,
+        [&scratch, currentDim, this](uint32_t a, uint32_t b) {
+            return scratch[a * dimensions + currentDim] < scratch[b * dimensions + currentDim];
+        });
+    
+    if (threads > 1 && right - left > PARALLEL_BUILD_THRESHOLD) {
+        auto leftTask = std::async(std::launch::async, [&, depth, left, mid, threads]() {
+            buildLayout(scratch, order, depth + 1, left, mid, threads / 2);
+        });
+        buildLayout(scratch, order, depth + 1, mid + 1, right, threads - threads / 2);
+        leftTask.get();
+    } else {
+        buildLayout(scratch, order, depth + 1, left, mid, 1);
+        buildLayout(scratch, order, depth + 1, mid + 1, right, 1);
+    }
+}
+
+void StaticKDTree::save(const std::string& path) const {
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.dimensions = static_cast<uint32_t>(dimensions);
+    header.leafSize = static_cast<uint32_t>(LEAF_SIZE);
+    header.count = count;
+    header.blobSize = offsetData ? offsetData[count] : 0;
+    
+    // Write beside the target and rename over it, so readers never see a
+    // partial file. The data is synced before the rename and the directory
+    // after it, so once save() returns the new snapshot survives a crash.
+    std::string tempPath = path + ".tmp";
+    {
+        std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+        uint64_t emptyOffset = 0;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(coordData), count * dimensions * sizeof(double));
+        out.write(reinterpret_cast<const char*>(offsetData ? offsetData : &emptyOffset),
+                  (count + 1) * sizeof(uint64_t));
+        out.write(blobData, header.blobSize);
+        out.flush();
+        if (!out) {
+            std::remove(tempPath.c_str());
+            throw std::runtime_error("Cannot write snapshot: " + path);
+        }
+    }
+    if (!syncPath(tempPath) || std::rename(tempPath.c_str(), path.c_str()) != 0) {
+        std::remove(tempPath.c_str());
+        throw std::runtime_error("Cannot write snapshot: " + path);
+    }
+    if (!syncPath(parentDirectory(path))) {
+        throw std::runtime_error("Cannot sync snapshot directory: " + path);
+    }
+}
+
+// Only the header is read; the arrays are used where they lie in the mapping
+StaticKDTree StaticKDTree::open(const std::string& path) {
+    std::shared_ptr<const MappedFile> file = std::make_shared<MappedFile>(path);
+    
+    SnapshotHeader header;
+    if (file->getSize() < sizeof(header)) {
+        throw std::runtime_error("Not a snapshot file: " + path);
+    }
+    std::memcpy(&header, file->getData(), sizeof(header));
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+        throw std::runtime_error("Not a snapshot file: " + path);
+    }
+    if (header.byteOrder != BYTE_ORDER_MARK) {
+        throw std::runtime_error("Snapshot was written with a different byte order: " + path);
+    }
+    if (header.version != SNAPSHOT_VERSION) {
+        throw std::runtime_error("Unsupported snapshot version " + std::to_string(header.version) + ": " + path);
+    }
+    // The implicit layout depends on the leaf size it was built with
+    if (header.leafSize != LEAF_SIZE || header.dimensions == 0) {
+        throw std::runtime_error("Incompatible snapshot layout: " + path);
+    }
+    
+    // Size checks guard the multiplications in the offset helpers against overflow
+    uint64_t fileSize = file->getSize();
+    if (header.count > fileSize / sizeof(uint64_t)
+        || (header.count > 0 && header.dimensions > fileSize / sizeof(double) / header.count)
+        || header.blobSize > fileSize || blobOffset(header) + header.blobSize != fileSize) {
+        throw std::runtime_error("Truncated or corrupt snapshot: " + path);
+    }
+    
+    StaticKDTree tree;
+    tree.dimensions = static_cast<int>(header.dimensions);
+    tree.count = static_cast<size_t>(header.count);
+    tree.coordData = reinterpret_cast<const double*>(file->getData() + coordsOffset());
+    tree.offsetData = reinterpret_cast<const uint64_t*>(file->getData() + offsetsOffset(header));
+    tree.blobData = file->getData() + blobOffset(header);
+    // Values are sliced by neighbouring offsets without further checks, so
+    // every offset is checked once here: from 0, never decreasing, to blobSize
+    if (tree.offsetData[0] != 0 || tree.offsetData[tree.count] != header.blobSize) {
+        throw std::runtime_error("Truncated or corrupt snapshot: " + path);
+    }
+    for (size_t i = 0; i < tree.count; ++i) {
+        if (tree.offsetData[i + 1] < tree.offsetData[i]) {
+            throw std::runtime_error("Truncated or corrupt snapshot: " + path);
+        }
+    }
+    tree.mapping = file;
+    return tree;
+}
+
+bool StaticKDTree::search(const Point& point) const {
+    if (point.getDimensions() != dimensions) {
+        return false;
+    }
+    return find(0, count, 0, point.getCoordinates()) != count;
+}
+
+bool StaticKDTree::findValue(const std::vector<double>& coordinates, std::string& value) const {
+    if (coordinates.size() != static_cast<size_t>(dimensions)) {
+        return false;
+    }
+    size_t index = find(0, count, 0, coordinates);
+    if (index == count) {
+        return false;
+    }
+    valueAt(index, value);
+    return true;
+}
+
+size_t StaticKDTree::locate(const std::vector<double>& coordinates) const {
+    if (coordinates.size() != static_cast<size_t>(dimensions)) {
+        return NOT_FOUND;
+    }
+    size_t index = find(0, count, 0, coordinates);
+    return index == count ? NOT_FOUND : index;
+}
+
+void StaticKDTree::valueAt(size_t position, std::string& value) const {
+    value.assign(blobData + offsetData[position], offsetData[position + 1] - offsetData[position]);
+}
+
+// Position of a point matching target, or count if there is none
+size_t StaticKDTree::find(size_t left, size_t right, int depth, const std::vector<double>& target) const {
+    if (right - left <= LEAF_SIZE) {
+        for (size_t i = left; i < right; ++i) {
+            if (matches(i, target)) return i;
+        }
+        return count;
+    }
+    
+    size_t mid = left + (right - left) / 2;
+    if (matches(mid, target)) {
+        return mid;
+    }
+    
+    // The build does not separate ties, so equal keys may sit on either side
+    int currentDim = depth % dimensions;
+    double split = coordinatesOf(mid)[currentDim];
+    if (target[currentDim] <= split) {
+        size_t found = find(left, mid, depth + 1, target);
+        if (found != count) {
+            return found;
+        }
+    }
+    return target[currentDim] >= split ? find(mid + 1, right, depth + 1, target) : count;
+}
+
+std::vector<Point> StaticKDTree::rangeQuery(const std::vector<double>& min,
+                                           const std::vector<double>& max) const {
+    std::vector<Point> results;
+    forEachInRange(min, max, [&results](const PointView& p) {
+        results.push_back(p.toPoint());
+        return true;
+    });
+    return results;
+}
+
+std::vector<Point> StaticKDTree::radiusQuery(const std::vector<double>& target, double radius) const {
+    std::vector<Point> results;
+    forEachInRadius(target, radius, [&results](const PointView& p) {
+        results.push_back(p.toPoint());
+        return true;
+    });
+    return results;
+}
+
+size_t StaticKDTree::radiusCount(const std::vector<double>& target, double radius) const {
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match tree dimensions");
+    }
+    return radius < 0 ? 0 : countInRadius(0, count, 0, target, radius);
+}
+
+size_t StaticKDTree::countInRadius(size_t left, size_t right, int depth, const std::vector<double>& target,
+                                   double radius) const {
+    double radiusSq = radius * radius;
+    if (right - left <= LEAF_SIZE) {
+        double dists[LEAF_SIZE];
+        squaredDistances(target.data(), coordinatesOf(left), right - left, dimensions, dists);
+        size_t found = 0;
+        for (size_t i = 0; i < right - left; ++i) {
+            found += dists[i] <= radiusSq ? 1 : 0;
+        }
+        return found;
+    }
+    
+    size_t mid = left + (right - left) / 2;
+    size_t found = inRadius(mid, target, radiusSq) ? 1 : 0;
+    
+    int currentDim = depth % dimensions;
+    double diff = target[currentDim] - coordinatesOf(mid)[currentDim];
+    
+    if (diff <= radius) {
+        found += countInRadius(left, mid, depth + 1, target, radius);
+    }
+    if (-diff <= radius) {
+        found += countInRadius(mid + 1, right, depth + 1, target, radius);
+    }
+    return found;
+}
+
+Point StaticKDTree::nearestNeighbor(const std::vector<double>& target) const {
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match tree dimensions");
+    }
+    
+    if (count == 0) {
+        throw std::runtime_error("Tree is empty");
+    }
+    
+    size_t best = 0;
+    double bestDistSq = squaredDistance(coordinatesOf(0), target.data(), dimensions);
+    nearestNeighbor(0, count, 0, target, best, bestDistSq);
+    return pointAt(best);
+}
+
+void StaticKDTree::nearestNeighbor(size_t left, size_t right, int depth, const std::vector<double>& target,
+                                   size_t& best, double& bestDistSq) const {
+    if (right - left <= LEAF_SIZE) {
+        double dists[LEAF_SIZE];
+        squaredDistances(target.data(), coordinatesOf(left), right - left, dimensions, dists);
+        for (size_t i = left; i < right; ++i) {
+            if (dists[i - left] < bestDistSq) {
+                bestDistSq = dists[i - left];
+                best = i;
+            }
+        }
+        return;
+    }
+    
+    size_t mid = left + (right - left) / 2;
+    double distSq = squaredDistance(coordinatesOf(mid), target.data(), dimensions);
+    if (distSq < bestDistSq) {
+        bestDistSq = distSq;
+        best = mid;
+    }
+    
+    int currentDim = depth % dimensions;
+    double diff = target[currentDim] - coordinatesOf(mid)[currentDim];
+    
+    size_t nearLeft = diff < 0 ? left : mid + 1;
+    size_t nearRight = diff < 0 ? mid : right;
+    size_t farLeft = diff < 0 ? mid + 1 : left;
+    size_t farRight = diff < 0 ? right : mid;
+    
+    nearestNeighbor(nearLeft, nearRight, depth + 1, target, best, bestDistSq);
+    
+    if (diff * diff < bestDistSq) {
+        nearestNeighbor(farLeft, farRight, depth + 1, target, best, bestDistSq);
+    }
+}
+
+std::vector<Point> StaticKDTree::kNearestNeighbors(const std::vector<double>& target, int k) const {
+    std::vector<Neighbor> nearest;
+    kNearestNeighbors(target, k, nearest);
+    std::vector<Point> result;
+    result.reserve(nearest.size());
+    for (const Neighbor& n : nearest) {
+        result.push_back(n.point.toPoint());
+    }
+    return result;
+}
+
+// `out` serves as a max-heap of the k best so far, then is sorted nearest first
+void StaticKDTree::kNearestNeighbors(const std::vector<double>& target, int k, std::vector<Neighbor>& out,
+                                     const std::vector<bool>* skip) const {
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match tree dimensions");
+    }
+    
+    out.clear();
+    if (k <= 0 || count == 0) {
+        return;
+    }
+    
+    kNearestNeighbors(0, count, 0, target, static_cast<size_t>(k), skip, out);
+    std::sort_heap(out.begin(), out.end(), Neighbor::closer);
+}
+
+void StaticKDTree::kNearestNeighbors(size_t left, size_t right, int depth, const std::vector<double>& target,
+                                     size_t k, const std::vector<bool>* skip, std::vector<Neighbor>& heap) const {
+    if (right - left <= LEAF_SIZE) {
+        double dists[LEAF_SIZE];
+        squaredDistances(target.data(), coordinatesOf(left), right - left, dimensions, dists);
+        for (size_t i = left; i < right; ++i) {
+            offer(i, dists[i - left], k, skip, heap);
+        }
+        return;
+    }
+    
+    size_t mid = left + (right - left) / 2;
+    offer(mid, squaredDistance(coordinatesOf(mid), target.data(), dimensions), k, skip, heap);
+    
+    int currentDim = depth % dimensions;
+    double diff = target[currentDim] - coordinatesOf(mid)[currentDim];
+    
+    size_t nearLeft = diff < 0 ? left : mid + 1;
+    size_t nearRight = diff < 0 ? mid : right;
+    size_t farLeft = diff < 0 ? mid + 1 : left;
+    size_t farRight = diff < 0 ? right : mid;
+    
+    kNearestNeighbors(nearLeft, nearRight, depth + 1, target, k, skip, heap);
+    
+    if (heap.size() < k || diff * diff < heap.front().distSq) {
+        kNearestNeighbors(farLeft, farRight, depth + 1, target, k, skip, heap);
+    }
+}
+
+// Keeps point `index` if it is among the k nearest so far. Skipped points
+// are only looked up once they would make the cut.
+void StaticKDTree::offer(size_t index, double distSq, size_t k, const std::vector<bool>* skip,
+                         std::vector<Neighbor>& heap) const {
+    if (skip && (heap.size() < k || distSq < heap.front().distSq) && (*skip)[index]) {
+        return;
+    }
+    if (heap.size() < k) {
+        heap.push_back({viewAt(index), distSq});
+        std::push_heap(heap.begin(), heap.end(), Neighbor::closer);
+    } else if (distSq < heap.front().distSq) {
+        std::pop_heap(heap.begin(), heap.end(), Neighbor::closer);
+        heap.back() = {viewAt(index), distSq};
+        std::push_heap(heap.begin(), heap.end(), Neighbor::closer);
+    }
+}
+
+const double* StaticKDTree::coordinatesOf(size_t index) const {
+    return coordData + index * dimensions;
+}
+
+bool StaticKDTree::inRange(size_t index, const std::vector<double>& min,
+                           const std::vector<double>& max) const {
+    const double* c = coordinatesOf(index);
+    for (int i = 0; i < dimensions; ++i) {
+        if (c[i] < min[i] || c[i] > max[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool StaticKDTree::inRadius(size_t index, const std::vector<double>& target, double radiusSq) const {
+    return squaredDistance(coordinatesOf(index), target.data(), dimensions) <= radiusSq;
+}
+
+bool StaticKDTree::matches(size_t index, const std::vector<double>& target) const {
+    const double* c = coordinatesOf(index);
+    for (int i = 0; i < dimensions; ++i) {
+        if (std::abs(c[i] - target[i]) > 1e-10) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string StaticKDTree::valueOf(size_t index) const {
+    return std::string(blobData + offsetData[index], offsetData[index + 1] - offsetData[index]);
+}
+
+Point StaticKDTree::pointAt(size_t index) const {
+    const double* c = coordinatesOf(index);
+    return Point(std::vector<double>(c, c + dimensions), valueOf(index));
+}
+
+PointView StaticKDTree::viewAt(size_t index) const {
+    return PointView(coordinatesOf(index), dimensions, blobData + offsetData[index],
+                     offsetData[index + 1] - offsetData[index], static_cast<uint32_t>(index));
+}
+
+bool StaticKDTree::isEmpty() const {
+    return count == 0;
+}
+
+int StaticKDTree::size() const {
+    return static_cast<int>(count);
+}
+
+// Subtrees split evenly, so the height follows from the point count alone
+int StaticKDTree::height() const {
+    int levels = 0;
+    for (size_t n = count; n > 0; n /= 2) {
+        ++levels;
+        if (n <= LEAF_SIZE) break;
+    }
+    return levels;
+}
+
+int StaticKDTree::getDimensions() const {
+    return dimensions;
+}
+
+std::vector<Point> StaticKDTree::getAllPoints() const {
+    std::vector<Point> points;
+    points.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        points.push_back(pointAt(i));
+    }
+    return points;
+}
+
+// Positions are in tree order, which is in-order along each split
+void StaticKDTree::print() const {
+    for (size_t i = 0; i < count; ++i) {
+        pointAt(i).print();
+    }
+}
@@ -0,0 +1,221 @@
+#ifndef STATIC_KDTREE_H
+#define STATIC_KDTREE_H
+
+#include "Point.h"
+#include "KDTree.h"
+#include "MappedFile.h"
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+// Read-only K-D tree stored in flat arrays.
+//
+// Points are laid out in tree order: a subtree covering positions
+// [left, right) stores its splitting point at the middle position and its
+// two children in the halves on either side, so no child pointers exist
+// and every subtree is one contiguous run. Runs of LEAF_SIZE points or
+// fewer are leaf buckets that are scanned linearly with the batch distance
+// kernels. Point i's coordinates live at coords[i * dims], and its value
+// is kept apart from the coordinates in a single byte blob, so traversal
+// touches only the coordinate block.
+//
+// The three arrays are also the snapshot file format: save() writes them
+// behind a small header and open() maps the file and queries it in place.
+class StaticKDTree {
+public:
+    static const size_t LEAF_SIZE = 16;
+    static const size_t NOT_FOUND = static_cast<size_t>(-1);
+
+private:
+    int dimensions;
+    size_t count;
+    
+    // Storage of a tree built in memory; left empty when opened from a file
+    std::vector<double> coords;
+    std::vector<uint64_t> valueOffsets;  // count + 1 offsets into valueBlob
+    std::vector<char> valueBlob;
+    std::shared_ptr<const MappedFile> mapping;
+    
+    // What queries read: the vectors above or the mapped file
+    const double* coordData;
+    const uint64_t* offsetData;
+    const char* blobData;
+
+    StaticKDTree();
+
+    // Build helpers
+    std::vector<uint32_t> layOut(const std::vector<double>& scratch);
+    void buildLayout(const std::vector<double>& scratch, std::vector<uint32_t>& order,
+                     int depth, size_t left, size_t right, int threads);
+
+    // Search helpers
+    template <typename Visitor>
+    bool visitRange(size_t left, size_t right, int depth, const std::vector<double>& min,
+                    const std::vector<double>& max, Visitor& visit) const;
+    template <typename Visitor>
+    bool visitRadius(size_t left, size_t right, int depth, const std::vector<double>& target,
+                     double radius, Visitor& visit) const;
+    size_t countInRadius(size_t left, size_t right, int depth, const std::vector<double>& target,
+                         double radius) const;
+    void nearestNeighbor(size_t left, size_t right, int depth, const std::vector<double>& target,
+                         size_t& best, double& bestDistSq) const;
+    void kNearestNeighbors(size_t left, size_t right, int depth, const std::vector<double>& target,
+                           size_t k, const std::vector<bool>* skip, std::vector<Neighbor>& heap) const;
+    void offer(size_t index, double distSq, size_t k, const std::vector<bool>* skip,
+               std::vector<Neighbor>& heap) const;
+    size_t find(size_t left, size_t right, int depth, const std::vector<double>& target) const;
+
+    // Utility
+    const double* coordinatesOf(size_t index) const;
+    bool inRange(size_t index, const std::vector<double>& min, const std::vector<double>& max) const;
+    bool inRadius(size_t index, const std::vector<double>& target, double radiusSq) const;
+    bool matches(size_t index, const std::vector<double>& target) const;
+    std::string valueOf(size_t index) const;
+    Point pointAt(size_t index) const;
+    PointView viewAt(size_t index) const;
+
+public:
+    StaticKDTree(int dims, const std::vector<Point>& points);
+    // From views of stored points, copying each coordinate and value once
+    // straight into the layout; the views must stay valid meanwhile
+    StaticKDTree(int dims, const std::vector<PointView>& points);
+    explicit StaticKDTree(const KDTree& tree);
+    
+    // Views point into the tree's own storage, so it can move but not copy
+    StaticKDTree(StaticKDTree&& other) = default;
+    StaticKDTree& operator=(StaticKDTree&& other) = default;
+    StaticKDTree(const StaticKDTree&) = delete;
+    StaticKDTree& operator=(const StaticKDTree&) = delete;
+    
+    // Snapshots
+    // save() writes the layout to `path` (through a temporary file, so an
+    // existing snapshot is replaced atomically) and syncs it to disk before
+    // returning. open() maps a saved file and serves queries from the
+    // mapping with no parsing or rebuild; the file must not be modified
+    // while the tree is alive. Both throw
+    // std::runtime_error on I/O errors or an unrecognized file.
+    void save(const std::string& path) const;
+    static StaticKDTree open(const std::string& path);
+
+    // Query operations
+    bool search(const Point& point) const;
+    bool findValue(const std::vector<double>& coordinates, std::string& value) const;
+    // Layout position of the point at `coordinates`, or NOT_FOUND
+    size_t locate(const std::vector<double>& coordinates) const;
+    void valueAt(size_t position, std::string& value) const;
+    std::vector<Point> rangeQuery(const std::vector<double>& min, const std::vector<double>& max) const;
+    // As KDTree::radiusQuery and KDTree::radiusCount
+    std::vector<Point> radiusQuery(const std::vector<double>& target, double radius) const;
+    size_t radiusCount(const std::vector<double>& target, double radius) const;
+    Point nearestNeighbor(const std::vector<double>& target) const;
+    std::vector<Point> kNearestNeighbors(const std::vector<double>& target, int k) const;
+    // Into a caller-owned buffer, as KDTree::kNearestNeighbors. Points whose
+    // layout position is set in `skip` are left out.
+    void kNearestNeighbors(const std::vector<double>& target, int k, std::vector<Neighbor>& out,
+                           const std::vector<bool>* skip = nullptr) const;
+    
+    // Streaming queries, as KDTree::forEachInRange. A view's value id is
+    // the point's position in the layout.
+    template <typename Visitor>
+    bool forEachInRange(const std::vector<double>& min, const std::vector<double>& max,
+                        Visitor&& visit) const;
+    template <typename Visitor>
+    bool forEachInRadius(const std::vector<double>& target, double radius, Visitor&& visit) const;
+    // Every point, in layout order
+    template <typename Visitor>
+    bool forEachPoint(Visitor&& visit) const {
+        for (size_t i = 0; i < count; ++i) {
+            if (!visit(viewAt(i))) return false;
+        }
+        return true;
+    }
+
+    // Utility
+    bool isEmpty() const;
+    int size() const;
+    int height() const;
+    int getDimensions() const;
+    std::vector<Point> getAllPoints() const;
+    void print() const;
+};
+
+template <typename Visitor>
+bool StaticKDTree::forEachInRange(const std::vector<double>& min, const std::vector<double>& max,
+                                  Visitor&& visit) const {
+    if (min.size() != static_cast<size_t>(dimensions) || max.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Range dimensions do not match tree dimensions");
+    }
+    return visitRange(0, count, 0, min, max, visit);
+}
+
+template <typename Visitor>
+bool StaticKDTree::visitRange(size_t left, size_t right, int depth, const std::vector<double>& min,
+                              const std::vector<double>& max, Visitor& visit) const {
+    if (right - left <= LEAF_SIZE) {
+        for (size_t i = left; i < right; ++i) {
+            if (inRange(i, min, max) && !visit(viewAt(i))) return false;
+        }
+        return true;
+    }
+    
+    size_t mid = left + (right - left) / 2;
+    if (inRange(mid, min, max) && !visit(viewAt(mid))) {
+        return false;
+    }
+    
+    int currentDim = depth % dimensions;
+    double split = coordinatesOf(mid)[currentDim];
+    
+    if (min[currentDim] <= split && !visitRange(left, mid, depth + 1, min, max, visit)) {
+        return false;
+    }
+    
+    if (max[currentDim] >= split && !visitRange(mid + 1, right, depth + 1, min, max, visit)) {
+        return false;
+    }
+    
+    return true;
+}
+
+template <typename Visitor>
+bool StaticKDTree::forEachInRadius(const std::vector<double>& target, double radius, Visitor&& visit) const {
+    if (target.size() != static_cast<size_t>(dimensions)) {
+        throw std::invalid_argument("Target dimensions do not match tree dimensions");
+    }
+    return radius < 0 || visitRadius(0, count, 0, target, radius, visit);
+}
+
+// The left half holds coordinates <= split, the right half >= split
+template <typename Visitor>
+bool StaticKDTree::visitRadius(size_t left, size_t right, int depth, const std::vector<double>& target,
+                               double radius, Visitor& visit) const {
+    double radiusSq = radius * radius;
+    if (right - left <= LEAF_SIZE) {
+        for (size_t i = left; i < right; ++i) {
+            if (inRadius(i, target, radiusSq) && !visit(viewAt(i))) return false;
+        }
+        return true;
+    }
+    
+    size_t mid = left + (right - left) / 2;
+    if (inRadius(mid, target, radiusSq) && !visit(viewAt(mid))) {
+        return false;
+    }
+    
+    int currentDim = depth % dimensions;
+    double diff = target[currentDim] - coordinatesOf(mid)[currentDim];
+    
+    if (diff <= radius && !visitRadius(left, mid, depth + 1, target, radius, visit)) {
+        return false;
+    }
+    
+    if (-diff <= radius && !visitRadius(mid + 1, right, depth + 1, target, radius, visit)) {
+        return false;
+    }
+    
+    return true;
+}
+
+#endif // STATIC_KDTREE_H
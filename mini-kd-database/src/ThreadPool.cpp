@@ -0,0 +1,111 @@
+#include "ThreadPool.h"
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <algorithm>
+
+const size_t ThreadPool::DEFAULT_CHUNK;
+
+namespace {
+struct ParallelForState {
+    std::atomic<size_t> next;
+    std::mutex mutex;
+    std::condition_variable finished;
+    size_t done;
+    std::exception_ptr error;
+
+    ParallelForState() : next(0), done(0) {}
+};
+
+void runChunks(ParallelForState& state, size_t count, size_t chunk, const std::function<void(size_t)>& fn) {
+    size_t begin;
+    while ((begin = state.next.fetch_add(chunk)) < count) {
+        size_t end = std::min(begin + chunk, count);
+        for (size_t i = begin; i < end; ++i) {
+            try {
+                fn(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                if (!state.error) {
+                    state.error = std::current_exception();
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.done += end - begin;
+        if (state.done == count) {
+            state.finished.notify_all();
+        }
+    }
+}
+}
+
+ThreadPool::ThreadPool(int threads) : stopping(false) {
+    int count = std::max(threads, 1);
+    for (int i = 0; i < count; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    available.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::workerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            available.wait(lock, [this]() { return stopping || !tasks.empty(); });
+            if (stopping && tasks.empty()) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    available.notify_one();
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& fn, int maxThreads, size_t chunk) {
+    if (count == 0) {
+        return;
+    }
+    
+    chunk = std::max<size_t>(chunk, 1);
+    int threads = maxThreads > 0 ? std::min(maxThreads, size() + 1) : size() + 1;
+    size_t helpers = std::min(static_cast<size_t>(threads - 1), (count - 1) / chunk);
+    
+    // Helpers may start after the caller has finished every index, so the
+    // shared state is reference-counted rather than living on this stack frame
+    auto state = std::make_shared<ParallelForState>();
+    for (size_t i = 0; i < helpers; ++i) {
+        submit([state, count, chunk, fn]() { runChunks(*state, count, chunk, fn); });
+    }
+    runChunks(*state, count, chunk, fn);
+    
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&]() { return state->done == count; });
+    if (state->error) {
+        std::rethrow_exception(state->error);
+    }
+}
+
+int ThreadPool::size() const {
+    return static_cast<int>(workers.size());
+}
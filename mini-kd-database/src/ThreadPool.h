@@ -0,0 +1,49 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstddef>
+
+// Fixed set of worker threads that is created once and reused across calls.
+class ThreadPool {
+public:
+    // Indices claimed at a time by default, so cheap queries do not contend on the counter
+    static const size_t DEFAULT_CHUNK = 8;
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable available;
+    bool stopping;
+
+    void workerLoop();
+
+public:
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Queues a task to run on some worker
+    void submit(std::function<void()> task);
+
+    // Runs fn(i) for every i in [0, count) and waits for all of them.
+    // At most maxThreads threads take part (0 means the whole pool); the
+    // calling thread works too, so nested calls cannot starve. The first
+    // exception thrown by fn is rethrown here once every index is done.
+    // Threads claim `chunk` indices at a time, in increasing order; pass 1
+    // when each index is a large piece of work, such as a whole shard.
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn, int maxThreads = 0,
+                     size_t chunk = DEFAULT_CHUNK);
+
+    int size() const;
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,153 @@
+#include "ValueStore.h"
+#include <cstring>
+
+namespace {
+// Chunk k starts at id FIRST_CHUNK * (2^k - 1)
+int chunkOf(size_t id, size_t firstChunk) {
+    unsigned long long n = id / firstChunk + 1;
+    return 63 - __builtin_clzll(n);
+}
+}
+
+const size_t ValueStore::FIRST_CHUNK;
+const int ValueStore::CHUNK_COUNT;
+
+ValueStore::ValueStore(bool intern) : slotCount(0), interned(intern), valueBytes(0) {}
+
+bool ValueStore::Bytes::operator==(const Bytes& other) const {
+    return length == other.length && std::memcmp(data, other.data, length) == 0;
+}
+
+// FNV-1a
+size_t ValueStore::BytesHash::operator()(const Bytes& bytes) const {
+    uint64_t hash = 14695981039346656037ULL;
+    for (uint32_t i = 0; i < bytes.length; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(bytes.data[i])) * 1099511628211ULL;
+    }
+    return static_cast<size_t>(hash);
+}
+
+ValueStore::Slot& ValueStore::slot(ValueId id) {
+    int k = chunkOf(id, FIRST_CHUNK);
+    return chunks[k][id - FIRST_CHUNK * ((size_t(1) << k) - 1)];
+}
+
+const ValueStore::Slot& ValueStore::slot(ValueId id) const {
+    int k = chunkOf(id, FIRST_CHUNK);
+    return chunks[k][id - FIRST_CHUNK * ((size_t(1) << k) - 1)];
+}
+
+// The new bytes are stored before the old ones are let go, so setting a
+// value to itself never frees the copy it is about to share
+void ValueStore::assign(Slot& slot, const char* data, size_t length) {
+    char* old = slot.data;
+    uint32_t oldLength = slot.length;
+    slot.data = length > 0 ? store(data, length) : nullptr;
+    slot.length = static_cast<uint32_t>(length);
+    release(old, oldLength);
+}
+
+char* ValueStore::store(const char* data, size_t length) {
+    if (interned) {
+        auto found = shared.find(Bytes{data, static_cast<uint32_t>(length)});
+        if (found != shared.end()) {
+            found->second++;
+            return const_cast<char*>(found->first.data);
+        }
+    }
+    char* copy = static_cast<char*>(arena.allocate(length));
+    std::memcpy(copy, data, length);
+    valueBytes += Arena::roundedSize(length);
+    if (interned) {
+        shared.emplace(Bytes{copy, static_cast<uint32_t>(length)}, 1);
+    }
+    return copy;
+}
+
+void ValueStore::release(char* data, size_t length) {
+    if (!data) {
+        return;
+    }
+    if (interned) {
+        auto found = shared.find(Bytes{data, static_cast<uint32_t>(length)});
+        if (--found->second > 0) {
+            return;
+        }
+        shared.erase(found);
+    }
+    arena.deallocate(data, length);
+    valueBytes -= Arena::roundedSize(length);
+}
+
+ValueStore::ValueId ValueStore::add(const std::string& value) {
+    return add(value.data(), value.size());
+}
+
+ValueStore::ValueId ValueStore::add(const char* data, size_t length) {
+    ValueId id;
+    if (!freeIds.empty()) {
+        id = freeIds.back();
+        freeIds.pop_back();
+    } else {
+        id = slotCount++;
+        int k = chunkOf(id, FIRST_CHUNK);
+        if (!chunks[k]) {
+            chunks[k].reset(new Slot[FIRST_CHUNK << k]);
+        }
+        slot(id) = Slot{nullptr, 0};
+    }
+    assign(slot(id), data, length);
+    return id;
+}
+
+void ValueStore::set(ValueId id, const std::string& value) {
+    assign(slot(id), value.data(), value.size());
+}
+
+void ValueStore::remove(ValueId id) {
+    assign(slot(id), nullptr, 0);
+    freeIds.push_back(id);
+}
+
+const char* ValueStore::data(ValueId id) const {
+    return slot(id).data;
+}
+
+size_t ValueStore::length(ValueId id) const {
+    return slot(id).length;
+}
+
+std::string ValueStore::get(ValueId id) const {
+    const Slot& s = slot(id);
+    return std::string(s.data, s.length);
+}
+
+void ValueStore::clear() {
+    arena.release();
+    for (std::unique_ptr<Slot[]>& chunk : chunks) {
+        chunk.reset();
+    }
+    slotCount = 0;
+    freeIds.clear();
+    shared.clear();
+    valueBytes = 0;
+}
+
+size_t ValueStore::size() const {
+    return slotCount - freeIds.size();
+}
+
+bool ValueStore::interning() const {
+    return interned;
+}
+
+// Table entries are counted as their payload plus a link and a bucket
+size_t ValueStore::memoryUsage() const {
+    size_t slotBytes = 0;
+    for (int k = 0; k < CHUNK_COUNT && chunks[k]; ++k) {
+        slotBytes += (FIRST_CHUNK << k) * sizeof(Slot);
+    }
+    size_t tableBytes = shared.size() * (sizeof(std::pair<const Bytes, uint32_t>) + sizeof(void*))
+                        + shared.bucket_count() * sizeof(void*);
+    return slotBytes + valueBytes + tableBytes;
+}
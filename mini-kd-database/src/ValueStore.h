@@ -0,0 +1,82 @@
+#ifndef VALUE_STORE_H
+#define VALUE_STORE_H
+
+#include "Arena.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
+
+// Holds the string values of a tree's points, addressed by 32-bit ids.
+//
+// Nodes keep only the id, so value bytes stay out of the traversal path
+// and a value can be read or replaced in O(1) by anyone holding the id.
+// The bytes live in an Arena and ids of removed values are reused.
+// Slots sit in chunks that never move once allocated, so a reader can look
+// up an existing id while another thread adds values.
+//
+// An interning store keeps one copy of the bytes of each distinct value,
+// shared by every id holding it and counted by a table the writer keeps.
+// Ids stay one per point, so set() and remove() still act on one point; a
+// label repeated across many points costs its slot, not another copy.
+class ValueStore {
+public:
+    typedef uint32_t ValueId;
+
+private:
+    struct Slot {
+        char* data;
+        uint32_t length;
+    };
+
+    // Chunk k holds FIRST_CHUNK << k slots, so 32 chunks cover every id
+    static const size_t FIRST_CHUNK = 1024;
+    static const int CHUNK_COUNT = 32;
+
+    // Interned bytes and the number of slots sharing them, keyed by content
+    struct Bytes {
+        const char* data;
+        uint32_t length;
+        bool operator==(const Bytes& other) const;
+    };
+    struct BytesHash {
+        size_t operator()(const Bytes& bytes) const;
+    };
+
+    Arena arena;
+    std::unique_ptr<Slot[]> chunks[CHUNK_COUNT];
+    ValueId slotCount;
+    std::vector<ValueId> freeIds;
+    bool interned;
+    std::unordered_map<Bytes, uint32_t, BytesHash> shared;
+    size_t valueBytes;  // arena bytes behind the slots
+
+    Slot& slot(ValueId id);
+    const Slot& slot(ValueId id) const;
+    void assign(Slot& slot, const char* data, size_t length);
+    char* store(const char* data, size_t length);
+    void release(char* data, size_t length);
+
+public:
+    explicit ValueStore(bool intern = false);
+
+    ValueId add(const std::string& value);
+    ValueId add(const char* data, size_t length);
+    void set(ValueId id, const std::string& value);
+    void remove(ValueId id);
+
+    const char* data(ValueId id) const;
+    size_t length(ValueId id) const;
+    std::string get(ValueId id) const;
+
+    // Drops every value at once
+    void clear();
+    size_t size() const;
+    bool interning() const;
+    // Bytes held for values: slots, value bytes and the intern table
+    size_t memoryUsage() const;
+};
+
+#endif // VALUE_STORE_H
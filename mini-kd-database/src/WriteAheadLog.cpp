@@ -0,0 +1,329 @@
+#include "WriteAheadLog.h"
+#include "MappedFile.h"
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+const char LOG_MAGIC[8] = {'K', 'D', 'W', 'A', 'L', '\0', '\0', '\0'};
+// Version 1 logs lack LOAD and MERGE records and read the same
+const uint32_t LOG_VERSION = 2;
+
+struct LogHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dimensions;
+};
+
+// Record framing ahead of the payload: length, checksum, type
+const size_t RECORD_HEADER_SIZE = 2 * sizeof(uint32_t) + 1;
+
+// FNV-1a over the type byte and payload; enough to spot a torn write
+uint32_t checksum(const char* data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+void appendBytes(std::string& out, const void* data, size_t length) {
+    out.append(static_cast<const char*>(data), length);
+}
+}
+
+WriteAheadLog::WriteAheadLog(const std::string& path, int dims, const LogOptions& options)
+    : path(path), dimensions(dims), options(options), fd(-1), appended(0), durable(0), fileSize(0),
+      flushing(false), failed(false), syncs(0), lastSync(std::chrono::steady_clock::now()) {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open log: " + path);
+    }
+    
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot read log size: " + path);
+    }
+    
+    LogHeader header;
+    if (info.st_size == 0) {
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, LOG_MAGIC, sizeof(header.magic));
+        header.version = LOG_VERSION;
+        header.dimensions = static_cast<uint32_t>(dims);
+        std::string bytes;
+        appendBytes(bytes, &header, sizeof(header));
+        try {
+            writeAll(bytes);
+            sync();
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        fileSize = sizeof(header);
+        return;
+    }
+    
+    if (static_cast<size_t>(info.st_size) < sizeof(header)
+        || ::pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))
+        || std::memcmp(header.magic, LOG_MAGIC, sizeof(header.magic)) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Not a log file: " + path);
+    }
+    if (header.version < 1 || header.version > LOG_VERSION || header.dimensions != static_cast<uint32_t>(dims)) {
+        ::close(fd);
+        throw std::runtime_error("Log does not match database dimensions: " + path);
+    }
+    fileSize = static_cast<uint64_t>(info.st_size);
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    // Callers commit before returning, so this only matters after a failure
+    try {
+        if (!failed && !pending.empty()) {
+            writeAll(pending);
+        }
+        if (!failed && options.sync != SyncPolicy::Never) {
+            sync();
+        }
+    } catch (const std::exception&) {
+    }
+    ::close(fd);
+}
+
+size_t WriteAheadLog::replay(const std::function<void(const Record&)>& apply) {
+    size_t records = 0;
+    size_t validEnd = sizeof(LogHeader);
+    size_t fileSize = 0;
+    {
+        MappedFile file(path);
+        const char* data = file.getData();
+        fileSize = file.getSize();
+        size_t coordBytes = dimensions * sizeof(double);
+    
+        Record record;
+        while (fileSize - validEnd >= RECORD_HEADER_SIZE) {
+            const char* head = data + validEnd;
+            uint32_t length;
+            uint32_t expected;
+            std::memcpy(&length, head, sizeof(length));
+            std::memcpy(&expected, head + sizeof(length), sizeof(expected));
+            const char* body = head + 2 * sizeof(uint32_t);
+            if (length > fileSize - validEnd - RECORD_HEADER_SIZE || checksum(body, length + 1) != expected) {
+                break;
+            }
+    
+            record.type = static_cast<RecordType>(body[0]);
+            const char* payload = body + 1;
+            size_t fixed = record.type == MOVE ? 2 * coordBytes : (record.type >= CLEAR ? 0 : coordBytes);
+            if (record.type < INSERT || record.type > MERGE || length < fixed) {
+                break;
+            }
+            // The payload is not aligned for doubles, so coordinates are copied out
+            record.coordinates.resize(fixed > 0 ? dimensions : 0);
+            record.newCoordinates.resize(record.type == MOVE ? dimensions : 0);
+            if (fixed > 0) {
+                std::memcpy(record.coordinates.data(), payload, coordBytes);
+            }
+            if (record.type == MOVE) {
+                std::memcpy(record.newCoordinates.data(), payload + coordBytes, coordBytes);
+            }
+            record.value.assign(payload + fixed, length - fixed);
+    
+            apply(record);
+            ++records;
+            validEnd += RECORD_HEADER_SIZE + length;
+        }
+    }
+    
+    // Whatever follows the last good record was never acknowledged
+    if (validEnd < fileSize) {
+        if (::ftruncate(fd, validEnd) != 0) {
+            throw std::runtime_error("Cannot truncate log: " + path);
+        }
+        sync();
+    }
+    fileSize = validEnd;
+    return records;
+}
+
+uint64_t WriteAheadLog::append(RecordType type, const std::vector<double>* coordinates,
+                               const std::vector<double>* newCoordinates, const std::string* value) {
+    size_t coordBytes = dimensions * sizeof(double);
+    uint32_t length = static_cast<uint32_t>((coordinates ? coordBytes : 0) + (newCoordinates ? coordBytes : 0)
+                                            + (value ? value->size() : 0));
+    
+    // Encode outside the lock; only the buffer append is serialized
+    std::string record;
+    record.reserve(RECORD_HEADER_SIZE + length);
+    uint32_t sum = 0;  // filled in once the body is encoded
+    appendBytes(record, &length, sizeof(length));
+    appendBytes(record, &sum, sizeof(sum));
+    record.push_back(static_cast<char>(type));
+    if (coordinates) appendBytes(record, coordinates->data(), coordBytes);
+    if (newCoordinates) appendBytes(record, newCoordinates->data(), coordBytes);
+    if (value) record += *value;
+    sum = checksum(record.data() + 2 * sizeof(uint32_t), length + 1);
+    std::memcpy(&record[sizeof(uint32_t)], &sum, sizeof(sum));
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    pending += record;
+    return ++appended;
+}
+
+uint64_t WriteAheadLog::logInsert(const std::vector<double>& coordinates, const std::string& value) {
+    return append(INSERT, &coordinates, nullptr, &value);
+}
+
+uint64_t WriteAheadLog::logRemove(const std::vector<double>& coordinates) {
+    return append(REMOVE, &coordinates, nullptr, nullptr);
+}
+
+uint64_t WriteAheadLog::logUpdate(const std::vector<double>& coordinates, const std::string& value) {
+    return append(UPDATE, &coordinates, nullptr, &value);
+}
+
+uint64_t WriteAheadLog::logMove(const std::vector<double>& oldCoords, const std::vector<double>& newCoords,
+                                const std::string& value) {
+    return append(MOVE, &oldCoords, &newCoords, &value);
+}
+
+uint64_t WriteAheadLog::logClear() {
+    return append(CLEAR, nullptr, nullptr, nullptr);
+}
+
+uint64_t WriteAheadLog::logLoad(const std::string& snapshotPath) {
+    return append(LOAD, nullptr, nullptr, &snapshotPath);
+}
+
+uint64_t WriteAheadLog::logMerge(const std::string& snapshotPath) {
+    return append(MERGE, nullptr, nullptr, &snapshotPath);
+}
+
+void WriteAheadLog::commit(uint64_t sequence) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (durable < sequence || isDropped(sequence)) {
+        if (isDropped(sequence)) {
+            throw std::runtime_error("Log write failed, change not committed: " + path);
+        }
+        if (failed) {
+            throw std::runtime_error("Log write failed: " + path);
+        }
+        if (flushing) {
+            flushed.wait(lock);
+            continue;
+        }
+    
+        // Lead a flush of everything appended so far, including other writers' records
+        flushing = true;
+        std::string batch;
+        batch.swap(pending);
+        uint64_t batchEnd = appended;
+        auto now = std::chrono::steady_clock::now();
+        bool syncNow = options.sync == SyncPolicy::EveryCommit
+                       || (options.sync == SyncPolicy::Periodic
+                           && now - lastSync >= std::chrono::milliseconds(options.syncIntervalMs));
+        lock.unlock();
+    
+        bool ok = true;
+        try {
+            writeAll(batch);
+            if (syncNow) sync();
+        } catch (const std::exception&) {
+            ok = false;
+        }
+    
+        bool rolledBack = ok || rollBack();
+    
+        lock.lock();
+        flushing = false;
+        if (ok) {
+            fileSize += batch.size();
+            if (syncNow) lastSync = now;
+        } else {
+            dropped.emplace_back(durable + 1, batchEnd);
+            failed = !rolledBack;
+        }
+        durable = batchEnd;
+        flushed.notify_all();
+    }
+}
+
+bool WriteAheadLog::isDropped(uint64_t sequence) const {
+    for (const auto& range : dropped) {
+        if (sequence >= range.first && sequence <= range.second) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Cuts off whatever part of a failed batch reached the file. Called by the
+// flush leader, so no other write runs meanwhile.
+bool WriteAheadLog::rollBack() {
+    try {
+        if (::ftruncate(fd, static_cast<off_t>(fileSize)) != 0) {
+            return false;
+        }
+        sync();
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+void WriteAheadLog::truncate() {
+    std::unique_lock<std::mutex> lock(mutex);
+    flushed.wait(lock, [this]() { return !flushing; });
+    pending.clear();
+    durable = appended;
+    if (::ftruncate(fd, sizeof(LogHeader)) != 0) {
+        throw std::runtime_error("Cannot truncate log: " + path);
+    }
+    fileSize = sizeof(LogHeader);
+    sync();
+}
+
+void WriteAheadLog::writeAll(const std::string& bytes) {
+    const char* data = bytes.data();
+    size_t left = bytes.size();
+    while (left > 0) {
+        ssize_t written = ::write(fd, data, left);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Cannot write log: " + path);
+        }
+        data += written;
+        left -= static_cast<size_t>(written);
+    }
+}
+
+void WriteAheadLog::sync() {
+#ifdef __linux__
+    int result = ::fdatasync(fd);
+#else
+    int result = ::fsync(fd);
+#endif
+    if (result != 0) {
+        throw std::runtime_error("Cannot sync log: " + path);
+    }
+    ++syncs;
+}
+
+bool WriteAheadLog::hasFailed() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return failed;
+}
+
+size_t WriteAheadLog::syncCount() const {
+    return syncs;
+}
+
+const std::string& WriteAheadLog::getPath() const {
+    return path;
+}
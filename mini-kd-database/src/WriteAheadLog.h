@@ -0,0 +1,128 @@
+#ifndef WRITE_AHEAD_LOG_H
+#define WRITE_AHEAD_LOG_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <utility>
+
+// When a committed record is forced to disk
+enum class SyncPolicy {
+    EveryCommit,  // commit() returns once the record is on disk
+    Periodic,     // written on commit, synced at most every syncIntervalMs
+    Never         // written on commit, synced when the OS decides
+};
+
+struct LogOptions {
+    SyncPolicy sync = SyncPolicy::EveryCommit;
+    int syncIntervalMs = 100;
+};
+
+// Append-only log of Database mutations.
+//
+// Each change is encoded as one binary record:
+//   payload length (uint32) | checksum (uint32) | type (uint8) | payload
+// where the payload holds the coordinates (plus the target coordinates of a
+// move) followed by the value bytes. A bulk load is saved as a snapshot
+// file of its own and logged as one record naming it. Records behind a
+// short header (magic, version, dimensions) make up the whole file.
+//
+// Writers append records under a short lock and then call commit(). The
+// first committer writes every pending record in one write() and, if the
+// sync policy asks for it, one fdatasync(); writers that arrive meanwhile
+// wait for that flush or join the next one, so concurrent writers share
+// the cost of a sync. If a flush fails, the file is cut back to its last
+// good record, so the failed records never replay, and their commits throw.
+// The log stays usable unless the cut fails as well; see hasFailed().
+class WriteAheadLog {
+public:
+    enum RecordType : uint8_t {
+        INSERT = 1,  // coordinates, value
+        REMOVE = 2,  // coordinates
+        UPDATE = 3,  // coordinates, new value
+        MOVE = 4,    // old coordinates, new coordinates, value
+        CLEAR = 5,   // no payload
+        LOAD = 6,    // snapshot path as the value; its points replace the contents
+        MERGE = 7    // snapshot path as the value; its points are inserted
+    };
+
+    struct Record {
+        RecordType type;
+        std::vector<double> coordinates;
+        std::vector<double> newCoordinates;
+        std::string value;
+    };
+
+private:
+    std::string path;
+    int dimensions;
+    LogOptions options;
+    int fd;
+
+    mutable std::mutex mutex;
+    std::condition_variable flushed;
+    std::string pending;       // encoded records not yet written
+    uint64_t appended;         // sequence number of the last appended record
+    uint64_t durable;          // sequence number covered by the last flush, written or dropped
+    uint64_t fileSize;         // bytes of header and good records in the file
+    std::vector<std::pair<uint64_t, uint64_t>> dropped;  // sequence ranges of failed flushes
+    bool flushing;
+    bool failed;
+    std::atomic<size_t> syncs;
+    std::chrono::steady_clock::time_point lastSync;
+
+    uint64_t append(RecordType type, const std::vector<double>* coordinates,
+                    const std::vector<double>* newCoordinates, const std::string* value);
+    bool isDropped(uint64_t sequence) const;
+    bool rollBack();
+    void writeAll(const std::string& bytes);
+    void sync();
+
+public:
+    // Opens or creates the log at `path`. Throws std::runtime_error on I/O
+    // errors or if the file is not a log for `dims` dimensions.
+    WriteAheadLog(const std::string& path, int dims, const LogOptions& options = LogOptions());
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    // Calls apply for every complete record in file order and returns how
+    // many there were. A torn or corrupt tail left by a crash is cut off.
+    // Call before appending.
+    size_t replay(const std::function<void(const Record&)>& apply);
+
+    // Appending returns the record's sequence number for commit()
+    uint64_t logInsert(const std::vector<double>& coordinates, const std::string& value);
+    uint64_t logRemove(const std::vector<double>& coordinates);
+    uint64_t logUpdate(const std::vector<double>& coordinates, const std::string& value);
+    uint64_t logMove(const std::vector<double>& oldCoords, const std::vector<double>& newCoords,
+                     const std::string& value);
+    uint64_t logClear();
+    uint64_t logLoad(const std::string& snapshotPath);
+    uint64_t logMerge(const std::string& snapshotPath);
+
+    // Blocks until every record up to `sequence` is written (and synced,
+    // per the policy). Safe to call from several threads at once. Throws
+    // std::runtime_error if the flush holding the record failed; the record
+    // is then gone from the log.
+    void commit(uint64_t sequence);
+
+    // Drops every record, e.g. once they are all covered by a snapshot
+    void truncate();
+
+    // True once a failed flush could not be cut back out of the file. Every
+    // later commit throws; open the log again to go on from its good records.
+    bool hasFailed() const;
+
+    size_t syncCount() const;
+    const std::string& getPath() const;
+};
+
+#endif // WRITE_AHEAD_LOG_H
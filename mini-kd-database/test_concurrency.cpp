@@ -0,0 +1,187 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <future>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "src/Database.h"
+
+// Readers query a region of fixed anchor points while a writer churns a
+// separate region, so every read has a known correct answer.
+int main(int argc, char* argv[]) {
+    int writes = argc > 1 ? std::atoi(argv[1]) : 20000;
+    int readers = argc > 2 ? std::atoi(argv[2]) : 4;
+    
+    std::cout << "=== Database Concurrency Stress Test ===" << std::endl;
+    std::cout << "Writes: " << writes << ", reader threads: " << readers << std::endl;
+    
+    Database db(2);
+    for (int x = 0; x < 40; ++x) {
+        for (int y = 0; y < 25; ++y) {
+            db.insert({static_cast<double>(x), static_cast<double>(y)}, "anchor");
+        }
+    }
+    std::vector<std::vector<double>> churn;
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<double> coord(0.0, 100.0);
+    for (int i = 0; i < 2000; ++i) {
+        churn.push_back({200.0 + coord(rng), coord(rng)});
+        db.insert(churn.back(), "churn");
+    }
+    
+    std::atomic<bool> writing(true);
+    std::atomic<long> reads(0);
+    std::atomic<long> failures(0);
+    std::atomic<long> snapshotScans(0);
+    std::atomic<long> snapshotFailures(0);
+    std::atomic<long> nestedScans(0);
+    std::atomic<long> nestedFailures(0);
+    std::atomic<long> saves(0);
+    std::atomic<long> saveFailures(0);
+    
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; ++r) {
+        threads.emplace_back([&, r]() {
+            std::mt19937 local(r);
+            std::uniform_int_distribution<int> pickX(0, 39);
+            std::uniform_int_distribution<int> pickY(0, 24);
+            while (writing.load()) {
+                std::vector<double> anchor = {static_cast<double>(pickX(local)), static_cast<double>(pickY(local))};
+                bool ok = db.rangeQuery({0.0, 0.0}, {39.0, 24.0}).size() == 1000
+                          && db.nearestNeighbor(anchor).first == anchor
+                          && db.getPointValue(anchor) == "anchor"
+                          && db.kNearestNeighbors({250.0, 50.0}, 5).size() == 5;
+                int size = db.getSize();
+                ok = ok && size >= 2999 && size <= 3000;
+                if (!ok) ++failures;
+                ++reads;
+            }
+        });
+    }
+    
+    // A snapshot taken mid-churn must answer the same scan the same way
+    // however long it is held, while the writer keeps changing the tree
+    threads.emplace_back([&]() {
+        while (writing.load()) {
+            DatabaseSnapshot view = db.snapshot();
+            size_t first = view.rangeQuery({0.0, 0.0}, {400.0, 100.0}).size();
+            std::string value = view.getPointValue({5.0, 5.0});
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            size_t second = view.rangeQuery({0.0, 0.0}, {400.0, 100.0}).size();
+            bool ok = first == static_cast<size_t>(view.getSize()) && first == second
+                      && value == "anchor" && view.getPointValue({5.0, 5.0}) == value;
+            if (!ok) ++snapshotFailures;
+            ++snapshotScans;
+        }
+    });
+    
+    // A scan whose visitor reads back from the database must not deadlock
+    // with a writer that queued up behind the scan
+    threads.emplace_back([&]() {
+        while (writing.load()) {
+            int anchors = 0;
+            db.forEachInRange({0.0, 0.0}, {3.0, 3.0}, [&](const PointView& p) {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+                anchors += db.getPointValue(p.copyCoordinates()) == "anchor" ? 1 : 0;
+                return true;
+            });
+            if (anchors != 16) ++nestedFailures;
+            ++nestedScans;
+        }
+    });
+    
+    // Each saved file must hold one consistent state of the churning tree
+    const std::string savePath = "test_concurrency.snap";
+    threads.emplace_back([&]() {
+        while (writing.load()) {
+            db.saveSnapshot(savePath);
+            std::unique_ptr<Database> saved = Database::openSnapshot(savePath);
+            int size = saved->getSize();
+            bool ok = size >= 2999 && size <= 3000
+                      && saved->rangeQuery({0.0, 0.0}, {39.0, 24.0}).size() == 1000;
+            if (!ok) ++saveFailures;
+            ++saves;
+        }
+    });
+    
+    // Each step removes one churn point and adds one, moving or rewriting others on the way
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < writes; ++i) {
+        size_t slot = rng() % churn.size();
+        std::vector<double> next = {200.0 + coord(rng), coord(rng)};
+        if (i % 4 == 0) {
+            db.update(churn[slot], next, "moved");
+        } else {
+            db.remove(churn[slot]);
+            db.insert(next, "churn");
+        }
+        if (i % 8 == 0) {
+            db.update(next, "rewritten");
+        }
+        churn[slot] = next;
+    }
+    writing.store(false);
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    
+    // A save stalled on a full pipe must not hold up a write: the save's
+    // temp file is a FIFO that is only drained after the insert finished
+    const std::string stalledPath = "test_concurrency_stalled.snap";
+    const std::string stalledTemp = stalledPath + ".tmp";
+    std::remove(stalledTemp.c_str());
+    bool writeDuringStall = false;
+    int pipeFd = mkfifo(stalledTemp.c_str(), 0600) == 0 ? open(stalledTemp.c_str(), O_RDWR | O_NONBLOCK) : -1;
+    if (pipeFd >= 0) {
+        std::atomic<bool> saveReturned(false);
+        std::thread stalledSave([&]() {
+            try {
+                db.saveSnapshot(stalledPath);
+            } catch (const std::exception&) {
+                // A FIFO cannot be synced; only the stall matters here
+            }
+            saveReturned.store(true);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        std::future<void> insertDone = std::async(std::launch::async, [&]() {
+            db.insert({500.0, 500.0}, "during save");
+        });
+        writeDuringStall = insertDone.wait_for(std::chrono::seconds(2)) == std::future_status::ready;
+        char buffer[4096];
+        while (!saveReturned.load()) {
+            if (read(pipeFd, buffer, sizeof(buffer)) <= 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        stalledSave.join();
+        insertDone.get();
+        db.remove({500.0, 500.0});
+        close(pipeFd);
+    }
+    std::remove(stalledTemp.c_str());
+    std::remove(stalledPath.c_str());
+    
+    std::cout << "Reads completed during writes: " << reads.load() << " in " << seconds << " s" << std::endl;
+    std::cout << "Every read saw a consistent tree? " << (failures.load() == 0 ? "Yes" : "No") << std::endl;
+    std::cout << "Snapshot scans: " << snapshotScans.load() << ", every snapshot stayed unchanged? "
+              << (snapshotFailures.load() == 0 ? "Yes" : "No") << std::endl;
+    std::cout << "Scans reading back from the visitor: " << nestedScans.load() << ", all consistent? "
+              << (nestedFailures.load() == 0 ? "Yes" : "No") << std::endl;
+    std::cout << "Snapshots saved: " << saves.load() << ", all consistent? "
+              << (saveFailures.load() == 0 ? "Yes" : "No") << std::endl;
+    std::cout << "Write finished while a save was stalled? " << (writeDuringStall ? "Yes" : "No") << std::endl;
+    std::remove(savePath.c_str());
+    std::cout << "Final size: " << db.getSize() << ", anchors intact? "
+              << (db.rangeQuery({0.0, 0.0}, {39.0, 24.0}).size() == 1000 ? "Yes" : "No") << std::endl;
+    
+    std::cout << "\n=== Stress test completed ===" << std::endl;
+    return 0;
+}
@@ -1,7 +1,26 @@
 #include <iostream>
 #include <vector>
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <algorithm>
+#include <limits>
+#include <chrono>
+#include <fstream>
+#include <csignal>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include "src/KDTree.h"
 #include "src/Point.h"
+#include "src/StaticKDTree.h"
+#include "src/FixedDatabase.h"
+#include "src/DistanceKernels.h"
+#include "src/Database.h"
+#include "src/ShardedDatabase.h"
+#include "src/PointFile.h"
 
 int main() {
     std::cout << "=== KDTree Testing ===" << std::endl;
@@ -83,6 +102,903 @@ int main() {
     std::cout << "After clear - size: " << tree.size() << std::endl;
     std::cout << "Tree empty? " << (tree.isEmpty() ? "Yes" : "No") << std::endl;
     
+    // Test 9: Bulk build
+    std::cout << "\nTest 9: Bulk build" << std::endl;
+    std::vector<Point> batch;
+    for (int i = 0; i < 1000; ++i) {
+        batch.push_back(Point({static_cast<double>(i % 37), static_cast<double>(i)}, "bulk"));
+    }
+    tree.build(batch);
+    std::cout << "Bulk-built size: " << tree.size() << ", height: " << tree.height() << std::endl;
+    bool allFound = true;
+    for (const auto& p : batch) {
+        allFound = allFound && tree.search(p);
+    }
+    std::cout << "All bulk-loaded points found? " << (allFound ? "Yes" : "No") << std::endl;
+    tree.build({Point({500.0, 500.0}, "merged")}, false);
+    std::cout << "After merge - size: " << tree.size() << std::endl;
+    
+    // Test 10: Flat static layout
+    std::cout << "\nTest 10: Flat static layout" << std::endl;
+    KDTree dynamicTree(3);
+    for (int i = 0; i < 2000; ++i) {
+        dynamicTree.insert(Point({static_cast<double>((i * 7919) % 1009),
+                                  static_cast<double>((i * 104729) % 997),
+                                  static_cast<double>((i * 31) % 101)}, "v" + std::to_string(i)));
+    }
+    StaticKDTree flatTree(dynamicTree);
+    std::cout << "Static tree size: " << flatTree.size() << std::endl;
+    
+    std::vector<double> boxMin = {100.0, 200.0, 10.0};
+    std::vector<double> boxMax = {600.0, 700.0, 60.0};
+    std::cout << "Range counts match? "
+              << (flatTree.rangeQuery(boxMin, boxMax).size() == dynamicTree.rangeQuery(boxMin, boxMax).size()
+                  ? "Yes" : "No") << std::endl;
+    
+    std::vector<double> probe = {321.5, 123.5, 50.5};
+    Point flatNearest = flatTree.nearestNeighbor(probe);
+    Point treeNearest = dynamicTree.nearestNeighbor(probe);
+    std::cout << "Nearest neighbors match? "
+              << (flatNearest.distanceTo(probe) == treeNearest.distanceTo(probe) ? "Yes" : "No") << std::endl;
+    
+    auto flatK = flatTree.kNearestNeighbors(probe, 10);
+    auto treeK = dynamicTree.kNearestNeighbors(probe, 10);
+    bool kMatch = flatK.size() == treeK.size();
+    for (size_t i = 0; kMatch && i < flatK.size(); ++i) {
+        kMatch = flatK[i].distanceTo(probe) == treeK[i].distanceTo(probe);
+    }
+    std::cout << "k-nearest neighbors match? " << (kMatch ? "Yes" : "No") << std::endl;
+    std::cout << "Stored point found? " << (flatTree.search(treeNearest) ? "Yes" : "No")
+              << ", value: " << flatNearest.getValue() << std::endl;
+    
+    // Test 11: Remove/insert churn reuses arena storage
+    std::cout << "\nTest 11: Remove/insert churn" << std::endl;
+    KDTree churnTree(2);
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < 500; ++i) {
+            churnTree.insert(Point({static_cast<double>(i % 23), static_cast<double>(i % 29)},
+                                   "round" + std::to_string(round)));
+        }
+        int removedCount = 0;
+        for (int i = 0; i < 500; ++i) {
+            removedCount += churnTree.remove(Point({static_cast<double>(i % 23), static_cast<double>(i % 29)}));
+        }
+        std::cout << "Round " << round << " removed " << removedCount << ", size now " << churnTree.size() << std::endl;
+    }
+    
+    // Test 12: Compile-time dimension tree
+    std::cout << "\nTest 12: Compile-time dimension tree" << std::endl;
+    FixedDatabase<3> fixedDb;
+    for (const Point& p : dynamicTree.getAllPoints()) {
+        const std::vector<double>& c = p.getCoordinates();
+        fixedDb.insert({{c[0], c[1], c[2]}}, p.getValue());
+    }
+    std::cout << "Fixed database size: " << fixedDb.getSize() << std::endl;
+    
+    FixedDatabase<3>::Coordinates fixedProbe = {{321.5, 123.5, 50.5}};
+    auto fixedNearest = fixedDb.nearestNeighbor(fixedProbe);
+    std::cout << "Nearest neighbor matches KDTree? "
+              << (Point({fixedNearest.first[0], fixedNearest.first[1], fixedNearest.first[2]}).distanceTo(probe)
+                  == treeNearest.distanceTo(probe) ? "Yes" : "No") << std::endl;
+    
+    auto fixedK = fixedDb.kNearestNeighbors(fixedProbe, 10);
+    bool fixedKMatch = fixedK.size() == treeK.size();
+    for (size_t i = 0; fixedKMatch && i < fixedK.size(); ++i) {
+        Point asPoint({fixedK[i].first[0], fixedK[i].first[1], fixedK[i].first[2]});
+        fixedKMatch = asPoint.distanceTo(probe) == treeK[i].distanceTo(probe);
+    }
+    std::cout << "k-nearest neighbors match KDTree? " << (fixedKMatch ? "Yes" : "No") << std::endl;
+    
+    std::cout << "Range counts match KDTree? "
+              << (fixedDb.rangeQuery({{100.0, 200.0, 10.0}}, {{600.0, 700.0, 60.0}}).size()
+                  == dynamicTree.rangeQuery(boxMin, boxMax).size() ? "Yes" : "No") << std::endl;
+    
+    FixedDatabase<3>::Coordinates nearestCoords = fixedNearest.first;
+    fixedDb.update(nearestCoords, "renamed");
+    std::cout << "Value after update: " << fixedDb.getPointValue(nearestCoords) << std::endl;
+    std::cout << "Removed nearest? " << (fixedDb.remove(nearestCoords) ? "Yes" : "No")
+              << ", size now " << fixedDb.getSize() << std::endl;
+
+    FixedDatabase<3>::Coordinates firstCoords = fixedK.back().first;
+    fixedDb.insert(firstCoords, "upserted");
+    std::cout << "Insert at stored coordinates keeps size " << fixedDb.getSize()
+              << ", value now " << fixedDb.getPointValue(firstCoords) << std::endl;
+
+    // Sorted inserts would make a chain of the plain tree
+    FixedKDTree<2> sortedFixed;
+    for (int i = 0; i < 4096; ++i) {
+        sortedFixed.insert({{static_cast<double>(i), static_cast<double>(i)}}, std::to_string(i));
+    }
+    std::cout << "Height after 4096 sorted inserts: " << sortedFixed.height() << std::endl;
+    bool sortedIntact = true;
+    for (int i = 0; i < 4096; i += 2) {
+        sortedIntact = sortedFixed.remove({{static_cast<double>(i), static_cast<double>(i)}}) && sortedIntact;
+    }
+    for (int i = 0; i < 4096; ++i) {
+        const std::string* value = sortedFixed.findValue({{static_cast<double>(i), static_cast<double>(i)}});
+        sortedIntact = sortedIntact && (i % 2 == 0 ? !value : value && *value == std::to_string(i));
+    }
+    sortedIntact = sortedIntact && sortedFixed.rangeQuery({{0.0, 0.0}}, {{4096.0, 4096.0}}).size() == 2048;
+    std::cout << "After removing every other point: size " << sortedFixed.size()
+              << ", height " << sortedFixed.height()
+              << ", rest intact? " << (sortedIntact ? "Yes" : "No") << std::endl;
+
+    // Test 13: Batch distance kernel
+    std::cout << "\nTest 13: Batch distance kernel (" << distanceKernelName() << ")" << std::endl;
+    std::vector<double> block;
+    for (int i = 0; i < 37 * 5; ++i) {
+        block.push_back(static_cast<double>((i * 7919) % 211) / 7.0);
+    }
+    std::vector<double> kernelTarget = {1.5, 2.5, 3.5, 4.5, 5.5};
+    std::vector<double> batchOut(37);
+    squaredDistances(kernelTarget.data(), block.data(), 37, 5, batchOut.data());
+    bool kernelMatch = true;
+    for (int i = 0; i < 37; ++i) {
+        double expected = squaredDistance(kernelTarget.data(), block.data() + i * 5, 5);
+        kernelMatch = kernelMatch && std::abs(batchOut[i] - expected) <= 1e-9 * (1.0 + expected);
+    }
+    std::cout << "Batch kernel matches scalar distances? " << (kernelMatch ? "Yes" : "No") << std::endl;
+    
+    // Test 14: Batched queries
+    std::cout << "\nTest 14: Batched queries" << std::endl;
+    Database batchDb(3);
+    for (const Point& p : dynamicTree.getAllPoints()) {
+        batchDb.insert(p.getCoordinates(), p.getValue());
+    }
+    std::vector<std::vector<double>> batchTargets;
+    std::vector<std::pair<std::vector<double>, std::vector<double>>> batchRanges;
+    for (int i = 0; i < 200; ++i) {
+        double x = (i * 37) % 1009, y = (i * 91) % 997, z = (i * 13) % 101;
+        batchTargets.push_back({x, y, z});
+        batchRanges.push_back({{x - 50, y - 50, z - 5}, {x + 50, y + 50, z + 5}});
+    }
+    auto batchNearest = batchDb.nearestNeighborBatch(batchTargets, 4);
+    auto batchK = batchDb.kNearestNeighborsBatch(batchTargets, 5, 4);
+    auto batchRange = batchDb.rangeQueryBatch(batchRanges, 4);
+    bool batchMatch = batchNearest.size() == batchTargets.size();
+    for (size_t i = 0; batchMatch && i < batchTargets.size(); ++i) {
+        batchMatch = batchNearest[i] == batchDb.nearestNeighbor(batchTargets[i])
+                     && batchK[i] == batchDb.kNearestNeighbors(batchTargets[i], 5)
+                     && batchRange[i].size() == batchDb.rangeQuery(batchRanges[i].first, batchRanges[i].second).size();
+    }
+    std::cout << "Batch results match single queries in order? " << (batchMatch ? "Yes" : "No") << std::endl;
+    
+    // Test 15: Streaming range query
+    std::cout << "\nTest 15: Streaming range query" << std::endl;
+    size_t streamed = 0;
+    bool completed = batchDb.forEachInRange(boxMin, boxMax, [&streamed](const PointView& p) {
+        streamed += p.getDimensions() == 3;
+        return true;
+    });
+    std::cout << "Streamed " << streamed << " points, completed? " << (completed ? "Yes" : "No")
+              << ", matches rangeQuery? " << (streamed == batchDb.rangeQuery(boxMin, boxMax).size() ? "Yes" : "No")
+              << std::endl;
+    size_t seen = 0;
+    completed = batchDb.forEachInRange(boxMin, boxMax, [&seen](const PointView&) {
+        return ++seen < 5;
+    });
+    std::cout << "Early stop after " << seen << " points, completed? " << (completed ? "Yes" : "No") << std::endl;
+    
+    // Test 16: Balance under sorted and clustered insert order
+    std::cout << "\nTest 16: Balance under adversarial insert order" << std::endl;
+    KDTree sortedTree(2);
+    KDTree reversedTree(2);
+    KDTree clusteredTree(2);
+    for (int i = 0; i < 20000; ++i) {
+        sortedTree.insert(Point({static_cast<double>(i), static_cast<double>(i % 97)}, "s"));
+        reversedTree.insert(Point({static_cast<double>(20000 - i), static_cast<double>(i % 89)}, "r"));
+        clusteredTree.insert(Point({(i % 4) * 1000.0 + i * 0.001, static_cast<double>(i)}, "c"));
+    }
+    std::cout << "Heights (sorted, reversed, clustered): " << sortedTree.height() << ", "
+              << reversedTree.height() << ", " << clusteredTree.height() << std::endl;
+    bool logarithmic = sortedTree.height() <= 40 && reversedTree.height() <= 40 && clusteredTree.height() <= 40;
+    std::cout << "All within O(log n)? " << (logarithmic ? "Yes" : "No") << std::endl;
+    
+    for (int i = 0; i < 15000; ++i) {
+        sortedTree.remove(Point({static_cast<double>(i), static_cast<double>(i % 97)}));
+    }
+    Point sortedNearest = sortedTree.nearestNeighbor({100.0, 3.0});
+    std::cout << "After removing 15000: size " << sortedTree.size() << ", height " << sortedTree.height()
+              << ", nearest to (100,3): (" << sortedNearest.getCoordinate(0) << ", "
+              << sortedNearest.getCoordinate(1) << ")" << std::endl;
+    
+    // Test 17: Removed points are skipped until compaction drops them
+    std::cout << "\nTest 17: Tombstone deletes" << std::endl;
+    KDTree gridTree(2);
+    for (int x = 0; x < 100; ++x) {
+        for (int y = 0; y < 100; ++y) {
+            gridTree.insert(Point({static_cast<double>(x), static_cast<double>(y)}, "g"));
+        }
+    }
+    for (int x = 0; x < 100; ++x) {
+        for (int y = x % 2; y < 100; y += 2) {
+            gridTree.remove(Point({static_cast<double>(x), static_cast<double>(y)}));
+        }
+    }
+    Point gridNearest = gridTree.nearestNeighbor({10.0, 10.0});
+    std::cout << "Size after removing half: " << gridTree.size()
+              << ", range count: " << gridTree.rangeQuery({0.0, 0.0}, {99.0, 99.0}).size()
+              << ", removed point found? " << (gridTree.search(Point({10.0, 10.0})) ? "Yes" : "No") << std::endl;
+    std::cout << "Nearest to (10,10) is a live point? "
+              << ((static_cast<int>(gridNearest.getCoordinate(0)) + static_cast<int>(gridNearest.getCoordinate(1))) % 2 == 1
+                  ? "Yes" : "No")
+              << ", distance " << gridNearest.distanceTo(std::vector<double>{10.0, 10.0}) << std::endl;
+    gridTree.insert(Point({10.0, 10.0}, "back"));
+    std::cout << "Reinserted (10,10): size " << gridTree.size() << ", nearest value '"
+              << gridTree.nearestNeighbor({10.0, 10.0}).getValue() << "'" << std::endl;
+    
+    // Test 18: Snapshot save and memory-mapped open
+    std::cout << "\nTest 18: Snapshot save and open" << std::endl;
+    const std::string snapshotPath = "test_snapshot.kds";
+    batchDb.saveSnapshot(snapshotPath);
+    std::unique_ptr<Database> opened = Database::openSnapshot(snapshotPath);
+    bool snapshotMatch = opened->getSize() == batchDb.getSize()
+                         && opened->getDimensions() == batchDb.getDimensions();
+    // The two trees may break distance ties differently, so nearest points are compared by distance
+    for (size_t i = 0; snapshotMatch && i < batchTargets.size(); ++i) {
+        const std::vector<double>& target = batchTargets[i];
+        snapshotMatch = squaredDistance(opened->nearestNeighbor(target).first.data(), target.data(), 3)
+                           == squaredDistance(batchDb.nearestNeighbor(target).first.data(), target.data(), 3)
+                        && opened->kNearestNeighbors(batchTargets[i], 5).size() == 5
+                        && opened->rangeQuery(batchRanges[i].first, batchRanges[i].second).size()
+                           == batchDb.rangeQuery(batchRanges[i].first, batchRanges[i].second).size();
+    }
+    std::cout << "Opened " << opened->getSize() << " points, queries match? " << (snapshotMatch ? "Yes" : "No")
+              << ", value lookup: '" << opened->getPointValue(batchDb.nearestNeighbor({0.0, 0.0, 0.0}).first)
+              << "'" << std::endl;
+    
+    opened->insert({-1.0, -1.0, -1.0}, "new");
+    opened->remove(batchDb.nearestNeighbor({0.0, 0.0, 0.0}).first);
+    std::cout << "After insert and remove: size " << opened->getSize() << ", new point found? "
+              << (opened->contains({-1.0, -1.0, -1.0}) ? "Yes" : "No") << std::endl;
+    
+    bool rejected = false;
+    try {
+        Database::openSnapshot("test_kdtree.cpp");
+    } catch (const std::runtime_error&) {
+        rejected = true;
+    }
+    // One value offset in the middle made to jump past the next one: the
+    // offsets follow the 40-byte header and the coordinates
+    const std::string corruptPath = "test_corrupt.kds";
+    batchDb.saveSnapshot(corruptPath);
+    std::FILE* corrupt = std::fopen(corruptPath.c_str(), "r+b");
+    uint64_t hugeOffset = UINT64_MAX / 2;
+    std::fseek(corrupt, static_cast<long>(40 + batchDb.getSize() * 3 * sizeof(double) + sizeof(uint64_t)), SEEK_SET);
+    std::fwrite(&hugeOffset, sizeof(hugeOffset), 1, corrupt);
+    std::fclose(corrupt);
+    bool corruptRejected = false;
+    try {
+        Database::openSnapshot(corruptPath);
+    } catch (const std::runtime_error&) {
+        corruptRejected = true;
+    }
+    std::remove(corruptPath.c_str());
+    std::cout << "Non-snapshot file rejected? " << (rejected ? "Yes" : "No") << ", corrupt value offsets rejected? "
+              << (corruptRejected ? "Yes" : "No") << std::endl;
+    std::remove(snapshotPath.c_str());
+    
+    // Test 19: Write-ahead log replay and checkpoint
+    std::cout << "\nTest 19: Write-ahead log" << std::endl;
+    const std::string logPath = "test_wal.log";
+    std::remove(logPath.c_str());
+    std::remove(snapshotPath.c_str());
+    {
+        std::unique_ptr<Database> logged = Database::recover(2, snapshotPath, logPath);
+        logged->insert({1.0, 1.0}, "one");
+        logged->insert({2.0, 2.0}, "two");
+        logged->insert({3.0, 3.0}, "three");
+        logged->remove({2.0, 2.0});
+        logged->update({1.0, 1.0}, "uno");
+        logged->update({3.0, 3.0}, {4.0, 4.0}, "four");
+    }
+    std::unique_ptr<Database> replayed = Database::recover(2, snapshotPath, logPath);
+    std::cout << "Replayed size: " << replayed->getSize() << ", (1,1) = '" << replayed->getPointValue({1.0, 1.0})
+              << "', (4,4) = '" << replayed->getPointValue({4.0, 4.0}) << "', (2,2) found? "
+              << (replayed->contains({2.0, 2.0}) ? "Yes" : "No") << std::endl;
+    
+    replayed->checkpoint(snapshotPath);
+    replayed->insert({5.0, 5.0}, "five");
+    replayed.reset();
+    replayed = Database::recover(2, snapshotPath, logPath);
+    std::cout << "After checkpoint and one more insert: size " << replayed->getSize() << ", (5,5) = '"
+              << replayed->getPointValue({5.0, 5.0}) << "'" << std::endl;
+    replayed.reset();
+    std::remove(logPath.c_str());
+    std::remove(snapshotPath.c_str());
+    
+    // Test 20: Copy-on-write snapshots keep their view while the Database changes
+    std::cout << "\nTest 20: Copy-on-write snapshots" << std::endl;
+    Database live(2);
+    for (int i = 0; i < 1000; ++i) {
+        live.insert({static_cast<double>(i % 40), static_cast<double>(i / 40)}, "v" + std::to_string(i));
+    }
+    DatabaseSnapshot before = live.snapshot();
+    for (int i = 0; i < 500; ++i) {
+        live.remove({static_cast<double>(i % 40), static_cast<double>(i / 40)});
+    }
+    live.insert({100.0, 100.0}, "new");
+    live.update({39.0, 24.0}, "changed");
+    live.update({38.0, 24.0}, {200.0, 200.0}, "moved");
+    std::cout << "Live size: " << live.getSize() << ", snapshot size: " << before.getSize() << std::endl;
+    std::cout << "Snapshot still sees removed (0,0)? " << (before.getPointValue({0.0, 0.0}) == "v0" ? "Yes" : "No")
+              << ", old value at (39,24)? " << (before.getPointValue({39.0, 24.0}) == "v999" ? "Yes" : "No")
+              << ", misses new point? " << (before.contains({100.0, 100.0}) ? "No" : "Yes") << std::endl;
+    std::cout << "Snapshot range count: " << before.rangeQuery({0.0, 0.0}, {39.0, 24.0}).size()
+              << ", nearest to (200,200): (" << before.nearestNeighbor({200.0, 200.0}).first[0] << ","
+              << before.nearestNeighbor({200.0, 200.0}).first[1] << ")" << std::endl;
+    std::cout << "Live sees the changes? "
+              << (live.getPointValue({39.0, 24.0}) == "changed" && live.contains({200.0, 200.0})
+                  && !live.contains({0.0, 0.0}) ? "Yes" : "No") << std::endl;
+    {
+        DatabaseSnapshot second = live.snapshot();
+        live.clear();
+        std::cout << "Snapshot survives clear? " << (second.getSize() == 501 ? "Yes" : "No") << std::endl;
+    }
+    
+    // Test 21: A sharded database answers like a single one
+    std::cout << "\nTest 21: Sharded database" << std::endl;
+    std::vector<std::pair<std::vector<double>, std::string>> shardPoints;
+    std::mt19937 shardRng(21);
+    std::uniform_real_distribution<double> shardCoord(0.0, 100.0);
+    for (int i = 0; i < 2000; ++i) {
+        shardPoints.push_back({{shardCoord(shardRng), shardCoord(shardRng)}, "s" + std::to_string(i)});
+    }
+    ShardedDatabase sharded(2, 4);
+    Database single(2);
+    sharded.bulkLoad(shardPoints);
+    single.bulkLoad(shardPoints);
+    std::vector<int> shardSizes = sharded.getShardSizes();
+    std::cout << "Shard sizes:";
+    for (int size : shardSizes) std::cout << " " << size;
+    std::cout << ", total " << sharded.getSize() << std::endl;
+    
+    sharded.insert({50.0, 50.0}, "center");
+    single.insert({50.0, 50.0}, "center");
+    sharded.update(shardPoints[0].first, {99.0, 1.0}, "moved");
+    single.update(shardPoints[0].first, {99.0, 1.0}, "moved");
+    sharded.remove(shardPoints[1].first);
+    single.remove(shardPoints[1].first);
+    bool shardRangesMatch = true;
+    bool shardNeighborsMatch = true;
+    for (int i = 0; i < 50; ++i) {
+        double x = shardCoord(shardRng), y = shardCoord(shardRng);
+        shardRangesMatch = shardRangesMatch
+            && sharded.rangeQuery({x, y}, {x + 20.0, y + 20.0}).size() == single.rangeQuery({x, y}, {x + 20.0, y + 20.0}).size();
+        shardNeighborsMatch = shardNeighborsMatch
+            && sharded.kNearestNeighbors({x, y}, 5) == single.kNearestNeighbors({x, y}, 5);
+    }
+    // Shards are searched in parallel; answers spanning several cells, or
+    // from far outside them, must still match
+    bool wideNeighborsMatch = sharded.kNearestNeighbors({-500.0, 300.0}, 3) == single.kNearestNeighbors({-500.0, 300.0}, 3);
+    for (int i = 0; i < 20; ++i) {
+        double x = shardCoord(shardRng), y = shardCoord(shardRng);
+        wideNeighborsMatch = wideNeighborsMatch
+            && sharded.kNearestNeighbors({x, y}, 200) == single.kNearestNeighbors({x, y}, 200);
+    }
+    std::cout << "Range counts match? " << (shardRangesMatch ? "Yes" : "No")
+              << ", kNN(5) matches? " << (shardNeighborsMatch ? "Yes" : "No")
+              << ", kNN(200) and far targets match? " << (wideNeighborsMatch ? "Yes" : "No") << std::endl;
+    std::cout << "Moved point: '" << sharded.getPointValue({99.0, 1.0}) << "', old place found? "
+              << (sharded.contains(shardPoints[0].first) ? "Yes" : "No") << ", size " << sharded.getSize() << std::endl;
+    
+    // Without a sample every insert lands in one cell until there are
+    // enough points to plan all of them
+    ShardedDatabase unplanned(2, 4);
+    for (int i = 0; i < 1100; ++i) {
+        unplanned.insert({shardCoord(shardRng), shardCoord(shardRng)}, "u" + std::to_string(i));
+    }
+    int usedShards = 0;
+    for (int size : unplanned.getShardSizes()) usedShards += size > 0 ? 1 : 0;
+    std::cout << "Without a sample, shards in use after 1100 inserts: " << usedShards << " of 4, size "
+              << unplanned.getSize() << std::endl;
+    
+    // Test 22: Approximate nearest neighbors with an error bound and a visit budget
+    std::cout << "\nTest 22: Approximate nearest neighbors" << std::endl;
+    KDTree wide(8);
+    std::uniform_real_distribution<double> wideCoord(0.0, 1.0);
+    std::vector<Point> widePoints;
+    for (int i = 0; i < 5000; ++i) {
+        std::vector<double> c(8);
+        for (double& x : c) x = wideCoord(shardRng);
+        widePoints.emplace_back(c, "w" + std::to_string(i));
+    }
+    wide.build(widePoints);
+    
+    bool exact = false;
+    std::vector<double> query(8, 0.5);
+    SearchOptions unlimited;
+    Point exactNearest = wide.nearestNeighbor(query);
+    Point sameNearest = wide.nearestNeighbor(query, unlimited, exact);
+    std::cout << "No limits gives the exact answer? "
+              << (sameNearest.getCoordinates() == exactNearest.getCoordinates() && exact ? "Yes" : "No") << std::endl;
+    
+    SearchOptions loose;
+    loose.epsilon = 0.5;
+    bool withinBound = true;
+    for (int i = 0; i < 100; ++i) {
+        for (double& x : query) x = wideCoord(shardRng);
+        std::vector<Point> truth = wide.kNearestNeighbors(query, 5);
+        std::vector<Point> approx = wide.kNearestNeighbors(query, 5, loose, exact);
+        for (size_t j = 0; j < approx.size(); ++j) {
+            double trueDist = std::sqrt(squaredDistance(truth[j].getCoordinates().data(), query.data(), 8));
+            double foundDist = std::sqrt(squaredDistance(approx[j].getCoordinates().data(), query.data(), 8));
+            withinBound = withinBound && approx.size() == truth.size() && foundDist <= 1.5 * trueDist + 1e-12;
+        }
+    }
+    std::cout << "epsilon 0.5 results within 1.5x of exact? " << (withinBound ? "Yes" : "No") << std::endl;
+    
+    SearchOptions budget;
+    budget.maxVisits = 20;
+    std::vector<Point> rushed = wide.kNearestNeighbors(query, 5, budget, exact);
+    std::cout << "20-node budget: " << rushed.size() << " results, exact? " << (exact ? "Yes" : "No") << std::endl;
+    
+    // Test 23: Bucketed leaves
+    std::cout << "\nTest 23: Bucketed leaves" << std::endl;
+    KDTree small(2, 4);
+    for (int x = 0; x < 10; ++x) {
+        for (int y = 0; y < 10; ++y) {
+            small.insert(Point({static_cast<double>(x), static_cast<double>(y)}, "grid"));
+        }
+    }
+    // More copies of one point than a leaf holds cannot be split apart
+    for (int i = 0; i < 12; ++i) {
+        small.insert(Point({3.0, 3.0}, "copy"));
+    }
+    std::cout << "Size: " << small.size() << ", copies found by range: "
+              << small.rangeQuery({3.0, 3.0}, {3.0, 3.0}).size() << ", height: " << small.height() << std::endl;
+    for (int i = 0; i < 13; ++i) {
+        small.remove(Point({3.0, 3.0}));
+    }
+    std::cout << "After removing every copy, found? " << (small.search(Point({3.0, 3.0})) ? "Yes" : "No")
+              << ", nearest to (3,3): (" << small.nearestNeighbor({3.0, 3.0}).getCoordinate(0) << ", "
+              << small.nearestNeighbor({3.0, 3.0}).getCoordinate(1) << ")" << std::endl;
+    
+    KDTree singles(3, 1);
+    KDTree buckets(3);
+    singles.build(dynamicTree.getAllPoints());
+    buckets.build(dynamicTree.getAllPoints());
+    std::cout << "Bytes per point, bucket 1 vs " << KDTree::DEFAULT_BUCKET_SIZE << ": "
+              << singles.memoryUsage() / singles.size() << " vs " << buckets.memoryUsage() / buckets.size()
+              << ", same nearest? "
+              << (singles.nearestNeighbor({500.0, 500.0, 50.0}).distanceTo(std::vector<double>{500.0, 500.0, 50.0})
+                  == buckets.nearestNeighbor({500.0, 500.0, 50.0}).distanceTo(std::vector<double>{500.0, 500.0, 50.0})
+                  ? "Yes" : "No") << std::endl;
+    
+    // Test 24: Bounding boxes
+    std::cout << "\nTest 24: Bounding boxes" << std::endl;
+    KDTree boxed(2, 4);
+    for (int i = 0; i < 200; ++i) {
+        boxed.insert(Point({static_cast<double>(i % 20), static_cast<double>(i / 20)}, "cluster"));
+    }
+    boxed.insert(Point({1000.0, 1000.0}, "outlier"));
+    std::cout << "Range over the cluster: " << boxed.rangeQuery({0.0, 0.0}, {19.0, 9.0}).size()
+              << ", nearest to (900,900): '" << boxed.nearestNeighbor({900.0, 900.0}).getValue() << "'" << std::endl;
+    // Removing the outlier shrinks the boxes back around the cluster
+    boxed.remove(Point({1000.0, 1000.0}));
+    std::vector<Point> nearCorner = boxed.kNearestNeighbors({900.0, 900.0}, 3);
+    std::cout << "After removing it, nearest to (900,900): (" << nearCorner[0].getCoordinate(0) << ", "
+              << nearCorner[0].getCoordinate(1) << "), range over everything: "
+              << boxed.rangeQuery({-1e9, -1e9}, {1e9, 1e9}).size() << std::endl;
+    
+    // Test 25: kNN into a caller-owned buffer
+    std::cout << "\nTest 25: kNN into a reused buffer" << std::endl;
+    std::vector<Neighbor> neighbors;
+    neighbors.reserve(8);
+    const Neighbor* bufferStart = neighbors.data();
+    bool sameAsCopies = true;
+    for (int i = 0; i < 50; ++i) {
+        std::vector<double> probe = {static_cast<double>((i * 53) % 1009), static_cast<double>((i * 17) % 997),
+                                     static_cast<double>(i % 101)};
+        std::vector<Point> copies = dynamicTree.kNearestNeighbors(probe, 8);
+        dynamicTree.kNearestNeighbors(probe, 8, neighbors);
+        sameAsCopies = sameAsCopies && neighbors.size() == copies.size();
+        for (size_t j = 0; sameAsCopies && j < neighbors.size(); ++j) {
+            double distSq = squaredDistance(copies[j].getCoordinates().data(), probe.data(), 3);
+            sameAsCopies = neighbors[j].point.copyCoordinates() == copies[j].getCoordinates()
+                           && std::abs(neighbors[j].distSq - distSq) <= 1e-9 * (1.0 + distSq);
+        }
+    }
+    std::cout << "Views match copied results? " << (sameAsCopies ? "Yes" : "No") << ", buffer reallocated? "
+              << (neighbors.data() != bufferStart ? "Yes" : "No") << std::endl;
+    
+    DatabaseSnapshot frozenView = batchDb.snapshot();
+    frozenView.kNearestNeighbors({0.0, 0.0, 0.0}, 3, neighbors);
+    batchDb.clear();
+    std::cout << "Snapshot views after the database was cleared: " << neighbors.size() << ", nearest value '"
+              << neighbors[0].point.getValue() << "'" << std::endl;
+    
+    // Test 26: Radius queries against a linear scan
+    std::cout << "\nTest 26: Radius queries" << std::endl;
+    std::vector<Point> everyPoint = dynamicTree.getAllPoints();
+    StaticKDTree radiusFlat(dynamicTree);
+    bool radiusMatches = true;
+    for (int i = 0; i < 50; ++i) {
+        std::vector<double> probe = {static_cast<double>((i * 71) % 1009), static_cast<double>((i * 29) % 997),
+                                     static_cast<double>(i % 101)};
+        double radius = 20.0 + 5.0 * (i % 20);
+        size_t expected = 0;
+        for (const Point& p : everyPoint) {
+            expected += squaredDistance(p.getCoordinates().data(), probe.data(), 3) <= radius * radius ? 1 : 0;
+        }
+        radiusMatches = radiusMatches && dynamicTree.radiusQuery(probe, radius).size() == expected
+                        && dynamicTree.radiusCount(probe, radius) == expected
+                        && radiusFlat.radiusQuery(probe, radius).size() == expected
+                        && radiusFlat.radiusCount(probe, radius) == expected;
+    }
+    std::cout << "Radius results match a linear scan? " << (radiusMatches ? "Yes" : "No") << std::endl;
+    
+    Database radiusDb(2);
+    radiusDb.insert({0.0, 0.0}, "origin");
+    radiusDb.insert({3.0, 4.0}, "on the boundary");
+    radiusDb.insert({3.0, 4.1}, "outside");
+    std::cout << "Points within 5 of the origin: " << radiusDb.radiusQuery({0.0, 0.0}, 5.0).size()
+              << " (expected 2), counted: " << radiusDb.radiusCount({0.0, 0.0}, 5.0)
+              << ", negative radius: " << radiusDb.radiusCount({0.0, 0.0}, -1.0) << std::endl;
+    
+    // Test 27: Searches under other metrics against a linear scan
+    std::cout << "\nTest 27: Distance metrics" << std::endl;
+    auto checkMetric = [&](const char* name, const auto& metric) {
+        bool matches = true;
+        for (int i = 0; i < 30; ++i) {
+            std::vector<double> probe = {static_cast<double>((i * 37) % 1009), static_cast<double>((i * 61) % 997),
+                                         static_cast<double>((i * 13) % 101)};
+            std::vector<double> dists;
+            for (const Point& p : everyPoint) {
+                dists.push_back(metric.distance(p.getCoordinates().data(), probe.data(), 3));
+            }
+            std::sort(dists.begin(), dists.end());
+            
+            Point nearest = dynamicTree.nearestNeighbor(probe, metric);
+            dynamicTree.kNearestNeighbors(probe, 5, metric, neighbors);
+            matches = matches && metric.distance(nearest.getCoordinates().data(), probe.data(), 3) == dists[0]
+                      && neighbors.size() == 5;
+            for (size_t j = 0; matches && j < neighbors.size(); ++j) {
+                matches = neighbors[j].distSq == dists[j];
+            }
+            double radius = metric.expand((dists[20] + dists[21]) / 2);
+            size_t inside = std::upper_bound(dists.begin(), dists.end(), metric.reduce(radius)) - dists.begin();
+            matches = matches && dynamicTree.radiusCount(probe, radius, metric) == inside
+                      && dynamicTree.radiusQuery(probe, radius, metric).size() == inside;
+        }
+        std::cout << name << " results match a linear scan? " << (matches ? "Yes" : "No") << std::endl;
+    };
+    checkMetric("Euclidean", EuclideanMetric());
+    checkMetric("Manhattan", ManhattanMetric());
+    checkMetric("Chebyshev", ChebyshevMetric());
+    checkMetric("Weighted Euclidean", WeightedEuclideanMetric({1.0, 4.0, 0.25}));
+    try {
+        dynamicTree.nearestNeighbor({0.0, 0.0, 0.0}, WeightedEuclideanMetric({1.0, 2.0}));
+        std::cout << "Two weights for a 3-d tree accepted? Yes" << std::endl;
+    } catch (const std::invalid_argument& e) {
+        std::cout << "Two weights for a 3-d tree accepted? No (" << e.what() << ")" << std::endl;
+    }
+    
+    // Test 28: Interned values
+    std::cout << "\nTest 28: Interned values" << std::endl;
+    const char* labels[] = {"restaurant", "fuel station with a shop", "parking", "hotel near the station"};
+    KDTree plainLabels(2);
+    KDTree internedLabels(2, KDTree::DEFAULT_BUCKET_SIZE, true);
+    for (int i = 0; i < 5000; ++i) {
+        Point p({static_cast<double>(i % 100), static_cast<double>(i / 100)}, labels[i % 4]);
+        plainLabels.insert(p);
+        internedLabels.insert(p);
+    }
+    std::cout << "Value bytes per point, plain vs interned: " << plainLabels.valueMemoryUsage() / 5000 << " vs "
+              << internedLabels.valueMemoryUsage() / 5000 << std::endl;
+    
+    std::shared_ptr<const KDTree> labelView = internedLabels.snapshot();
+    internedLabels.update(Point({1.0, 0.0}, labels[1]), Point({1.0, 0.0}, "changed"));
+    internedLabels.remove(Point({2.0, 0.0}, labels[2]));
+    std::string kept, after, neighbour;
+    labelView->findValue({1.0, 0.0}, kept);
+    internedLabels.findValue({1.0, 0.0}, after);
+    internedLabels.findValue({5.0, 0.0}, neighbour);
+    labelView.reset();
+    internedLabels.insert(Point({2.0, 0.0}, labels[2]));
+    bool sameValues = true;
+    internedLabels.forEachPoint([&](const PointView& p) {
+        int i = static_cast<int>(p.getCoordinate(1)) * 100 + static_cast<int>(p.getCoordinate(0));
+        sameValues = sameValues && (i == 1 ? p.getValue() == "changed" : p.getValue() == labels[i % 4]);
+        return true;
+    });
+    std::cout << "Snapshot kept '" << kept << "', tree has '" << after << "', shared label intact: '" << neighbour
+              << "', every value right? " << (sameValues ? "Yes" : "No") << std::endl;
+    
+    // Test 29: Query statistics, collected only in a KD_STATS build
+    std::cout << "\nTest 29: Query statistics" << std::endl;
+    Database statsDb(2);
+    for (int i = 0; i < 1000; ++i) {
+        statsDb.insert({static_cast<double>(i % 40), static_cast<double>(i / 40)}, "s");
+    }
+    statsDb.nearestNeighbor({10.3, 10.3});
+    statsDb.kNearestNeighbors({10.3, 10.3}, 5);
+    statsDb.rangeQuery({5.0, 5.0}, {8.0, 8.0});
+    statsDb.radiusCount({20.0, 12.0}, 3.0);
+    statsDb.contains({3.0, 4.0});
+    statsDb.remove({3.0, 4.0});
+    DatabaseStats stats = statsDb.stats();
+    if (stats.enabled) {
+        const OperationStats& nn = stats[DatabaseStats::NEAREST];
+        bool countsRight = stats[DatabaseStats::INSERT].count == 1000 && nn.count == 1
+                           && stats[DatabaseStats::K_NEAREST].count == 1 && stats[DatabaseStats::RANGE].count == 1
+                           && stats[DatabaseStats::RADIUS].count == 1 && stats[DatabaseStats::LOOKUP].count == 1
+                           && stats[DatabaseStats::REMOVE].count == 1;
+        std::cout << "Nearest neighbor in 1000 points: " << nn.work.nodesVisited << " nodes visited, "
+                  << nn.work.distanceEvaluations << " distances, " << nn.work.subtreesPruned
+                  << " subtrees pruned, depth " << nn.work.maxDepth << ", p99 <= " << nn.percentileMicros(0.99)
+                  << " us" << std::endl;
+        std::cout << "Operation counts right? " << (countsRight ? "Yes" : "No") << std::endl;
+        
+        threadQueryStats().reset();
+        dynamicTree.nearestNeighbor({500.0, 500.0, 500.0});
+        QueryStats one = threadQueryStats();
+        std::cout << "One KDTree query: " << one.nodesVisited << " nodes, " << one.distanceEvaluations
+                  << " of " << dynamicTree.size() << " points measured, fewer than all? "
+                  << (one.distanceEvaluations < static_cast<uint64_t>(dynamicTree.size()) ? "Yes" : "No")
+                  << std::endl;
+        
+        statsDb.resetStats();
+        std::cout << "Counts cleared by resetStats? "
+                  << (statsDb.stats()[DatabaseStats::INSERT].count == 0 ? "Yes" : "No") << std::endl;
+    } else {
+        bool allZero = true;
+        for (const OperationStats& op : stats.operations) {
+            allZero = allZero && op.count == 0 && op.work.nodesVisited == 0;
+        }
+        std::cout << "Statistics not compiled in (make STATS=1); every count zero? " << (allZero ? "Yes" : "No")
+                  << std::endl;
+    }
+    
+    // Test 30: Point files for batch loading
+    std::cout << "\nTest 30: Point files" << std::endl;
+    std::mt19937 numberRng(30);
+    std::uniform_real_distribution<double> fraction(-1.0, 1.0);
+    std::uniform_int_distribution<int> scale(-70, 70);
+    const char* formats[] = {"%.17g", "%.6f", "%g", "%.3e", "%.0f", "%.15g", "%.30f"};
+    bool numbersMatch = true;
+    for (int i = 0; i < 30000; ++i) {
+        char text[512];
+        std::snprintf(text, sizeof(text), formats[i % 7], std::ldexp(fraction(numberRng), scale(numberRng)));
+        size_t length = std::strlen(text);
+        double parsed = 0.0;
+        const char* end = parseDouble(text, text + length, parsed);
+        numbersMatch = numbersMatch && end == text + length && parsed == std::strtod(text, nullptr);
+    }
+    const char partial[] = "5.e+x";
+    double partialValue = 0.0;
+    const char* partialEnd = parseDouble(partial, partial + 5, partialValue);
+    const char letters[] = "abc";
+    double untouched = 7.0;
+    std::cout << "30000 formatted numbers read as strtod reads them? " << (numbersMatch ? "Yes" : "No")
+              << ", \"5.e+x\" read as " << partialValue << " up to the e? " << (partialEnd == partial + 2 ? "Yes" : "No")
+              << ", \"abc\" rejected? " << (!parseDouble(letters, letters + 3, untouched) && untouched == 7.0 ? "Yes" : "No")
+              << std::endl;
+    
+    const std::string csvPath = "test_points.csv";
+    const std::string packedPath = "test_points.bin";
+    std::FILE* csv = std::fopen(csvPath.c_str(), "w");
+    std::fputs("x,y,label\n# comment\n\n1.5,2,plain\r\n-3e2 , 4.25,with, commas\n7,8\n", csv);
+    std::fclose(csv);
+    auto csvPoints = readPointFile(csvPath, 2);
+    bool csvRight = csvPoints.size() == 3 && csvPoints[0].first == std::vector<double>({1.5, 2.0})
+                    && csvPoints[0].second == "plain" && csvPoints[1].first == std::vector<double>({-300.0, 4.25})
+                    && csvPoints[1].second == "with, commas" && csvPoints[2].second.empty();
+    writeBinaryPointFile(packedPath, 2, csvPoints);
+    bool packedRight = readPointFile(packedPath, 2) == csvPoints;
+    std::cout << "CSV read right? " << (csvRight ? "Yes" : "No") << ", packed round trip? "
+              << (packedRight ? "Yes" : "No") << std::endl;
+    
+    // The flat batch holds the same points and loads like the pairs do,
+    // the last of repeated coordinates winning
+    PointBatch csvBatch = readPointBatch(csvPath, 2);
+    bool batchRight = csvBatch.size() == csvPoints.size();
+    for (size_t i = 0; batchRight && i < csvBatch.size(); ++i) {
+        batchRight = csvBatch.view(i).copyCoordinates() == csvPoints[i].first
+                     && csvBatch.view(i).getValue() == csvPoints[i].second;
+    }
+    csvBatch.add({1.5, 2.0}, "again");
+    Database fromBatch(2);
+    fromBatch.bulkLoad(csvBatch);
+    std::cout << "Batch matches the pairs? " << (batchRight ? "Yes" : "No") << ", loaded " << fromBatch.getSize()
+              << " points, (1.5,2) = '" << fromBatch.search({1.5, 2.0}) << "'" << std::endl;
+    
+    csv = std::fopen(csvPath.c_str(), "w");
+    std::fputs("1,2,a\n3,oops,b\n", csv);
+    std::fclose(csv);
+    std::string badLine;
+    try {
+        readPointFile(csvPath, 2);
+    } catch (const std::runtime_error& e) {
+        badLine = e.what();
+    }
+    bool wrongDims = false;
+    try {
+        readPointFile(packedPath, 3);
+    } catch (const std::runtime_error&) {
+        wrongDims = true;
+    }
+    csv = std::fopen(csvPath.c_str(), "w");
+    std::fputs("1,2,a\n1e400,2,b\n", csv);
+    std::fclose(csv);
+    std::string overflowLine;
+    try {
+        readPointFile(csvPath, 2);
+    } catch (const std::runtime_error& e) {
+        overflowLine = e.what();
+    }
+    std::cout << "Bad CSV line reported as '" << badLine << "', packed file of other dimensions rejected? "
+              << (wrongDims ? "Yes" : "No") << ", overflow reported as '" << overflowLine << "'" << std::endl;
+    std::remove(csvPath.c_str());
+    std::remove(packedPath.c_str());
+    
+    // Test 31: Nearest neighbor of targets whose distances overflow or are NaN
+    std::cout << "\nTest 31: Far-away and NaN targets" << std::endl;
+    Database lonely(2);
+    lonely.insert({1.0, 2.0}, "only");
+    Database pair(2);
+    pair.insert({1.0, 1.0}, "a");
+    pair.insert({5.0, 5.0}, "b");
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    bool answered = lonely.nearestNeighbor({1e200, 1e200}).second == "only"
+                    && lonely.nearestNeighbor({nan, 0.0}).second == "only"
+                    && !pair.nearestNeighbor({1e200, 1e200}).second.empty()
+                    && !pair.nearestNeighbor({-1e200, nan}).second.empty()
+                    && !pair.nearestNeighbor({std::numeric_limits<double>::infinity(), 0.0}).second.empty();
+    SearchOptions tight;
+    tight.maxVisits = 1;
+    bool approximateExact = false;
+    answered = answered && dynamicTree.nearestNeighbor({1e200, nan, 1e200}, tight, approximateExact).getDimensions() == 3
+               && dynamicTree.nearestNeighbor({1e200, 1e200, 1e200}).getDimensions() == 3;
+    std::cout << "Every far-away or NaN target answered with a stored point? " << (answered ? "Yes" : "No")
+              << std::endl;
+    
+    // Test 32: k nearest neighbors of targets whose distances overflow or are NaN
+    std::cout << "\nTest 32: k nearest of far-away and NaN targets" << std::endl;
+    const double inf = std::numeric_limits<double>::infinity();
+    bool allReturned = pair.kNearestNeighbors({1e200, 1e200}, 2).size() == 2
+                       && pair.kNearestNeighbors({nan, 0.0}, 2).size() == 2
+                       && dynamicTree.kNearestNeighbors({1e200, nan, -1e200}, 3).size() == 3
+                       && single.kNearestNeighbors({inf, 0.0}, 5).size() == 5
+                       && sharded.kNearestNeighbors({-1e200, 1e200}, 5).size() == 5
+                       && sharded.kNearestNeighbors({nan, nan}, 5).size() == 5
+                       && !sharded.nearestNeighbor({inf, inf}).second.empty();
+    std::cout << "k neighbors returned for every far-away or NaN target? " << (allReturned ? "Yes" : "No")
+              << std::endl;
+    
+    // Test 33: Removes compact the subtree they emptied, never the whole tree
+    std::cout << "\nTest 33: Remove latency after a bulk build" << std::endl;
+    std::mt19937 removeRng(33);
+    std::uniform_real_distribution<double> removeCoord(0.0, 1000.0);
+    std::vector<Point> removable;
+    for (int i = 0; i < 200000; ++i) {
+        removable.push_back(Point({removeCoord(removeRng), removeCoord(removeRng)}, "r"));
+    }
+    KDTree removing(2);
+    auto buildStart = std::chrono::steady_clock::now();
+    removing.build(removable);
+    std::chrono::duration<double> buildTime = std::chrono::steady_clock::now() - buildStart;
+    std::shuffle(removable.begin(), removable.end(), removeRng);
+    std::chrono::duration<double> slowestRemove(0.0);
+    bool allRemoved = true;
+    for (size_t i = 0; i < removable.size() * 3 / 5; ++i) {
+        auto removeStart = std::chrono::steady_clock::now();
+        allRemoved = removing.remove(removable[i]) && allRemoved;
+        slowestRemove = std::max<std::chrono::duration<double>>(slowestRemove,
+                                                                std::chrono::steady_clock::now() - removeStart);
+    }
+    allRemoved = allRemoved && static_cast<size_t>(removing.size()) == removable.size() - removable.size() * 3 / 5
+                 && removing.search(removable.back());
+    std::cout << "Every remove succeeded? " << (allRemoved ? "Yes" : "No")
+              << ", slowest remove under a tenth of the bulk build? "
+              << (slowestRemove < buildTime / 10 ? "Yes" : "No") << std::endl;
+    
+    // Test 34: A change whose log write fails is not applied and the log stays usable
+    std::cout << "\nTest 34: Failed log writes" << std::endl;
+    std::remove(logPath.c_str());
+    bool failedWriteThrown = false;
+    bool logUsable = false;
+    {
+        Database logged(2);
+        logged.openLog(logPath);
+        logged.insert({1.0, 1.0}, "kept");
+        struct stat logInfo;
+        ::stat(logPath.c_str(), &logInfo);
+        // Writing past the file size limit fails with EFBIG instead of raising SIGXFSZ
+        std::signal(SIGXFSZ, SIG_IGN);
+        struct rlimit oldLimit;
+        ::getrlimit(RLIMIT_FSIZE, &oldLimit);
+        struct rlimit tightLimit = oldLimit;
+        tightLimit.rlim_cur = static_cast<rlim_t>(logInfo.st_size) + 16;
+        ::setrlimit(RLIMIT_FSIZE, &tightLimit);
+        try {
+            logged.insert({2.0, 2.0}, std::string(100, 'x'));
+        } catch (const std::runtime_error&) {
+            failedWriteThrown = true;
+        }
+        ::setrlimit(RLIMIT_FSIZE, &oldLimit);
+        std::signal(SIGXFSZ, SIG_DFL);
+        failedWriteThrown = failedWriteThrown && !logged.contains({2.0, 2.0});
+        logged.insert({3.0, 3.0}, "after");
+        logUsable = logged.getSize() == 2;
+    }
+    replayed = Database::recover(2, snapshotPath, logPath);
+    logUsable = logUsable && replayed->getSize() == 2 && !replayed->contains({2.0, 2.0})
+                && replayed->getPointValue({3.0, 3.0}) == "after";
+    std::cout << "Failed change thrown and not applied? " << (failedWriteThrown ? "Yes" : "No")
+              << ", later changes logged and replayed without it? " << (logUsable ? "Yes" : "No") << std::endl;
+    replayed.reset();
+    std::remove(logPath.c_str());
+    
+    // Test 35: Logged bulk loads, and changes kept as a delta over the mapped file
+    std::cout << "\nTest 35: Logged bulk load and mapped deltas" << std::endl;
+    std::remove(logPath.c_str());
+    std::remove(snapshotPath.c_str());
+    std::vector<std::pair<std::vector<double>, std::string>> loadBatch;
+    for (int i = 0; i < 1000; ++i) {
+        loadBatch.push_back({{static_cast<double>(i), static_cast<double>(i % 50)}, "b" + std::to_string(i)});
+    }
+    Database reference(2);
+    reference.bulkLoad(loadBatch);
+    struct stat loadLogInfo;
+    auto changeBoth = [&reference](Database& db) {
+        for (Database* target : {&db, &reference}) {
+            target->insert({5000.0, 5000.0}, "new");
+            target->remove({0.0, 0.0});
+            target->update({1.0, 1.0}, "one");
+            target->update({2.0, 2.0}, {6000.0, 6000.0}, "moved");
+        }
+    };
+    auto sameAsReference = [&reference](const Database& db) {
+        std::vector<double> low = {-1e9, -1e9};
+        std::vector<double> high = {1e9, 1e9};
+        auto all = db.rangeQuery(low, high);
+        auto expected = reference.rangeQuery(low, high);
+        std::sort(all.begin(), all.end());
+        std::sort(expected.begin(), expected.end());
+        bool same = all == expected && db.getSize() == reference.getSize()
+                    && db.radiusCount({3.0, 3.0}, 40.0) == reference.radiusCount({3.0, 3.0}, 40.0);
+        for (const auto& target : std::vector<std::vector<double>>{{0.2, 0.1}, {2.1, 2.3}, {5500.0, 5400.0}}) {
+            auto nearest = db.kNearestNeighbors(target, 5);
+            auto expectedNearest = reference.kNearestNeighbors(target, 5);
+            same = same && nearest.size() == expectedNearest.size()
+                   && db.nearestNeighbor(target).first == reference.nearestNeighbor(target).first;
+            for (size_t i = 0; same && i < nearest.size(); ++i) {
+                same = squaredDistance(nearest[i].first.data(), target.data(), 2)
+                       == squaredDistance(expectedNearest[i].first.data(), target.data(), 2);
+            }
+        }
+        return same && !db.contains({0.0, 0.0}) && db.getPointValue({1.0, 1.0}) == "one";
+    };
+    bool loggedLoadSmall = false;
+    bool liveMatches = false;
+    bool snapshotKept = false;
+    {
+        std::unique_ptr<Database> logged = Database::recover(2, snapshotPath, logPath);
+        logged->bulkLoad(loadBatch);
+        ::stat(logPath.c_str(), &loadLogInfo);
+        loggedLoadSmall = loadLogInfo.st_size < 100;
+        DatabaseSnapshot beforeChanges = logged->snapshot();
+        changeBoth(*logged);
+        liveMatches = sameAsReference(*logged);
+        snapshotKept = beforeChanges.getSize() == 1000 && beforeChanges.contains({0.0, 0.0})
+                       && beforeChanges.getPointValue({1.0, 1.0}) == "b1" && !beforeChanges.contains({5000.0, 5000.0});
+    }
+    replayed = Database::recover(2, snapshotPath, logPath);
+    bool replayMatches = sameAsReference(*replayed);
+    changeBoth(*replayed);
+    replayMatches = replayMatches && sameAsReference(*replayed);
+    replayed->checkpoint(snapshotPath);
+    bool loadFileGone = !std::ifstream(logPath + ".load1").good();
+    replayed.reset();
+    std::cout << "Bulk load logged as one record? " << (loggedLoadSmall ? "Yes" : "No")
+              << ", changes over the loaded file match a plain database? " << (liveMatches ? "Yes" : "No")
+              << ", snapshot unchanged? " << (snapshotKept ? "Yes" : "No") << std::endl;
+    std::cout << "Replayed over the loaded file and matches? " << (replayMatches ? "Yes" : "No")
+              << ", load file removed by checkpoint? " << (loadFileGone ? "Yes" : "No") << std::endl;
+    std::remove(logPath.c_str());
+    std::remove(snapshotPath.c_str());
+    
     std::cout << "\n=== All tests completed successfully! ===" << std::endl;
     
     return 0;
@@ -0,0 +1,105 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include "src/Database.h"
+
+int main() {
+    std::cout << "=== Database Update Testing ===" << std::endl;
+    
+    // Test 1: Point lookups
+    std::cout << "\nTest 1: Point lookups" << std::endl;
+    Database db(2);
+    db.insert({2.0, 3.0}, "A");
+    db.insert({5.0, 4.0}, "B");
+    db.insert({9.0, 6.0}, "C");
+    db.insert({4.0, 7.0}, "");
+    
+    std::cout << "search(5,4): '" << db.search({5.0, 4.0}) << "'" << std::endl;
+    std::cout << "getPointValue(9,6): '" << db.getPointValue({9.0, 6.0}) << "'" << std::endl;
+    std::cout << "Contains (4,7) with empty value? " << (db.contains({4.0, 7.0}) ? "Yes" : "No") << std::endl;
+    std::cout << "Contains (1,1)? " << (db.contains({1.0, 1.0}) ? "Yes" : "No") << std::endl;
+    
+    std::string value = "stale";
+    bool found = db.getPointValue({2.0, 3.0}, value);
+    std::cout << "Lookup into buffer: " << (found ? "found" : "missing") << ", value '" << value << "'" << std::endl;
+    
+    // Test 2: Inserting at existing coordinates replaces the value
+    std::cout << "\nTest 2: Insert at existing coordinates" << std::endl;
+    db.insert({2.0, 3.0}, "A2");
+    std::cout << "Size: " << db.getSize() << ", value at (2,3): '" << db.getPointValue({2.0, 3.0}) << "'" << std::endl;
+    
+    // Test 3: Value-only update
+    std::cout << "\nTest 3: Value-only update" << std::endl;
+    std::cout << "Update (5,4) -> 'B2': " << (db.update({5.0, 4.0}, "B2") ? "OK" : "Failed") << std::endl;
+    std::cout << "Update empty-valued (4,7) -> 'D': " << (db.update({4.0, 7.0}, "D") ? "OK" : "Failed") << std::endl;
+    std::cout << "Update missing (1,1): " << (db.update({1.0, 1.0}, "X") ? "OK" : "Failed") << std::endl;
+    std::cout << "Values: '" << db.getPointValue({5.0, 4.0}) << "', '" << db.getPointValue({4.0, 7.0}) << "'" << std::endl;
+    
+    // Test 4: Moving a point
+    std::cout << "\nTest 4: Moving a point" << std::endl;
+    std::cout << "Move (9,6) -> (8,1): " << (db.update({9.0, 6.0}, {8.0, 1.0}, "C2") ? "OK" : "Failed") << std::endl;
+    std::cout << "Old location present? " << (db.contains({9.0, 6.0}) ? "Yes" : "No") << std::endl;
+    std::cout << "New location value: '" << db.getPointValue({8.0, 1.0}) << "'" << std::endl;
+    std::cout << "Nearest to (8,1.1): '" << db.nearestNeighbor({8.0, 1.1}).second << "'" << std::endl;
+    
+    // Test 5: updateAndGetOld returns the value that was stored
+    std::cout << "\nTest 5: updateAndGetOld" << std::endl;
+    auto old = db.updateAndGetOld({5.0, 4.0}, {6.0, 6.0}, "B3");
+    std::cout << "Old value: '" << old.second << "' at (" << old.first[0] << ", " << old.first[1] << ")" << std::endl;
+    std::cout << "Value at (6,6): '" << db.getPointValue({6.0, 6.0}) << "'" << std::endl;
+    auto missing = db.updateAndGetOld({1.0, 1.0}, {2.0, 2.0}, "X");
+    std::cout << "Missing point returns empty? " << (missing.first.empty() ? "Yes" : "No") << std::endl;
+    
+    // Test 6: Remove keeps the index in step with the tree
+    std::cout << "\nTest 6: Remove" << std::endl;
+    std::cout << "Remove (2,3): " << (db.remove({2.0, 3.0}) ? "OK" : "Failed") << std::endl;
+    std::cout << "Remove (2,3) again: " << (db.remove({2.0, 3.0}) ? "OK" : "Failed") << std::endl;
+    std::cout << "Size: " << db.getSize() << ", range query count: "
+              << db.rangeQuery({0.0, 0.0}, {10.0, 10.0}).size() << std::endl;
+    
+    // Test 7: Bulk loads rebuild the index
+    std::cout << "\nTest 7: Bulk load" << std::endl;
+    db.bulkLoad({{{1.0, 1.0}, "P"}, {{8.0, 1.0}, "Q"}, {{1.0, 1.0}, "P2"}}, false);
+    std::cout << "Size after merge: " << db.getSize() << std::endl;
+    std::cout << "Values: (1,1)='" << db.getPointValue({1.0, 1.0}) << "', (8,1)='"
+              << db.getPointValue({8.0, 1.0}) << "', (6,6)='" << db.getPointValue({6.0, 6.0}) << "'" << std::endl;
+    
+    std::vector<std::pair<std::vector<double>, std::string>> grid;
+    for (int x = 0; x < 50; ++x) {
+        for (int y = 0; y < 50; ++y) {
+            grid.push_back({{static_cast<double>(x), static_cast<double>(y)},
+                            std::to_string(x) + "," + std::to_string(y)});
+        }
+    }
+    db.bulkLoad(grid);
+    bool allFound = true;
+    for (const auto& pr : grid) {
+        allFound = allFound && db.getPointValue(pr.first) == pr.second;
+    }
+    std::cout << "Grid size: " << db.getSize() << ", every point found? " << (allFound ? "Yes" : "No") << std::endl;
+    
+    // Test 8: Churn through the index
+    std::cout << "\nTest 8: Remove and update churn" << std::endl;
+    for (int x = 0; x < 50; x += 2) {
+        for (int y = 0; y < 50; ++y) {
+            db.remove({static_cast<double>(x), static_cast<double>(y)});
+        }
+    }
+    for (int x = 1; x < 50; x += 2) {
+        db.update({static_cast<double>(x), 0.0}, "edited");
+    }
+    bool consistent = db.getSize() == 1250;
+    for (const auto& pr : grid) {
+        bool even = static_cast<int>(pr.first[0]) % 2 == 0;
+        std::string expected = pr.first[1] == 0.0 ? "edited" : pr.second;
+        consistent = consistent && db.contains(pr.first) == !even
+                     && (even || db.getPointValue(pr.first) == expected);
+    }
+    std::cout << "Size: " << db.getSize() << ", index matches tree? " << (consistent ? "Yes" : "No") << std::endl;
+    
+    db.clear();
+    std::cout << "After clear, contains (1,1)? " << (db.contains({1.0, 1.0}) ? "Yes" : "No") << std::endl;
+    
+    std::cout << "\n=== All tests completed ===" << std::endl;
+    return 0;
+}